@@ -0,0 +1,18 @@
+QT -= gui
+QT += sql mqtt testlib
+
+CONFIG += c++2a console
+CONFIG -= app_bundle
+
+TARGET = handlerbenchmark
+
+INCLUDEPATH += $$PWD/../../src
+
+DEPENDPATH += $$PWD/../../../messagehandler/lib/include
+INCLUDEPATH += $$PWD/../../../messagehandler/lib/include
+LIBS += -L$$PWD/../../../messagehandler/lib -lmessagehandler
+
+include($$PWD/../../src/databasehandler.pri)
+
+SOURCES += \
+    handlerbenchmark.cpp
@@ -0,0 +1,767 @@
+#include <QtTest>
+#include <QBitArray>
+#include <QCryptographicHash>
+#include <QTemporaryDir>
+
+#include <databasehandler.h>
+#include <timestamp.h>
+
+#include <memory>
+
+//
+// Microbenchmarks of the public DatabaseHandler API
+// Every benchmark runs once per table size, from 10^3 rows up to HOSTSECURE_BENCHMARK_MAX_ROWS (default 10^5,
+// at most 10^7). Each table size has its own database file, filled on first use. The files are kept in
+// HOSTSECURE_BENCHMARK_DIR when set, so later runs and runs on other revisions measure the same data
+//
+
+namespace
+{
+   constexpr qint64 DEFAULT_MAX_ROWS = 100000;
+   constexpr qint64 LARGEST_TABLE_SIZE = 10000000;
+   constexpr qint64 POPULATE_CHUNK_SIZE = 10000;
+   constexpr qint64 LOG_DAYS = 30;
+   constexpr qint64 MICROSECONDS_PER_DAY = 86400000000LL;
+   constexpr qint64 LOG_START = 1630454400000000LL; // 2021-09-01 00:00:00 UTC
+   constexpr qint64 KEY_STRIDE = 7919; // Prime, so consecutive iterations hit keys spread over the table
+
+   QString macAddress(qint64 a_index)
+   {
+      const QString hex = QString("%1").arg(a_index, 10, 16, QChar('0'));
+      QString macAddress = "02";
+      for(int i = 0; i < hex.size(); i += 2)
+      {
+         macAddress.append(':').append(hex.mid(i, 2));
+      }
+      return macAddress;
+   }
+
+   QString productId(qint64 a_index)
+   {
+      return QString("%1").arg(a_index & 0xffff, 4, 16, QChar('0'));
+   }
+
+   QString vendorId(qint64 a_index)
+   {
+      return QString("%1").arg((a_index >> 16) & 0xffff, 4, 16, QChar('0'));
+   }
+
+   QString serialNumber(qint64 a_index)
+   {
+      return QString("SN%1").arg(a_index);
+   }
+
+   QString virusHash(qint64 a_index)
+   {
+      return QCryptographicHash::hash(QByteArray::number(a_index), QCryptographicHash::Md5).toHex();
+   }
+
+   QString logTimestamp(qint64 a_index)
+   {
+      return Timestamp::toText(LOG_START + (a_index % LOG_DAYS) * MICROSECONDS_PER_DAY + (a_index / LOG_DAYS) * 1000);
+   }
+
+   QDateTime logDay(int a_day)
+   {
+      return QDateTime::fromMSecsSinceEpoch((LOG_START + a_day * MICROSECONDS_PER_DAY) / 1000, QTimeZone::UTC);
+   }
+
+   qint64 maxRows()
+   {
+      const qint64 rows = QString(getenv("HOSTSECURE_BENCHMARK_MAX_ROWS")).toLongLong();
+      return rows > 0 ? qMin(rows, LARGEST_TABLE_SIZE) : DEFAULT_MAX_ROWS;
+   }
+}
+
+//!
+//! \brief The HandlerBenchmark class
+//! QtTest benchmark suite measuring point lookups, scans, registrations and status checks of DatabaseHandler
+//!
+class HandlerBenchmark : public QObject
+{
+   Q_OBJECT
+
+private slots:
+   void initTestCase();
+   void cleanupTestCase();
+
+   void getEdgeNode_data() { tableSizes(); }
+   void getEdgeNode();
+   void getAllEdgeNodeKeys_data() { tableSizes(); }
+   void getAllEdgeNodeKeys();
+   void getAllEdgeNodes_data() { tableSizes(); }
+   void getAllEdgeNodes();
+   void getEdgeNodePage_data() { tableSizes(); }
+   void getEdgeNodePage();
+   void getOnlineEdgeNodes_data() { tableSizes(); }
+   void getOnlineEdgeNodes();
+   void registerOrUpdateEdgeNode_data() { tableSizes(); }
+   void registerOrUpdateEdgeNode();
+   void setEdgeNodeOnlineStatus_data() { tableSizes(); }
+   void setEdgeNodeOnlineStatus();
+   void registerOrUpdateEdgeNodes_data() { tableSizes(); }
+   void registerOrUpdateEdgeNodes();
+   void edgesWentOffline_data() { tableSizes(); }
+   void edgesWentOffline();
+
+   void registerDevice_data() { tableSizes(); }
+   void registerDevice();
+   void getDevice_data() { tableSizes(); }
+   void getDevice();
+   void getAllDevices_data() { tableSizes(); }
+   void getAllDevices();
+   void getDevicePage_data() { tableSizes(); }
+   void getDevicePage();
+   void setDeviceBlacklisted_data() { tableSizes(); }
+   void setDeviceBlacklisted();
+   void isDeviceBlackListed_data() { tableSizes(); }
+   void isDeviceBlackListed();
+   void isDeviceWhiteListed_data() { tableSizes(); }
+   void isDeviceWhiteListed();
+   void getDeviceStatus_data() { tableSizes(); }
+   void getDeviceStatus();
+
+   void registerAndUnregisterConnectedDevice_data() { tableSizes(); }
+   void registerAndUnregisterConnectedDevice();
+   void getAllConnectedDevices_data() { tableSizes(); }
+   void getAllConnectedDevices();
+   void unregisterConnectedDevicesOnEdgeNode_data() { tableSizes(); }
+   void unregisterConnectedDevicesOnEdgeNode();
+   void getDevicesConnectedToEdgeNode_data() { tableSizes(); }
+   void getDevicesConnectedToEdgeNode();
+   void isDeviceConnected_data() { tableSizes(); }
+   void isDeviceConnected();
+
+   void registerProductVendor_data() { tableSizes(); }
+   void registerProductVendor();
+   void registerProductVendors_data() { tableSizes(); }
+   void registerProductVendors();
+   void getProductVendor_data() { tableSizes(); }
+   void getProductVendor();
+   void getAllProductVendors_data() { tableSizes(); }
+   void getAllProductVendors();
+
+   void registerVirusHash_data() { tableSizes(); }
+   void registerVirusHash();
+   void getVirusHash_data() { tableSizes(); }
+   void getVirusHash();
+   void isHashInVirusDatabase_data() { tableSizes(); }
+   void isHashInVirusDatabase();
+   void checkVirusHashes_data() { tableSizes(); }
+   void checkVirusHashes();
+   void getAllVirusHashes_data() { tableSizes(); }
+   void getAllVirusHashes();
+
+   void logEvent_data() { tableSizes(); }
+   void logEvent();
+   void getLoggedEvent_data() { tableSizes(); }
+   void getLoggedEvent();
+   void getLoggedEventPage_data() { tableSizes(); }
+   void getLoggedEventPage();
+   void forEachLoggedEventBetween_data() { tableSizes(); }
+   void forEachLoggedEventBetween();
+   void forEachLoggedEventOnEdgeNode_data() { tableSizes(); }
+   void forEachLoggedEventOnEdgeNode();
+   void forEachLoggedEventForDevice_data() { tableSizes(); }
+   void forEachLoggedEventForDevice();
+   void dropLogPartitionsBefore_data() { tableSizes(); }
+   void dropLogPartitionsBefore();
+
+private:
+   void tableSizes();
+   DatabaseHandler& handler(qint64& a_rows);
+   void populate(DatabaseHandler& a_handler, qint64 a_rows);
+
+   std::unique_ptr<QTemporaryDir> m_TemporaryDir;
+   QString m_Directory;
+   std::unique_ptr<DatabaseHandler> m_Handler;
+   qint64 m_HandlerRows = 0;
+   qint64 m_Counter = 0;
+};
+
+//!
+//! \brief The initTestCase function
+//! Selects the directory holding the database files
+//!
+void HandlerBenchmark::initTestCase()
+{
+   m_Directory = QString(getenv("HOSTSECURE_BENCHMARK_DIR"));
+   if(m_Directory.isEmpty())
+   {
+      m_TemporaryDir = std::make_unique<QTemporaryDir>();
+      QVERIFY(m_TemporaryDir->isValid());
+      m_Directory = m_TemporaryDir->path();
+   }
+   QVERIFY(QDir().mkpath(m_Directory));
+}
+
+//!
+//! \brief The cleanupTestCase function
+//! Closes the database before the temporary files are removed
+//!
+void HandlerBenchmark::cleanupTestCase()
+{
+   m_Handler.reset();
+}
+
+//!
+//! \brief The tableSizes function
+//! Adds one data row per table size, in powers of ten up to the configured maximum
+//!
+void HandlerBenchmark::tableSizes()
+{
+   QTest::addColumn<qint64>("rows");
+   const qint64 limit = maxRows();
+   for(qint64 rows = 1000; rows <= limit; rows *= 10)
+   {
+      QTest::addRow("rows=%lld", rows) << rows;
+   }
+}
+
+//!
+//! \brief The handler function
+//! Opens the database of the current table size, filling it when it does not exist yet
+//!
+DatabaseHandler& HandlerBenchmark::handler(qint64& a_rows)
+{
+   QFETCH(qint64, rows);
+   a_rows = rows;
+   if(m_Handler != nullptr && m_HandlerRows == rows)
+   {
+      return *m_Handler;
+   }
+
+   m_Handler.reset();
+
+   const QString path = QString("%1/handler_%2.db").arg(m_Directory).arg(rows);
+   const bool exists = QFile::exists(path);
+   m_Handler = std::make_unique<DatabaseHandler>(path);
+   m_HandlerRows = rows;
+   if(!exists)
+   {
+      populate(*m_Handler, rows);
+   }
+   return *m_Handler;
+}
+
+//!
+//! \brief The populate function
+//! Fills every table with a_rows rows. Every tenth Device is blacklisted and every tenth after that whitelisted,
+//! every Device is connected to its own Edge Node and logged once
+//!
+void HandlerBenchmark::populate(DatabaseHandler& a_handler, qint64 a_rows)
+{
+   qInfo() << "Filling the benchmark database with" << a_rows << "rows per table";
+
+   for(qint64 chunk = 0; chunk < a_rows; chunk += POPULATE_CHUNK_SIZE)
+   {
+      const qint64 end = qMin(chunk + POPULATE_CHUNK_SIZE, a_rows);
+      std::vector<DatabaseHandler::ProductVendor> productVendors;
+      std::vector<DatabaseHandler::VirusHash> virusHashes;
+      productVendors.reserve(end - chunk);
+      virusHashes.reserve(end - chunk);
+
+      for(qint64 i = chunk; i < end; ++i)
+      {
+         productVendors.push_back({ productId(i), QString("Product %1").arg(i), vendorId(i), QString("Vendor %1").arg(i) });
+         virusHashes.push_back({ virusHash(i), QString("Virus %1").arg(i) });
+      }
+
+      // Devices reference their product and vendor, so those rows go first
+      a_handler.beginTransaction();
+      a_handler.registerProductVendors(productVendors);
+      a_handler.registerVirusHashes(virusHashes);
+      for(qint64 i = chunk; i < end; ++i)
+      {
+         const QString timestamp = logTimestamp(i);
+         a_handler.registerOrUpdateEdgeNode(macAddress(i), i % 2 == 0, timestamp);
+         a_handler.registerDevice(productId(i), vendorId(i), serialNumber(i));
+         if(i % 10 == 0)
+         {
+            a_handler.setDeviceBlacklisted(productId(i), vendorId(i), serialNumber(i));
+         }
+         else if(i % 10 == 1)
+         {
+            a_handler.setDeviceWhitelisted(productId(i), vendorId(i), serialNumber(i));
+         }
+         a_handler.registerConnectedDevice(macAddress(i), productId(i), vendorId(i), serialNumber(i), timestamp);
+         a_handler.logEvent(macAddress(i), productId(i), vendorId(i), serialNumber(i), timestamp, "Device connected");
+      }
+      a_handler.commitTransaction();
+   }
+
+   a_handler.reloadCaches();
+}
+
+void HandlerBenchmark::getEdgeNode()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   DatabaseHandler::EdgeNode edgeNode;
+   QBENCHMARK
+   {
+      db.getEdgeNode(edgeNode, macAddress((m_Counter++ * KEY_STRIDE) % rows));
+   }
+}
+
+void HandlerBenchmark::getAllEdgeNodeKeys()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      QVector<QString> macAddresses;
+      db.getAllEdgeNodeKeys(macAddresses);
+   }
+}
+
+void HandlerBenchmark::getAllEdgeNodes()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> edgeNodes;
+      db.getAllEdgeNodes(edgeNodes);
+   }
+}
+
+void HandlerBenchmark::getEdgeNodePage()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   qint64 token = DatabaseHandler::FIRST_PAGE;
+   std::vector<DatabaseHandler::EdgeNode> page;
+   QBENCHMARK
+   {
+      token = db.getEdgeNodePage(page, token);
+   }
+}
+
+void HandlerBenchmark::getOnlineEdgeNodes()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      QVector<QString> macAddresses;
+      db.getOnlineEdgeNodes(macAddresses);
+   }
+}
+
+void HandlerBenchmark::registerOrUpdateEdgeNode()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.registerOrUpdateEdgeNode(macAddress(i), i % 2 == 0, logTimestamp(i));
+   }
+}
+
+void HandlerBenchmark::setEdgeNodeOnlineStatus()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.setEdgeNodeOnlineStatus(macAddress(i), i % 2 == 0, logTimestamp(i));
+   }
+}
+
+void HandlerBenchmark::registerOrUpdateEdgeNodes()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   std::vector<DatabaseHandler::EdgeNode> edgeNodes;
+   for(qint64 i = 0; i < qMin<qint64>(rows, 1000); ++i)
+   {
+      const qint64 key = (i * KEY_STRIDE) % rows;
+      edgeNodes.push_back({ macAddress(key), key % 2 == 0, logTimestamp(key) });
+   }
+   QBENCHMARK
+   {
+      db.registerOrUpdateEdgeNodes(edgeNodes);
+   }
+}
+
+void HandlerBenchmark::edgesWentOffline()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Edge Nodes that are offline already, whose own Device is connected again afterwards, so the tables keep
+      // their contents apart from the logged disconnects
+      const qint64 i = ((m_Counter++ * KEY_STRIDE) % (rows / 2)) * 2 + 1;
+      db.edgesWentOffline({ qMakePair(macAddress(i), logTimestamp(rows + m_Counter)) });
+      db.registerConnectedDevice(macAddress(i), productId(i), vendorId(i), serialNumber(i), logTimestamp(i));
+   }
+}
+
+void HandlerBenchmark::registerDevice()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // New serial numbers of the populated products and vendors
+      const qint64 i = m_Counter++;
+      db.registerDevice(productId(i % rows), vendorId(i % rows), QString("NEW%1").arg(i));
+   }
+}
+
+void HandlerBenchmark::getDevice()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   DatabaseHandler::Device device;
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.getDevice(device, productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::getAllDevices()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      std::vector<std::unique_ptr<DatabaseHandler::Device>> devices;
+      db.getAllDevices(devices);
+   }
+}
+
+void HandlerBenchmark::getDevicePage()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   qint64 token = DatabaseHandler::FIRST_PAGE;
+   std::vector<DatabaseHandler::Device> page;
+   QBENCHMARK
+   {
+      token = db.getDevicePage(page, token);
+   }
+}
+
+void HandlerBenchmark::setDeviceBlacklisted()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Devices that are blacklisted already, so the statuses of the table stay as populated
+      const qint64 i = ((m_Counter++ * KEY_STRIDE) % rows) / 10 * 10;
+      db.setDeviceBlacklisted(productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::isDeviceBlackListed()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.isDeviceBlackListed(productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::isDeviceWhiteListed()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.isDeviceWhiteListed(productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::getDeviceStatus()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.getDeviceStatus(productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::registerAndUnregisterConnectedDevice()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Connects a Device to the next Edge Node and disconnects it again, so the table keeps its size
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      const QString edgeNode = macAddress((i + 1) % rows);
+      db.registerConnectedDevice(edgeNode, productId(i), vendorId(i), serialNumber(i), logTimestamp(i));
+      db.unregisterConnectedDevice(edgeNode, productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::getAllConnectedDevices()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      std::vector<std::unique_ptr<DatabaseHandler::ConnectedDevice>> connectedDevices;
+      db.getAllConnectedDevices(connectedDevices);
+   }
+}
+
+void HandlerBenchmark::unregisterConnectedDevicesOnEdgeNode()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Disconnects every Device of an Edge Node and connects its own Device again, so the table keeps its size
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.unregisterConnectedDevicesOnEdgeNode(macAddress(i));
+      db.registerConnectedDevice(macAddress(i), productId(i), vendorId(i), serialNumber(i), logTimestamp(i));
+   }
+}
+
+void HandlerBenchmark::getDevicesConnectedToEdgeNode()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   std::vector<DatabaseHandler::Device> devices;
+   QBENCHMARK
+   {
+      db.getDevicesConnectedToEdgeNode(devices, macAddress((m_Counter++ * KEY_STRIDE) % rows));
+   }
+}
+
+void HandlerBenchmark::isDeviceConnected()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.isDeviceConnected(productId(i), vendorId(i), serialNumber(i));
+   }
+}
+
+void HandlerBenchmark::registerProductVendor()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.registerProductVendor(productId(i), QString("Product %1").arg(i), vendorId(i), QString("Vendor %1").arg(i));
+   }
+}
+
+void HandlerBenchmark::registerProductVendors()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   std::vector<DatabaseHandler::ProductVendor> productVendors;
+   for(qint64 i = 0; i < qMin<qint64>(rows, 1000); ++i)
+   {
+      const qint64 key = (i * KEY_STRIDE) % rows;
+      productVendors.push_back({ productId(key), QString("Product %1").arg(key), vendorId(key), QString("Vendor %1").arg(key) });
+   }
+   QBENCHMARK
+   {
+      db.registerProductVendors(productVendors);
+   }
+}
+
+void HandlerBenchmark::getProductVendor()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   DatabaseHandler::ProductVendor productVendor;
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.getProductVendor(productVendor, productId(i), vendorId(i));
+   }
+}
+
+void HandlerBenchmark::getAllProductVendors()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      std::vector<std::unique_ptr<DatabaseHandler::ProductVendor>> productVendors;
+      db.getAllProductVendors(productVendors);
+   }
+}
+
+void HandlerBenchmark::registerVirusHash()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = rows + m_Counter++;
+      db.registerVirusHash(virusHash(i), QString("Virus %1").arg(i));
+   }
+}
+
+void HandlerBenchmark::getVirusHash()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   DatabaseHandler::VirusHash hash;
+   QBENCHMARK
+   {
+      db.getVirusHash(hash, virusHash((m_Counter++ * KEY_STRIDE) % rows));
+   }
+}
+
+void HandlerBenchmark::isHashInVirusDatabase()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Every other lookup misses, most scanned files are clean
+      const qint64 i = m_Counter++;
+      db.isHashInVirusDatabase(virusHash(i % 2 == 0 ? (i * KEY_STRIDE) % rows : -i));
+   }
+}
+
+void HandlerBenchmark::checkVirusHashes()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QVector<QString> hashes;
+   for(qint64 i = 0; i < 1000; ++i)
+   {
+      hashes.append(virusHash(i % 2 == 0 ? (i * KEY_STRIDE) % rows : -i - 1));
+   }
+   QBENCHMARK
+   {
+      QBitArray matches;
+      std::vector<std::unique_ptr<DatabaseHandler::VirusHash>> matchingHashes;
+      db.checkVirusHashes(hashes, matches, matchingHashes);
+   }
+}
+
+void HandlerBenchmark::getAllVirusHashes()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      std::vector<std::unique_ptr<DatabaseHandler::VirusHash>> virusHashes;
+      db.getAllVirusHashes(virusHashes);
+   }
+}
+
+void HandlerBenchmark::logEvent()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.logEvent(macAddress(i), productId(i), vendorId(i), serialNumber(i), logTimestamp(rows + m_Counter), "Device disconnected");
+   }
+}
+
+void HandlerBenchmark::getLoggedEvent()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   DatabaseHandler::LogEvent logEvent;
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.getLoggedEvent(logEvent, macAddress(i), productId(i), vendorId(i), serialNumber(i), logTimestamp(i));
+   }
+}
+
+void HandlerBenchmark::getLoggedEventPage()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   qint64 token = DatabaseHandler::FIRST_PAGE;
+   std::vector<DatabaseHandler::LogEvent> page;
+   QBENCHMARK
+   {
+      token = db.getLoggedEventPage(page, token);
+   }
+}
+
+void HandlerBenchmark::forEachLoggedEventBetween()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // One day out of the logged month
+      const int day = static_cast<int>(m_Counter++ % LOG_DAYS);
+      qint64 events = 0;
+      db.forEachLoggedEventBetween(logDay(day), logDay(day + 1), [&events](const DatabaseHandler::LogEvent&)
+      {
+         ++events;
+         return true;
+      });
+   }
+}
+
+void HandlerBenchmark::forEachLoggedEventOnEdgeNode()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      qint64 events = 0;
+      db.forEachLoggedEventOnEdgeNode(macAddress(i), logDay(0), logDay(LOG_DAYS + 1), [&events](const DatabaseHandler::LogEvent&)
+      {
+         ++events;
+         return true;
+      });
+   }
+}
+
+void HandlerBenchmark::forEachLoggedEventForDevice()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      qint64 events = 0;
+      db.forEachLoggedEventForDevice(productId(i), vendorId(i), serialNumber(i), logDay(0), logDay(LOG_DAYS + 1), [&events](const DatabaseHandler::LogEvent&)
+      {
+         ++events;
+         return true;
+      });
+   }
+}
+
+void HandlerBenchmark::dropLogPartitionsBefore()
+{
+   qint64 rows = 0;
+   DatabaseHandler& db = handler(rows);
+   QBENCHMARK
+   {
+      // Logs one event on the day before the logged month and drops its partition again, the month stays as populated
+      const qint64 i = (m_Counter++ * KEY_STRIDE) % rows;
+      db.logEvent(macAddress(i), productId(i), vendorId(i), serialNumber(i), Timestamp::toText(LOG_START - MICROSECONDS_PER_DAY), "Device connected");
+      db.dropLogPartitionsBefore(logDay(0));
+   }
+}
+
+QTEST_GUILESS_MAIN(HandlerBenchmark)
+
+#include "handlerbenchmark.moc"
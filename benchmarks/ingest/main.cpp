@@ -0,0 +1,307 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <databasehandler.h>
+#include <databasemanager.h>
+#include <databasemqttclient.h>
+#include <databasewriter.h>
+#include <timestamp.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+//
+// Ingest throughput benchmark
+// Generates synthetic Edge Node and Device traffic for a configurable fleet and pushes it through
+// DatabaseMqttClient::processMessage, the DatabaseManager slots and the DatabaseWriter into SQLite.
+// The broker is bypassed, messages are handed to the client exactly as the subscription would.
+// Prints a JSON report with messages/sec, end-to-end latency percentiles and commits per message
+//
+
+namespace
+{
+   struct Message
+   {
+      QMqttTopicName topic;
+      QByteArray payload;
+   };
+
+   struct Settings
+   {
+      int edges = 100;
+      int devicesPerEdge = 4;
+      int rounds = 10;
+      QString databasePath;
+      QString outputPath;
+   };
+
+   //!
+   //! \brief The edgeMacAddress function
+   //! Creates a unique locally administered MAC address for the synthetic Edge Node a_index
+   //!
+   QString edgeMacAddress(int a_index)
+   {
+      const QString hex = QString("%1").arg(a_index, 10, 16, QChar('0'));
+      QString macAddress = "02";
+      for(int i = 0; i < hex.size(); i += 2)
+      {
+         macAddress.append(':').append(hex.mid(i, 2));
+      }
+      return macAddress;
+   }
+
+   //!
+   //! \brief The deviceVendorId function
+   //! Creates the vendor ID of the synthetic Device a_device of every Edge Node
+   //!
+   QString deviceVendorId(int a_device)
+   {
+      return QString("%1").arg(0x1000 + a_device, 4, 16, QChar('0'));
+   }
+
+   //!
+   //! \brief The deviceProductId function
+   //! Creates the product ID of the synthetic Devices of the Edge Node a_edge
+   //!
+   QString deviceProductId(int a_edge)
+   {
+      return QString("%1").arg(a_edge % 0x10000, 4, 16, QChar('0'));
+   }
+
+   //!
+   //! \brief The generateProductVendors function
+   //! Creates the productvendor rows of every synthetic Device, which must exist before the Devices are registered
+   //!
+   std::vector<DatabaseHandler::ProductVendor> generateProductVendors(const Settings& a_settings)
+   {
+      std::vector<DatabaseHandler::ProductVendor> productVendors;
+      const int edges = qMin(a_settings.edges, 0x10000);
+      productVendors.reserve(static_cast<std::size_t>(edges) * a_settings.devicesPerEdge);
+      for(int edge = 0; edge < edges; ++edge)
+      {
+         for(int device = 0; device < a_settings.devicesPerEdge; ++device)
+         {
+            productVendors.push_back({ deviceProductId(edge), QString("Product %1").arg(edge), deviceVendorId(device), QString("Vendor %1").arg(device) });
+         }
+      }
+      return productVendors;
+   }
+
+   //!
+   //! \brief The generateTraffic function
+   //! Creates the messages of all rounds up front so payload creation is not part of the measurement.
+   //! Every round each Edge Node sends a heartbeat and each of its Devices alternates between connected and removed
+   //!
+   std::vector<Message> generateTraffic(const Settings& a_settings)
+   {
+      std::vector<Message> messages;
+      messages.reserve(static_cast<std::size_t>(a_settings.rounds) * a_settings.edges * (1 + a_settings.devicesPerEdge));
+
+      for(int round = 0; round < a_settings.rounds; ++round)
+      {
+         const bool connect = round % 2 == 0;
+         for(int edge = 0; edge < a_settings.edges; ++edge)
+         {
+            const QString edgeTopic = QString("edges/%1").arg(edgeMacAddress(edge));
+
+            MsgEdge edgeSample;
+            edgeSample.isOnline = true;
+            messages.push_back({ QMqttTopicName(edgeTopic), QJsonDocument(edgeSample.toJson()).toJson(QJsonDocument::Compact) });
+
+            for(int device = 0; device < a_settings.devicesPerEdge; ++device)
+            {
+               const QString deviceId = deviceVendorId(device) + ":" + deviceProductId(edge);
+               QByteArray payload;
+               if(connect)
+               {
+                  MsgDevice deviceSample;
+                  deviceSample.deviceSerial = QString("SN%1-%2").arg(edge).arg(device);
+                  deviceSample.lastHeartBeat = Timestamp::nowText();
+                  payload = QJsonDocument(deviceSample.toJson()).toJson(QJsonDocument::Compact);
+               }
+               messages.push_back({ QMqttTopicName(edgeTopic + "/" + deviceId), payload });
+            }
+         }
+      }
+      return messages;
+   }
+
+   //!
+   //! \brief The percentile function
+   //! Retrieves the a_fraction percentile of the sorted latencies in microseconds
+   //!
+   double percentile(const std::vector<qint64>& a_sortedNanoseconds, double a_fraction)
+   {
+      if(a_sortedNanoseconds.empty())
+      {
+         return 0.0;
+      }
+      const std::size_t index = static_cast<std::size_t>(a_fraction * (a_sortedNanoseconds.size() - 1));
+      return a_sortedNanoseconds[index] / 1000.0;
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   QCoreApplication app(argc, argv);
+
+   QCommandLineParser parser;
+   parser.setApplicationDescription("Measures how many edges/# messages per second the databasehandler can absorb");
+   parser.addHelpOption();
+   parser.addOption({ "edges", "Number of Edge Nodes in the fleet.", "count", "100" });
+   parser.addOption({ "devices", "Number of Devices per Edge Node.", "count", "4" });
+   parser.addOption({ "rounds", "Number of traffic rounds.", "count", "10" });
+   parser.addOption({ "database", "Database file to write to. Defaults to a temporary file.", "path" });
+   parser.addOption({ "output", "File to write the JSON report to in addition to stdout.", "path" });
+   parser.process(app);
+
+   Settings settings;
+   settings.edges = qMax(1, parser.value("edges").toInt());
+   settings.devicesPerEdge = qMax(0, parser.value("devices").toInt());
+   settings.rounds = qMax(1, parser.value("rounds").toInt());
+   settings.databasePath = parser.value("database");
+   settings.outputPath = parser.value("output");
+
+   QTemporaryDir temporaryDir;
+   if(settings.databasePath.isEmpty())
+   {
+      settings.databasePath = temporaryDir.filePath("ingest.db");
+   }
+
+   const std::vector<Message> messages = generateTraffic(settings);
+   const DatabaseWriter::Settings writerSettings = DatabaseWriter::Settings::fromEnvironment();
+
+   // Messages that enqueue a write wait for the commit of that write. The rest, such as coalesced heartbeats, only
+   // wait for the slot to return
+   QElapsedTimer clock;
+   QMutex latencyMutex;
+   std::deque<std::pair<quint64, qint64>> pendingMessages;
+   std::vector<qint64> latencies;
+   latencies.reserve(messages.size());
+   quint64 coalescedMessages = 0;
+   quint64 committedWrites = 0;
+
+   qint64 elapsed = 0;
+   DatabaseWriter::Metrics writerMetrics;
+   {
+      auto databaseHandler = std::make_shared<DatabaseHandler>(settings.databasePath);
+      databaseHandler->registerProductVendors(generateProductVendors(settings));
+      auto databaseWriter = std::make_unique<DatabaseWriter>(databaseHandler, writerSettings);
+      DatabaseWriter* writer = databaseWriter.get();
+      writer->setCommitObserver([&](quint64 a_processed)
+      {
+         const qint64 now = clock.nsecsElapsed();
+         QMutexLocker locker(&latencyMutex);
+         committedWrites = a_processed;
+         while(!pendingMessages.empty() && pendingMessages.front().first <= a_processed)
+         {
+            latencies.push_back(now - pendingMessages.front().second);
+            pendingMessages.pop_front();
+         }
+      });
+
+      auto mqttClient = std::make_shared<DatabaseMqttClient>(nullptr, false);
+      DatabaseManager manager(databaseHandler, std::move(databaseWriter), mqttClient);
+      const quint64 enqueuedBefore = writer->getMetrics().enqueued;
+
+      clock.start();
+      quint64 enqueued = enqueuedBefore;
+      for(const Message& message : messages)
+      {
+         const qint64 start = clock.nsecsElapsed();
+         mqttClient->processMessage(message.topic, message.payload);
+
+         const quint64 enqueuedAfter = writer->getMetrics().enqueued;
+         QMutexLocker locker(&latencyMutex);
+         if(enqueuedAfter != enqueued)
+         {
+            // The write may already have been committed before the message was registered as pending
+            if(committedWrites >= enqueuedAfter)
+            {
+               latencies.push_back(clock.nsecsElapsed() - start);
+            }
+            else
+            {
+               pendingMessages.emplace_back(enqueuedAfter, start);
+            }
+            enqueued = enqueuedAfter;
+         }
+         else
+         {
+            latencies.push_back(clock.nsecsElapsed() - start);
+            ++coalescedMessages;
+         }
+      }
+      writer->flush();
+      elapsed = clock.nsecsElapsed();
+      writerMetrics = writer->getMetrics();
+      writerMetrics.enqueued -= enqueuedBefore;
+      writer->setCommitObserver(nullptr);
+   }
+
+   std::sort(latencies.begin(), latencies.end());
+
+   const double seconds = elapsed / 1e9;
+   const double messageCount = static_cast<double>(messages.size());
+
+   QJsonObject configuration;
+   configuration["edges"] = settings.edges;
+   configuration["devicesPerEdge"] = settings.devicesPerEdge;
+   configuration["rounds"] = settings.rounds;
+   configuration["maxBatchSize"] = writerSettings.maxBatchSize;
+   configuration["maxBatchDelayMs"] = writerSettings.maxBatchDelayMs;
+   configuration["synchronous"] = writerSettings.synchronousMode == DatabaseHandler::SynchronousMode::Full ? "FULL"
+                                : writerSettings.synchronousMode == DatabaseHandler::SynchronousMode::Off ? "OFF" : "NORMAL";
+
+   QJsonObject latency;
+   latency["p50"] = percentile(latencies, 0.50);
+   latency["p99"] = percentile(latencies, 0.99);
+   latency["p999"] = percentile(latencies, 0.999);
+   latency["max"] = percentile(latencies, 1.0);
+
+   // Every commit writes the WAL once, and syncs it when synchronous is FULL. With NORMAL the WAL is only
+   // synced on checkpoints, so the commits are an upper bound of the fsyncs
+   QJsonObject report;
+   report["benchmark"] = "ingest";
+   report["configuration"] = configuration;
+   report["messages"] = static_cast<qint64>(messages.size());
+   report["coalescedMessages"] = static_cast<qint64>(coalescedMessages);
+   report["writes"] = static_cast<qint64>(writerMetrics.enqueued);
+   report["failedWrites"] = static_cast<qint64>(writerMetrics.failed);
+   report["commits"] = static_cast<qint64>(writerMetrics.batches);
+   report["seconds"] = seconds;
+   report["messagesPerSecond"] = seconds > 0 ? messageCount / seconds : 0.0;
+   report["fsyncsPerMessage"] = messageCount > 0 ? writerMetrics.batches / messageCount : 0.0;
+   report["latencyMicroseconds"] = latency;
+
+   const QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+   QTextStream(stdout) << json;
+
+   if(!settings.outputPath.isEmpty())
+   {
+      QFile output(settings.outputPath);
+      if(!output.open(QIODevice::WriteOnly | QIODevice::Truncate) || output.write(json) != json.size())
+      {
+         qCritical() << "Failed to write the report to" << settings.outputPath;
+         return 1;
+      }
+   }
+
+   if(writerMetrics.failed != 0)
+   {
+      qCritical() << writerMetrics.failed << "database writes failed, the measurement is not valid";
+      return 1;
+   }
+
+   return 0;
+}
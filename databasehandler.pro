@@ -7,28 +7,27 @@ CONFIG -= app_bundle
 # If release build
 CONFIG(release, debug|release) {
     DEFINES += QT_NO_DEBUG_OUTPUT
+    # Keeps file and line in the message context, so the log rate limiter tells call sites apart
+    DEFINES += QT_MESSAGELOGCONTEXT
 }
 
+# Compiles out the per-operation latency histograms of DatabaseHandler
+# DEFINES += HOSTSECURE_NO_OPERATION_METRICS
+
 INCLUDEPATH += src
 
 DEPENDPATH += ../messagehandler/lib/include
 INCLUDEPATH += ../messagehandler/lib/include
 LIBS += -L../messagehandler/lib -lmessagehandler
 
+include(src/databasehandler.pri)
+
 SOURCES += \
     main.cpp \
-    src/databasedatafileparser.cpp \
-    src/databasehandler.cpp \
-    src/databasemanager.cpp \
-    src/databasemqttclient.cpp \
     src/loghandler.cpp \
     src/testhandler.cpp
 
 HEADERS += \
-    src/databasedatafileparser.h \
-    src/databasehandler.h \
-    src/databasemanager.h \
-    src/databasemqttclient.h \
     src/loghandler.h \
     src/testhandler.h
 
@@ -6,10 +6,10 @@
 
 int main(int argc, char *argv[])
 {
-    bool test = false;
     LogHandler logger;
 
     QCoreApplication a(argc, argv);
+    const bool test = a.arguments().contains("--test");
 
     const char* dataDir = getenv("HOSTSECURE_DATA_DIR");
     if(dataDir == nullptr)
@@ -21,7 +21,7 @@ int main(int argc, char *argv[])
     {
         TestHandler testHandler(QString(dataDir).append("/Databases/testcases.db"));
         testHandler.testCaseAll();
-        return a.exec();
+        return 0;
     }
     else
     {
@@ -0,0 +1,240 @@
+#include "asyncdatabasehandler.h"
+#include "databaseconnectionpool.h"
+
+#include <QSemaphore>
+
+namespace
+{
+   template<typename T>
+   DatabaseHandler::RowCallback<T> appendTo(std::vector<T>& a_rows)
+   {
+      return [&a_rows](const T& a_row)
+      {
+         a_rows.push_back(a_row);
+         return true;
+      };
+   }
+}
+
+//!
+//! \brief The AsyncDatabaseHandler constructor
+//! Sizes the thread pool to the number of reader connections. Pool threads keep their connection until destruction
+//!
+AsyncDatabaseHandler::AsyncDatabaseHandler(DatabaseHandler& a_databaseHandler)
+   : m_DatabaseHandler(a_databaseHandler)
+{
+   m_ThreadPool.setMaxThreadCount(DatabaseConnectionPool::maxReadersFromEnvironment());
+   m_ThreadPool.setExpiryTimeout(-1);
+}
+
+//!
+//! \brief The AsyncDatabaseHandler destructor
+//! Waits for all queries and lets every pool thread release its connection
+//!
+AsyncDatabaseHandler::~AsyncDatabaseHandler()
+{
+   m_ThreadPool.waitForDone();
+
+   // Each release task blocks until all of them have run, so every pool thread runs exactly one
+   const int threads = m_ThreadPool.maxThreadCount();
+   QSemaphore released;
+   QSemaphore barrier;
+   for(int i = 0; i < threads; ++i)
+   {
+      m_ThreadPool.start([this, &released, &barrier]()
+      {
+         m_DatabaseHandler.releaseThreadConnection();
+         released.release();
+         barrier.acquire();
+      });
+   }
+   released.acquire(threads);
+   barrier.release(threads);
+   m_ThreadPool.waitForDone();
+}
+
+//!
+//! \brief The getEdgeNode function
+//! Retrieves an Edge Node, or nothing if it does not exist
+//!
+QFuture<std::optional<DatabaseHandler::EdgeNode>> AsyncDatabaseHandler::getEdgeNode(const QString& a_macAddress)
+{
+   return run([a_macAddress](DatabaseHandler& a_handler)
+   {
+      DatabaseHandler::EdgeNode edgeNode;
+      return a_handler.getEdgeNode(edgeNode, a_macAddress) ? std::make_optional(edgeNode) : std::nullopt;
+   });
+}
+
+//!
+//! \brief The getAllEdgeNodes function
+//! Retrieves all Edge Nodes
+//!
+QFuture<std::vector<DatabaseHandler::EdgeNode>> AsyncDatabaseHandler::getAllEdgeNodes()
+{
+   return run([](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::EdgeNode> edgeNodes;
+      a_handler.forEachEdgeNode(appendTo(edgeNodes));
+      return edgeNodes;
+   });
+}
+
+//!
+//! \brief The getOnlineEdgeNodes function
+//! Retrieves the mac addresses of all online Edge Nodes
+//!
+QFuture<QVector<QString>> AsyncDatabaseHandler::getOnlineEdgeNodes()
+{
+   return run([](DatabaseHandler& a_handler)
+   {
+      QVector<QString> macAddresses;
+      a_handler.getOnlineEdgeNodes(macAddresses);
+      return macAddresses;
+   });
+}
+
+//!
+//! \brief The getDevice function
+//! Retrieves a Device, or nothing if it does not exist
+//!
+QFuture<std::optional<DatabaseHandler::Device>> AsyncDatabaseHandler::getDevice(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber)
+{
+   return run([a_productId, a_vendorId, a_serialNumber](DatabaseHandler& a_handler)
+   {
+      DatabaseHandler::Device device;
+      return a_handler.getDevice(device, a_productId, a_vendorId, a_serialNumber) ? std::make_optional(device) : std::nullopt;
+   });
+}
+
+//!
+//! \brief The getAllDevices function
+//! Retrieves all Devices
+//!
+QFuture<std::vector<DatabaseHandler::Device>> AsyncDatabaseHandler::getAllDevices()
+{
+   return run([](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::Device> devices;
+      a_handler.forEachDevice(appendTo(devices));
+      return devices;
+   });
+}
+
+//!
+//! \brief The isDeviceBlackListed function
+//! Checks if a Device is blacklisted
+//!
+QFuture<bool> AsyncDatabaseHandler::isDeviceBlackListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber)
+{
+   return run([a_productId, a_vendorId, a_serialNumber](DatabaseHandler& a_handler)
+   {
+      return a_handler.isDeviceBlackListed(a_productId, a_vendorId, a_serialNumber);
+   });
+}
+
+//!
+//! \brief The isDeviceWhiteListed function
+//! Checks if a Device is whitelisted
+//!
+QFuture<bool> AsyncDatabaseHandler::isDeviceWhiteListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber)
+{
+   return run([a_productId, a_vendorId, a_serialNumber](DatabaseHandler& a_handler)
+   {
+      return a_handler.isDeviceWhiteListed(a_productId, a_vendorId, a_serialNumber);
+   });
+}
+
+//!
+//! \brief The getAllConnectedDevices function
+//! Retrieves all connected Devices
+//!
+QFuture<std::vector<DatabaseHandler::ConnectedDevice>> AsyncDatabaseHandler::getAllConnectedDevices()
+{
+   return run([](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::ConnectedDevice> connectedDevices;
+      a_handler.forEachConnectedDevice(appendTo(connectedDevices));
+      return connectedDevices;
+   });
+}
+
+//!
+//! \brief The getProductVendor function
+//! Retrieves a productvendor, or nothing if it does not exist
+//!
+QFuture<std::optional<DatabaseHandler::ProductVendor>> AsyncDatabaseHandler::getProductVendor(const QString& a_productId, const QString& a_vendorId)
+{
+   return run([a_productId, a_vendorId](DatabaseHandler& a_handler)
+   {
+      DatabaseHandler::ProductVendor productVendor;
+      return a_handler.getProductVendor(productVendor, a_productId, a_vendorId) ? std::make_optional(productVendor) : std::nullopt;
+   });
+}
+
+//!
+//! \brief The getVirusHash function
+//! Retrieves a virus hash, or nothing if it does not exist
+//!
+QFuture<std::optional<DatabaseHandler::VirusHash>> AsyncDatabaseHandler::getVirusHash(const QString& a_virusHash)
+{
+   return run([a_virusHash](DatabaseHandler& a_handler)
+   {
+      DatabaseHandler::VirusHash virusHash;
+      return a_handler.getVirusHash(virusHash, a_virusHash) ? std::make_optional(virusHash) : std::nullopt;
+   });
+}
+
+//!
+//! \brief The isHashInVirusDatabase function
+//! Checks if a hash is a known virus hash
+//!
+QFuture<bool> AsyncDatabaseHandler::isHashInVirusDatabase(const QString& a_hash)
+{
+   return run([a_hash](DatabaseHandler& a_handler)
+   {
+      return a_handler.isHashInVirusDatabase(a_hash);
+   });
+}
+
+//!
+//! \brief The getLoggedEventsBetween function
+//! Retrieves all events logged in [a_from, a_to), oldest first
+//!
+QFuture<std::vector<DatabaseHandler::LogEvent>> AsyncDatabaseHandler::getLoggedEventsBetween(const QDateTime& a_from, const QDateTime& a_to)
+{
+   return run([a_from, a_to](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::LogEvent> logEvents;
+      a_handler.forEachLoggedEventBetween(a_from, a_to, appendTo(logEvents));
+      return logEvents;
+   });
+}
+
+//!
+//! \brief The getLoggedEventsOnEdgeNode function
+//! Retrieves the events logged on an Edge Node in [a_from, a_to), oldest first
+//!
+QFuture<std::vector<DatabaseHandler::LogEvent>> AsyncDatabaseHandler::getLoggedEventsOnEdgeNode(const QString& a_edgeNodeMacAddress, const QDateTime& a_from, const QDateTime& a_to)
+{
+   return run([a_edgeNodeMacAddress, a_from, a_to](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::LogEvent> logEvents;
+      a_handler.forEachLoggedEventOnEdgeNode(a_edgeNodeMacAddress, a_from, a_to, appendTo(logEvents));
+      return logEvents;
+   });
+}
+
+//!
+//! \brief The getLoggedEventsForDevice function
+//! Retrieves the events logged for a Device in [a_from, a_to), oldest first
+//!
+QFuture<std::vector<DatabaseHandler::LogEvent>> AsyncDatabaseHandler::getLoggedEventsForDevice(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QDateTime& a_from, const QDateTime& a_to)
+{
+   return run([a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber, a_from, a_to](DatabaseHandler& a_handler)
+   {
+      std::vector<DatabaseHandler::LogEvent> logEvents;
+      a_handler.forEachLoggedEventForDevice(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber, a_from, a_to, appendTo(logEvents));
+      return logEvents;
+   });
+}
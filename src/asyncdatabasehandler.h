@@ -0,0 +1,96 @@
+#pragma once
+#include "databasehandler.h"
+
+#include <QFuture>
+#include <QPromise>
+#include <QThreadPool>
+#include <QDateTime>
+
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+//!
+//! \brief The AsyncDatabaseHandler class
+//! Runs DatabaseHandler queries on a dedicated thread pool and returns their results as QFutures,
+//! so callers on the event loop never block on SQLite. Chain work with QFuture::then.
+//! Exceptions thrown by a query are stored in its future and rethrown by QFuture::result() or handled by onFailed().
+//! Every pool thread reads through its own query only connection, so only read queries may be run;
+//! writes belong on the DatabaseWriter. The handler must outlive this object
+//!
+class AsyncDatabaseHandler
+{
+public:
+    explicit AsyncDatabaseHandler(DatabaseHandler& a_databaseHandler);
+    ~AsyncDatabaseHandler();
+
+    template<typename Function>
+    auto run(Function a_function) -> QFuture<std::invoke_result_t<Function, DatabaseHandler&>>;
+
+    // Edge node
+    QFuture<std::optional<DatabaseHandler::EdgeNode>> getEdgeNode(const QString& a_macAddress);
+    QFuture<std::vector<DatabaseHandler::EdgeNode>> getAllEdgeNodes();
+    QFuture<QVector<QString>> getOnlineEdgeNodes();
+
+    // Device
+    QFuture<std::optional<DatabaseHandler::Device>> getDevice(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber);
+    QFuture<std::vector<DatabaseHandler::Device>> getAllDevices();
+    QFuture<bool> isDeviceBlackListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber);
+    QFuture<bool> isDeviceWhiteListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber);
+
+    // Connected devices
+    QFuture<std::vector<DatabaseHandler::ConnectedDevice>> getAllConnectedDevices();
+
+    // ProductVendor
+    QFuture<std::optional<DatabaseHandler::ProductVendor>> getProductVendor(const QString& a_productId, const QString& a_vendorId);
+
+    // Virus
+    QFuture<std::optional<DatabaseHandler::VirusHash>> getVirusHash(const QString& a_virusHash);
+    QFuture<bool> isHashInVirusDatabase(const QString& a_hash);
+
+    // Event logging
+    QFuture<std::vector<DatabaseHandler::LogEvent>> getLoggedEventsBetween(const QDateTime& a_from, const QDateTime& a_to);
+    QFuture<std::vector<DatabaseHandler::LogEvent>> getLoggedEventsOnEdgeNode(const QString& a_edgeNodeMacAddress, const QDateTime& a_from, const QDateTime& a_to);
+    QFuture<std::vector<DatabaseHandler::LogEvent>> getLoggedEventsForDevice(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QDateTime& a_from, const QDateTime& a_to);
+
+private:
+    DatabaseHandler& m_DatabaseHandler;
+    QThreadPool m_ThreadPool;
+};
+
+//!
+//! \brief The run function
+//! Runs a_function with the handler on the thread pool and returns a future for its result
+//!
+template<typename Function>
+auto AsyncDatabaseHandler::run(Function a_function) -> QFuture<std::invoke_result_t<Function, DatabaseHandler&>>
+{
+    using Result = std::invoke_result_t<Function, DatabaseHandler&>;
+
+    // QThreadPool takes copyable tasks, so the move only promise is shared with the task
+    auto promise = std::make_shared<QPromise<Result>>();
+    QFuture<Result> future = promise->future();
+    promise->start();
+
+    m_ThreadPool.start([this, promise, function = std::move(a_function)]() mutable
+    {
+        try
+        {
+            if constexpr (std::is_void_v<Result>)
+            {
+                function(m_DatabaseHandler);
+            }
+            else
+            {
+                promise->addResult(function(m_DatabaseHandler));
+            }
+        }
+        catch(...)
+        {
+            promise->setException(std::current_exception());
+        }
+        promise->finish();
+    });
+
+    return future;
+}
@@ -0,0 +1,133 @@
+#include "compactids.h"
+
+#include <cstdlib>
+
+namespace
+{
+   constexpr int USB_ID_DIGITS = 4;
+   constexpr int MAC_ADDRESS_DIGITS = 12;
+
+   int hexValue(QChar a_character)
+   {
+      const char16_t character = a_character.unicode();
+      if(character >= u'0' && character <= u'9')
+      {
+         return character - u'0';
+      }
+      if(character >= u'a' && character <= u'f')
+      {
+         return character - u'a' + 10;
+      }
+      if(character >= u'A' && character <= u'F')
+      {
+         return character - u'A' + 10;
+      }
+      return -1;
+   }
+}
+
+//!
+//! \brief The parseUsbId static function
+//! Parses a vendor or product ID of exactly four hex digits
+//!
+bool CompactIds::parseUsbId(QStringView a_text, UsbId& a_usbId)
+{
+   if(a_text.size() != USB_ID_DIGITS)
+   {
+      return false;
+   }
+
+   UsbId value = 0;
+   for(QChar character : a_text)
+   {
+      const int digit = hexValue(character);
+      if(digit < 0)
+      {
+         return false;
+      }
+      value = static_cast<UsbId>((value << 4) | digit);
+   }
+   a_usbId = value;
+   return true;
+}
+
+//!
+//! \brief The parseMacAddress static function
+//! Parses a MAC address of twelve hex digits, optionally grouped in pairs by ':' or '-'
+//!
+bool CompactIds::parseMacAddress(QStringView a_text, MacAddress& a_macAddress)
+{
+   MacAddress value = 0;
+   int digits = 0;
+   for(qsizetype i = 0; i < a_text.size(); ++i)
+   {
+      const QChar character = a_text[i];
+      if((character == u':' || character == u'-') && digits > 0 && digits % 2 == 0 && digits < MAC_ADDRESS_DIGITS)
+      {
+         continue;
+      }
+
+      const int digit = hexValue(character);
+      if(digit < 0 || digits == MAC_ADDRESS_DIGITS)
+      {
+         return false;
+      }
+      value = (value << 4) | static_cast<MacAddress>(digit);
+      ++digits;
+   }
+
+   if(digits != MAC_ADDRESS_DIGITS)
+   {
+      return false;
+   }
+   a_macAddress = value;
+   return true;
+}
+
+//!
+//! \brief The parseDeviceType static function
+//! Parses a "vendorid:productid" device type
+//!
+bool CompactIds::parseDeviceType(QStringView a_text, DeviceType& a_deviceType)
+{
+   const qsizetype separator = a_text.indexOf(u':');
+   return separator >= 0 &&
+          parseUsbId(a_text.left(separator), a_deviceType.vendorId) &&
+          parseUsbId(a_text.mid(separator + 1), a_deviceType.productId);
+}
+
+//!
+//! \brief The formatUsbId static function
+//! Formats a vendor or product ID as four lowercase hex digits
+//!
+QString CompactIds::formatUsbId(UsbId a_usbId)
+{
+   return QString::number(a_usbId, 16).rightJustified(USB_ID_DIGITS, u'0');
+}
+
+//!
+//! \brief The formatMacAddress static function
+//! Formats a MAC address as six colon separated pairs of lowercase hex digits
+//!
+QString CompactIds::formatMacAddress(MacAddress a_macAddress)
+{
+   static constexpr char hexDigits[] = "0123456789abcdef";
+   QString text(MAC_ADDRESS_DIGITS + MAC_ADDRESS_DIGITS / 2 - 1, u':');
+   for(int pair = 0; pair < MAC_ADDRESS_DIGITS / 2; ++pair)
+   {
+      const quint8 byte = static_cast<quint8>(a_macAddress >> (8 * (MAC_ADDRESS_DIGITS / 2 - 1 - pair)));
+      text[pair * 3] = QLatin1Char(hexDigits[byte >> 4]);
+      text[pair * 3 + 1] = QLatin1Char(hexDigits[byte & 0x0f]);
+   }
+   return text;
+}
+
+//!
+//! \brief The enabledInEnvironment static function
+//! Returns whether new databases should be created with the compact layout, set by HOSTSECURE_DB_COMPACT_IDS
+//!
+bool CompactIds::enabledInEnvironment()
+{
+   const char* setting = getenv("HOSTSECURE_DB_COMPACT_IDS");
+   return setting != nullptr && (QString(setting) == "1" || QString(setting).compare("true", Qt::CaseInsensitive) == 0);
+}
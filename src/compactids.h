@@ -0,0 +1,30 @@
+#pragma once
+#include <QString>
+#include <QStringView>
+
+//!
+//! \brief The CompactIds class
+//! Converts MAC addresses and USB vendor and product IDs between their text form and the fixed-size
+//! integers stored by the compact database layout
+//!
+class CompactIds
+{
+public:
+    using UsbId = quint16;
+    using MacAddress = quint64;
+
+    // A device type as it arrives from the Mqtt client, "vendorid:productid"
+    struct DeviceType
+    {
+        UsbId vendorId = 0;
+        UsbId productId = 0;
+    };
+
+    static bool parseUsbId(QStringView a_text, UsbId& a_usbId);
+    static bool parseMacAddress(QStringView a_text, MacAddress& a_macAddress);
+    static bool parseDeviceType(QStringView a_text, DeviceType& a_deviceType);
+    static QString formatUsbId(UsbId a_usbId);
+    static QString formatMacAddress(MacAddress a_macAddress);
+
+    static bool enabledInEnvironment();
+};
@@ -0,0 +1,364 @@
+#include "databaseconnectionpool.h"
+
+#include <QDebug>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <vector>
+
+//!
+//! \brief The SharedState struct
+//! The part of the pool the connections of other threads need when they close, which may happen after the pool is gone
+//!
+struct DatabaseConnectionPool::SharedState
+{
+   explicit SharedState(int a_maxReaders)
+      : readers(a_maxReaders)
+   {
+   }
+
+   QSemaphore readers;
+   std::atomic<QThread*> writerThread{nullptr};
+   QMutex observerMutex;
+   ConnectionObserver connectionClosed;
+};
+
+namespace
+{
+   constexpr int DEFAULT_MAX_READERS = 4;
+   constexpr int BUSY_TIMEOUT_MS = 5000;
+
+   // Connection names are never reused, even by threads of other pools
+   std::atomic<quint64> nextConnectionId{0};
+
+   //!
+   //! \brief The configureConnection function
+   //! Applies the settings every connection to the database requires
+   //!
+   void configureConnection(const QSqlDatabase& a_database, bool a_queryOnly)
+   {
+      QSqlQuery query(a_database);
+      query.exec("PRAGMA foreign_keys = ON;");
+      // Several threads use their own connection, so wait for locks instead of failing immediately
+      query.exec(QString("PRAGMA busy_timeout = %1;").arg(BUSY_TIMEOUT_MS));
+      query.exec(QString("PRAGMA query_only = %1;").arg(a_queryOnly ? "ON" : "OFF"));
+   }
+
+   //!
+   //! \brief The ThreadConnection class
+   //! Owns a connection of a thread other than the owner of its pool. Destroying it closes the connection and gives
+   //! back the writer binding or reader slot it held, also when the thread exits without releasing it
+   //!
+   class ThreadConnection
+   {
+   public:
+      ThreadConnection(const std::shared_ptr<DatabaseConnectionPool::SharedState>& a_pool, const QString& a_name, bool a_writer)
+         : m_Pool(a_pool)
+         , m_Name(a_name)
+         , m_Thread(QThread::currentThread())
+         , m_Writer(a_writer)
+      {
+      }
+
+      ~ThreadConnection()
+      {
+         const std::shared_ptr<DatabaseConnectionPool::SharedState> pool = m_Pool.lock();
+         if(pool)
+         {
+            // Statements prepared on the connection must go before it does
+            QMutexLocker locker(&pool->observerMutex);
+            if(pool->connectionClosed)
+            {
+               pool->connectionClosed(m_Name);
+            }
+         }
+
+         if(QSqlDatabase::contains(m_Name))
+         {
+            QSqlDatabase::database(m_Name, false).close();
+            QSqlDatabase::removeDatabase(m_Name);
+         }
+
+         if(pool)
+         {
+            if(m_Writer)
+            {
+               QThread* expected = m_Thread;
+               pool->writerThread.compare_exchange_strong(expected, nullptr);
+            }
+            else
+            {
+               pool->readers.release();
+            }
+         }
+      }
+
+      ThreadConnection(const ThreadConnection&) = delete;
+      ThreadConnection& operator=(const ThreadConnection&) = delete;
+
+      const DatabaseConnectionPool::SharedState* pool() const { return m_Pool.lock().get(); }
+      const QString& name() const { return m_Name; }
+      bool isWriter() const { return m_Writer; }
+
+   private:
+      const std::weak_ptr<DatabaseConnectionPool::SharedState> m_Pool;
+      const QString m_Name;
+      QThread* const m_Thread;
+      const bool m_Writer;
+   };
+
+   //!
+   //! \brief The threadConnections function
+   //! Retrieves the connections of the calling thread, one per pool. They are destroyed when the thread exits
+   //!
+   std::vector<std::unique_ptr<ThreadConnection>>& threadConnections()
+   {
+      thread_local std::vector<std::unique_ptr<ThreadConnection>> connections;
+      return connections;
+   }
+
+   //!
+   //! \brief The findThreadConnection function
+   //! Retrieves the connection of the calling thread in a pool, dropping the entries of pools that are gone
+   //!
+   ThreadConnection* findThreadConnection(const DatabaseConnectionPool::SharedState* a_pool)
+   {
+      std::vector<std::unique_ptr<ThreadConnection>>& connections = threadConnections();
+      ThreadConnection* result = nullptr;
+      for(auto it = connections.begin(); it != connections.end();)
+      {
+         const DatabaseConnectionPool::SharedState* pool = (*it)->pool();
+         if(pool == nullptr)
+         {
+            it = connections.erase(it);
+            continue;
+         }
+         if(pool == a_pool)
+         {
+            result = it->get();
+         }
+         ++it;
+      }
+      return result;
+   }
+}
+
+//!
+//! \brief The DatabaseConnectionPool constructor
+//! The creating thread becomes the owner and uses a connection of its own, which lives as long as the pool
+//!
+DatabaseConnectionPool::DatabaseConnectionPool(const QString& a_databasePath, int a_maxReaders)
+   : m_DatabasePath(a_databasePath)
+   , m_OwnerThread(QThread::currentThread())
+   , m_OwnerConnectionName(QString("hostsecure_owner_%1").arg(nextConnectionId.fetch_add(1)))
+   , m_SharedState(std::make_shared<SharedState>(qMax(a_maxReaders, 1)))
+{
+}
+
+//!
+//! \brief The DatabaseConnectionPool destructor
+//! Closes the owner connection. Connections still open on other threads outlive the pool and are closed when
+//! their thread exits
+//!
+DatabaseConnectionPool::~DatabaseConnectionPool()
+{
+   setConnectionClosedObserver(nullptr);
+   releaseConnection();
+
+   if(QSqlDatabase::contains(m_OwnerConnectionName))
+   {
+      QSqlDatabase::database(m_OwnerConnectionName, false).close();
+      QSqlDatabase::removeDatabase(m_OwnerConnectionName);
+   }
+}
+
+//!
+//! \brief The connection function
+//! Returns the connection of the calling thread, opening it on first use.
+//! Throws if no reader connection becomes available within the busy timeout
+//!
+QSqlDatabase DatabaseConnectionPool::connection()
+{
+   QThread* const thread = QThread::currentThread();
+
+   if(thread == m_OwnerThread)
+   {
+      if(!QSqlDatabase::contains(m_OwnerConnectionName))
+      {
+         QSqlDatabase db = openConnection(m_OwnerConnectionName, false);
+         // WAL is a property of the database file, so setting it once through the first connection is enough
+         QSqlQuery query(db);
+         if(!query.exec("PRAGMA journal_mode = WAL;"))
+         {
+            qWarning() << __PRETTY_FUNCTION__ << "Failed to enable WAL mode: " << query.lastError();
+         }
+      }
+
+      // The owner only writes while no other thread is bound as the writer
+      QSqlDatabase db = QSqlDatabase::database(m_OwnerConnectionName, false);
+      const bool queryOnly = m_SharedState->writerThread.load() != nullptr;
+      if(queryOnly != m_OwnerQueryOnly)
+      {
+         QSqlQuery query(db);
+         query.exec(QString("PRAGMA query_only = %1;").arg(queryOnly ? "ON" : "OFF"));
+         m_OwnerQueryOnly = queryOnly;
+      }
+      return db;
+   }
+
+   const ThreadConnection* threadConnection = findThreadConnection(m_SharedState.get());
+   if(threadConnection != nullptr)
+   {
+      return QSqlDatabase::database(threadConnection->name(), false);
+   }
+
+   const bool writer = thread == m_SharedState->writerThread.load();
+   if(!writer && !m_SharedState->readers.tryAcquire(1, BUSY_TIMEOUT_MS))
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "No reader connection available";
+      throw std::runtime_error("No reader connection available");
+   }
+
+   const QString name = QString(writer ? "hostsecure_writer_%1" : "hostsecure_reader_%1").arg(nextConnectionId.fetch_add(1));
+   try
+   {
+      QSqlDatabase db = openConnection(name, !writer);
+      threadConnections().push_back(std::make_unique<ThreadConnection>(m_SharedState, name, writer));
+      return db;
+   }
+   catch(...)
+   {
+      if(!writer)
+      {
+         m_SharedState->readers.release();
+      }
+      throw;
+   }
+}
+
+//!
+//! \brief The connectionName function
+//! Returns the name of the calling thread's connection, or an empty string if it has none open
+//!
+QString DatabaseConnectionPool::connectionName() const
+{
+   if(QThread::currentThread() == m_OwnerThread)
+   {
+      return m_OwnerConnectionName;
+   }
+   const ThreadConnection* threadConnection = findThreadConnection(m_SharedState.get());
+   return threadConnection != nullptr ? threadConnection->name() : QString();
+}
+
+//!
+//! \brief The bindWriter function
+//! Binds the calling thread as the writer until it releases its connection or exits
+//!
+void DatabaseConnectionPool::bindWriter()
+{
+   QThread* const thread = QThread::currentThread();
+   if(thread == m_SharedState->writerThread.load())
+   {
+      return;
+   }
+   if(thread == m_OwnerThread)
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "The owner thread writes by default and cannot be bound";
+      throw std::runtime_error("The owner thread cannot be bound as the writer");
+   }
+
+   releaseConnection(); // A reader connection of this thread must not be used for writing
+
+   QThread* expected = nullptr;
+   if(!m_SharedState->writerThread.compare_exchange_strong(expected, thread))
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "The writer connection is already bound to another thread";
+      throw std::runtime_error("The writer connection is already bound to another thread");
+   }
+}
+
+//!
+//! \brief The releaseConnection function
+//! Closes the connection of the calling thread and gives up the writer binding or reader slot it held.
+//! The connection of the owner thread lives as long as the pool
+//!
+void DatabaseConnectionPool::releaseConnection()
+{
+   QThread* const thread = QThread::currentThread();
+   if(thread == m_OwnerThread)
+   {
+      return;
+   }
+
+   std::vector<std::unique_ptr<ThreadConnection>>& connections = threadConnections();
+   const ThreadConnection* threadConnection = findThreadConnection(m_SharedState.get());
+   if(threadConnection != nullptr)
+   {
+      connections.erase(std::find_if(connections.begin(), connections.end(),
+                                     [threadConnection](const std::unique_ptr<ThreadConnection>& a_connection)
+      {
+         return a_connection.get() == threadConnection;
+      }));
+   }
+
+   // Bound without ever opening the writer connection
+   QThread* expected = thread;
+   m_SharedState->writerThread.compare_exchange_strong(expected, nullptr);
+}
+
+//!
+//! \brief The setConnectionClosedObserver function
+//! Registers a function called with the name of every connection of another thread right before it is closed,
+//! on the thread that owned it
+//!
+void DatabaseConnectionPool::setConnectionClosedObserver(ConnectionObserver a_observer)
+{
+   QMutexLocker locker(&m_SharedState->observerMutex);
+   m_SharedState->connectionClosed = std::move(a_observer);
+}
+
+//!
+//! \brief The isOwnerThread function
+//! Returns whether the calling thread created the pool and uses the owner connection
+//!
+bool DatabaseConnectionPool::isOwnerThread() const
+{
+   return QThread::currentThread() == m_OwnerThread;
+}
+
+//!
+//! \brief The maxReadersFromEnvironment static function
+//! Reads the maximum number of reader connections from HOSTSECURE_DB_READERS
+//!
+int DatabaseConnectionPool::maxReadersFromEnvironment()
+{
+   const char* setting = getenv("HOSTSECURE_DB_READERS");
+   if(setting != nullptr && QString(setting).toInt() > 0)
+   {
+      return QString(setting).toInt();
+   }
+   return DEFAULT_MAX_READERS;
+}
+
+QSqlDatabase DatabaseConnectionPool::openConnection(const QString& a_connectionName, bool a_queryOnly)
+{
+   QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", a_connectionName);
+   db.setDatabaseName(m_DatabasePath);
+   if(!db.open())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to open database connection: " << db.lastError();
+      const std::string error = db.lastError().text().toStdString();
+      db = QSqlDatabase();
+      QSqlDatabase::removeDatabase(a_connectionName);
+      throw std::runtime_error("Failed to open database connection: " + error);
+   }
+   configureConnection(db, a_queryOnly);
+   return db;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <QString>
+
+#include <functional>
+#include <memory>
+
+class QSqlDatabase;
+class QThread;
+//!
+//! \brief The DatabaseConnectionPool class
+//! Hands every thread its own connection to the database, which runs in WAL mode so readers never block the writer.
+//! One thread at a time is bound as the writer and uses the writer connection. Until a thread is bound, the thread
+//! that created the pool writes through the owner connection. Every other thread gets a query only reader
+//! connection, at most maxReaders of them at a time.
+//! Connections of threads other than the owner are closed when the thread releases them or exits, whichever
+//! comes first, and every connection gets a name no later connection reuses
+//!
+class DatabaseConnectionPool
+{
+public:
+    using ConnectionObserver = std::function<void(const QString& a_connectionName)>;
+
+    DatabaseConnectionPool(const QString& a_databasePath, int a_maxReaders);
+    ~DatabaseConnectionPool();
+
+    QSqlDatabase connection();
+    QString connectionName() const;
+    void bindWriter();
+    void releaseConnection();
+    bool isOwnerThread() const;
+    void setConnectionClosedObserver(ConnectionObserver a_observer);
+
+    static int maxReadersFromEnvironment();
+
+    struct SharedState;
+
+private:
+    QSqlDatabase openConnection(const QString& a_connectionName, bool a_queryOnly);
+
+    const QString m_DatabasePath;
+    QThread* const m_OwnerThread;
+    const QString m_OwnerConnectionName; // Closed and removed with the pool
+    std::shared_ptr<SharedState> m_SharedState; // Also held by the connections of other threads
+    bool m_OwnerQueryOnly = false; // Only accessed by the owner thread
+};
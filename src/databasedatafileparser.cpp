@@ -4,42 +4,121 @@
 #include <QDebug>
 #include <QFile>
 #include <QFileInfo>
+#include <QTextStream>
+#include <QElapsedTimer>
+
+namespace
+{
+   // Number of rows committed per transaction while importing
+   constexpr std::size_t IMPORT_CHUNK_SIZE = 10000;
+
+   struct ImportStatistics
+   {
+      qint64 lines = 0;
+      qint64 rejectedLines = 0;
+      qint64 insertedRows = 0;
+   };
+
+   //!
+   //! \brief The dataFilePath function
+   //! Resolves the path of a data file in the HostSecure data directory
+   //!
+   QString dataFilePath( const char* a_fileName )
+   {
+      const char* dataDir = getenv( "HOSTSECURE_DATA_DIR" );
+      if( dataDir == nullptr )
+      {
+         dataDir = ".";
+      }
+
+      QString path( dataDir );
+      path.append( "/" ).append( a_fileName );
+      return path;
+   }
+
+   //!
+   //! \brief The registerProductVendorChunk function
+   //! Imports a chunk of productvendor rows. Rows whose ids the database rejects count as rejected lines
+   //!
+   void registerProductVendorChunk( DatabaseHandler& a_dbHandler, const std::vector<DatabaseHandler::ProductVendor>& a_chunk,
+                                    ImportStatistics& a_statistics )
+   {
+      int invalidRows = 0;
+      a_statistics.insertedRows += a_dbHandler.registerProductVendors( a_chunk, &invalidRows );
+      a_statistics.rejectedLines += invalidRows;
+   }
+
+   //!
+   //! \brief The reportImport function
+   //! Logs the throughput and the number of rejected lines of a finished import
+   //!
+   void reportImport( const char* a_tableName, const ImportStatistics& a_statistics, qint64 a_elapsedMs )
+   {
+      const qint64 acceptedLines = a_statistics.lines - a_statistics.rejectedLines;
+      const qint64 rowsPerSecond = ( a_elapsedMs > 0 ) ? ( acceptedLines * 1000 / a_elapsedMs ) : acceptedLines;
+
+      qInfo() << "Imported" << a_statistics.insertedRows << a_tableName << "rows in" << a_elapsedMs << "ms"
+              << "(" << rowsPerSecond << "rows/sec )."
+              << a_statistics.rejectedLines << "malformed or invalid lines rejected,"
+              << ( acceptedLines - a_statistics.insertedRows ) << "duplicate rows skipped";
+   }
+}
 
 //!
 //! \brief The parseDeviceProductVendor static function
 //! Parses a csv file and populates the productvendor database table
+//! The file is streamed line by line and committed in chunks of IMPORT_CHUNK_SIZE rows
 //!
 void DatabaseDataFileParser::parseDeviceProductVendor( DatabaseHandler& a_dbHandler )
 {
-   const char* dataDir = getenv( "HOSTSECURE_DATA_DIR" );
-   if( dataDir == nullptr )
-   {
-      dataDir = ".";
-   }
-
-   QString path( dataDir );
-   path.append( "/productvendors.txt" );
-   QFile file( path );
+   QFile file( dataFilePath( "productvendors.txt" ) );
 
    if( file.exists() )
    {
-      if ( file.open( QIODevice::ReadOnly ) )
+      if ( file.open( QIODevice::ReadOnly | QIODevice::Text ) )
       {
-         while ( !file.atEnd() )
+         QElapsedTimer timer;
+         timer.start();
+
+         ImportStatistics statistics;
+         std::vector<DatabaseHandler::ProductVendor> chunk;
+         chunk.reserve( IMPORT_CHUNK_SIZE );
+
+         QTextStream stream( &file );
+         QString line;
+         while ( stream.readLineInto( &line ) )
          {
-            QString line = file.readLine();
-            QStringList productVendor = line.split(',');
+            ++statistics.lines;
+            const QStringList productVendor = line.split(',');
 
             if( productVendor.size() != 4 )
             {
                qWarning() << "Read incomplete line in productvendor file: " << line;
+               ++statistics.rejectedLines;
+               continue;
             }
-            else
+
+            DatabaseHandler::ProductVendor row;
+            row.productId = productVendor[0];
+            row.productName = productVendor[1];
+            row.vendorId = productVendor[2];
+            row.vendorName = productVendor[3];
+            chunk.push_back( std::move( row ) );
+
+            if( chunk.size() == IMPORT_CHUNK_SIZE )
             {
-               a_dbHandler.registerProductVendor(productVendor[0], productVendor[1], productVendor[2], productVendor[3]);
+               registerProductVendorChunk( a_dbHandler, chunk, statistics );
+               chunk.clear();
             }
          }
+
+         if( !chunk.empty() )
+         {
+            registerProductVendorChunk( a_dbHandler, chunk, statistics );
+         }
          file.close();
+
+         reportImport( "productvendor", statistics, timer.elapsed() );
       }
       else
       {
@@ -57,39 +136,58 @@ void DatabaseDataFileParser::parseDeviceProductVendor( DatabaseHandler& a_dbHand
 }
 
 //!
-//! \brief The parseDeviceProductVendor static function
+//! \brief The parseVirusHash static function
 //! Parses a csv file and populates the virushash database table
+//! The file is streamed line by line and committed in chunks of IMPORT_CHUNK_SIZE rows
 //!
 void DatabaseDataFileParser::parseVirusHash( DatabaseHandler& a_dbHandler )
 {
-   const char* dataDir = getenv("HOSTSECURE_DATA_DIR");
-   if(dataDir == nullptr)
-   {
-      dataDir = ".";
-   }
+   QFile file( dataFilePath( "virushashes.txt" ) );
 
-   QString path(dataDir);
-   path.append("/virushashes.txt");
-
-   QFile file(path);
    if(file.exists())
    {
-      if ( file.open( QIODevice::ReadOnly ) )
+      if ( file.open( QIODevice::ReadOnly | QIODevice::Text ) )
       {
-         while ( !file.atEnd() )
+         QElapsedTimer timer;
+         timer.start();
+
+         ImportStatistics statistics;
+         std::vector<DatabaseHandler::VirusHash> chunk;
+         chunk.reserve( IMPORT_CHUNK_SIZE );
+
+         QTextStream stream( &file );
+         QString line;
+         while ( stream.readLineInto( &line ) )
          {
-            QString line = file.readLine();
-            QStringList virusHash = line.split(',');
+            ++statistics.lines;
+            const QStringList virusHash = line.split(',');
+
             if(virusHash.size() != 2)
             {
                qWarning() << "Read incomplete line in virushash file: " << line;
+               ++statistics.rejectedLines;
+               continue;
             }
-            else
+
+            DatabaseHandler::VirusHash row;
+            row.virusHash = virusHash[0];
+            row.description = virusHash[1];
+            chunk.push_back( std::move( row ) );
+
+            if( chunk.size() == IMPORT_CHUNK_SIZE )
             {
-               a_dbHandler.registerVirusHash(virusHash[0], virusHash[1]);
+               statistics.insertedRows += a_dbHandler.registerVirusHashes( chunk );
+               chunk.clear();
             }
          }
+
+         if( !chunk.empty() )
+         {
+            statistics.insertedRows += a_dbHandler.registerVirusHashes( chunk );
+         }
          file.close();
+
+         reportImport( "virushash", statistics, timer.elapsed() );
       }
       else
       {
@@ -1,9 +1,20 @@
 #include "databasehandler.h"
 #include "databasedatafileparser.h"
+#include "virushashindex.h"
+#include "compactids.h"
+#include "timestamp.h"
+#include "databaseconnectionpool.h"
+#include "operationmetrics.h"
 
 #include <QDebug>
 #include <QFile>
 #include <QDir>
+#include <QBitArray>
+#include <QThread>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QDate>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
@@ -13,13 +24,488 @@ namespace
    constexpr auto DEVICE_STATUS_UNKNOWN = "U";
    constexpr auto DEVICE_STATUS_WHITELISTED = "W";
    constexpr auto DEVICE_STATUS_BLACKLISTED = "B";
+
+   constexpr auto DEVICE_DISCONNECTED_EVENT = "Device disconnected";
+
+   // Number of keys bound to one set-based virus hash lookup, well below SQLite's bound parameter limit
+   constexpr int VIRUS_HASH_LOOKUP_CHUNK_SIZE = 256;
+
+   // Upper bound of device triples kept in the device cache
+   constexpr int DEVICE_CACHE_CAPACITY = 100000;
+
+   constexpr qint64 MICROSECONDS_PER_DAY = 86400000000LL;
+   // Pagination tokens of the event log hold the partition day above the rowid within the partition
+   constexpr int LOG_PAGE_TOKEN_ROWID_BITS = 40;
+   constexpr qint64 LOG_PARTITION_LAST_DAY = 2932896; // 9999-12-31
+
+   //!
+   //! \brief The schemaStatement function
+   //! Fills in the column types of MAC address and vendor and product ID columns for the text or the compact layout
+   //!
+   QString schemaStatement(const char* a_statement, bool a_compactIds)
+   {
+      QString statement(a_statement);
+      statement.replace("%MACADDRESS%", a_compactIds ? "INTEGER" : "VARCHAR(8)");
+      statement.replace("%USBID%", a_compactIds ? "INTEGER" : "VARCHAR(4)");
+      return statement;
+   }
+
+
+   //!
+   //! \brief The log partition functions
+   //! The event log is stored in one table per UTC day, named log_yyyyMMdd so names sort chronologically.
+   //! Timestamps that are not epoch microseconds are kept in the first partition
+   //!
+   qint64 logPartitionDay(qint64 a_logtime)
+   {
+      return qMax<qint64>(a_logtime, 0) / MICROSECONDS_PER_DAY;
+   }
+
+   QString logPartitionName(qint64 a_day)
+   {
+      return QStringLiteral("log_") + QDate(1970, 1, 1).addDays(a_day).toString("yyyyMMdd");
+   }
+
+   qint64 logPartitionDay(const QString& a_name)
+   {
+      return QDate(1970, 1, 1).daysTo(QDate::fromString(a_name.mid(4), "yyyyMMdd"));
+   }
+
+   void createLogPartition(const QSqlDatabase& a_database, const QString& a_name, bool a_compactIds)
+   {
+      static const char* const statements[] =
+      {
+         "CREATE TABLE IF NOT EXISTS %PARTITION%(edgenodemacaddress %MACADDRESS%, "
+         "deviceid INTEGER, "
+         "logtime TIMESTAMP, "
+         "loginfo VARCHAR(100), "
+         "FOREIGN KEY (edgenodemacaddress) REFERENCES edgenode(macaddress), "
+         "FOREIGN KEY (deviceid) REFERENCES device(id), "
+         "PRIMARY KEY(edgenodemacaddress, deviceid, logtime))",
+         "CREATE INDEX IF NOT EXISTS %PARTITION%_logtime ON %PARTITION%(logtime)",
+         "CREATE INDEX IF NOT EXISTS %PARTITION%_edgenode_logtime ON %PARTITION%(edgenodemacaddress, logtime)",
+         "CREATE INDEX IF NOT EXISTS %PARTITION%_device_logtime ON %PARTITION%(deviceid, logtime)"
+      };
+
+      QSqlQuery query(a_database);
+      for(const char* statement : statements)
+      {
+         if(!query.exec(schemaStatement(statement, a_compactIds).replace("%PARTITION%", a_name)))
+         {
+            throw std::runtime_error("Failed to create log partition " + a_name.toStdString() + ": " + query.lastError().text().toStdString());
+         }
+      }
+   }
+
+   //!
+   //! \brief The Migration struct
+   //! One step of the schema history. The schema version is stored in PRAGMA user_version,
+   //! and every step newer than it is applied in order, each in its own transaction.
+   //! Data conversions SQL cannot express run in convert after the statements
+   //!
+   struct Migration
+   {
+      int version;
+      const char* description;
+      std::vector<const char*> statements;
+      std::function<void(const QSqlDatabase&, bool a_compactIds)> convert = nullptr;
+   };
+
+   //!
+   //! \brief The convertTimestampColumn function
+   //! Rewrites the text timestamps of a column as epoch microseconds. Values that cannot be parsed are kept as they are
+   //!
+   void convertTimestampColumn(const QSqlDatabase& a_database, const QString& a_table, const QString& a_column)
+   {
+      QSqlQuery select(a_database);
+      select.setForwardOnly(true);
+      if(!select.exec(QString("SELECT rowid, %1 FROM %2 WHERE typeof(%1) = 'text'").arg(a_column, a_table)))
+      {
+         throw std::runtime_error(select.lastError().text().toStdString());
+      }
+
+      QVariantList rowIds;
+      QVariantList values;
+      int unparsed = 0;
+      while(select.next())
+      {
+         qint64 microseconds = 0;
+         if(Timestamp::parse(select.value(1).toString(), microseconds))
+         {
+            rowIds.append(select.value(0));
+            values.append(microseconds);
+         }
+         else
+         {
+            ++unparsed;
+         }
+      }
+      select.finish();
+
+      if(!rowIds.isEmpty())
+      {
+         QSqlQuery update(a_database);
+         if(!update.prepare(QString("UPDATE OR IGNORE %1 SET %2 = ? WHERE rowid = ?").arg(a_table, a_column)))
+         {
+            throw std::runtime_error(update.lastError().text().toStdString());
+         }
+         update.bindValue(0, values);
+         update.bindValue(1, rowIds);
+         if(!update.execBatch())
+         {
+            throw std::runtime_error(update.lastError().text().toStdString());
+         }
+      }
+
+      if(unparsed > 0)
+      {
+         qWarning() << __PRETTY_FUNCTION__ << "Kept" << unparsed << "unparsable timestamps in" << a_table << a_column;
+      }
+   }
+
+   void convertTimestampsToEpoch(const QSqlDatabase& a_database, bool)
+   {
+      convertTimestampColumn(a_database, "edgenode", "lastheartbeat");
+      convertTimestampColumn(a_database, "connecteddevice", "connecttime");
+      convertTimestampColumn(a_database, "log", "logtime");
+   }
+
+   //!
+   //! \brief The partitionLog function
+   //! Moves the rows of the single log table into daily partitions and drops it
+   //!
+   void partitionLog(const QSqlDatabase& a_database, bool a_compactIds)
+   {
+      QSqlQuery query(a_database);
+      query.setForwardOnly(true);
+      if(!query.exec(QString("SELECT DISTINCT CASE WHEN typeof(logtime) = 'integer' THEN max(logtime, 0) / %1 ELSE 0 END FROM log")
+                     .arg(MICROSECONDS_PER_DAY)))
+      {
+         throw std::runtime_error(query.lastError().text().toStdString());
+      }
+      QVector<qint64> days;
+      while(query.next())
+      {
+         days.append(query.value(0).toLongLong());
+      }
+      query.finish();
+
+      for(qint64 day : std::as_const(days))
+      {
+         const QString partition = logPartitionName(day);
+         createLogPartition(a_database, partition, a_compactIds);
+
+         // Text compares greater than any integer, so unconverted timestamps only match the first partition
+         const QString condition = day == 0 ? QStringLiteral("typeof(logtime) != 'integer' OR logtime < ?")
+                                            : QStringLiteral("logtime >= ? AND logtime < ?");
+         QSqlQuery copy(a_database);
+         copy.prepare(QString("INSERT INTO %1(edgenodemacaddress, deviceid, logtime, loginfo) "
+                              "SELECT edgenodemacaddress, deviceid, logtime, loginfo FROM log WHERE %2").arg(partition, condition));
+         if(day != 0)
+         {
+            copy.addBindValue(day * MICROSECONDS_PER_DAY);
+         }
+         copy.addBindValue((day + 1) * MICROSECONDS_PER_DAY);
+         if(!copy.exec())
+         {
+            throw std::runtime_error(copy.lastError().text().toStdString());
+         }
+      }
+
+      if(!query.exec("DROP TABLE log"))
+      {
+         throw std::runtime_error(query.lastError().text().toStdString());
+      }
+   }
+
+   const std::vector<Migration>& migrations()
+   {
+      static const std::vector<Migration> steps
+      {
+         { 1, "Create tables",
+           {
+              "CREATE TABLE edgenode(macaddress %MACADDRESS% PRIMARY KEY, isonline BIT NOT NULL, lastheartbeat TIMESTAMP NOT NULL)",
+              "CREATE TABLE virushash(hashkey VARCHAR(32) PRIMARY KEY, description VARCHAR(100))",
+              "CREATE TABLE productvendor(productid %USBID%, vendorid %USBID%, productname VARCHAR(30), vendorname VARCHAR(30), "
+              "PRIMARY KEY(productid, vendorid))",
+              // An auto ID is used to decrease the number of columns required in referencing tables
+              "CREATE TABLE device(id INTEGER PRIMARY KEY AUTOINCREMENT, productid %USBID%, vendorid %USBID%, serialnumber VARCHAR(8), status CHAR(1) NOT NULL, "
+              "UNIQUE(productid, vendorid, serialnumber), "
+              "FOREIGN KEY(productid, vendorid) REFERENCES productvendor(productid, vendorid))",
+              "CREATE TABLE connecteddevice(edgenodemacaddress %MACADDRESS%, deviceid INTEGER, connecttime TIMESTAMP, "
+              "FOREIGN KEY (edgenodemacaddress) REFERENCES edgenode(macaddress), "
+              "FOREIGN KEY (deviceid) REFERENCES device(id), "
+              "PRIMARY KEY(edgenodemacaddress, deviceid))",
+              "CREATE TABLE log(edgenodemacaddress %MACADDRESS%, "
+              "deviceid INTEGER, "
+              "logtime TIMESTAMP, "
+              "loginfo VARCHAR(100), "
+              "FOREIGN KEY (edgenodemacaddress) REFERENCES edgenode(macaddress), "
+              "FOREIGN KEY (deviceid) REFERENCES device(id), "
+              "PRIMARY KEY(edgenodemacaddress, deviceid, logtime))"
+           }
+         },
+         { 2, "Add secondary indexes for time range, per device and online status queries",
+           {
+              "CREATE INDEX IF NOT EXISTS log_logtime ON log(logtime)",
+              "CREATE INDEX IF NOT EXISTS log_edgenode_logtime ON log(edgenodemacaddress, logtime)",
+              "CREATE INDEX IF NOT EXISTS log_device_logtime ON log(deviceid, logtime)",
+              "CREATE INDEX IF NOT EXISTS connecteddevice_deviceid ON connecteddevice(deviceid)",
+              "CREATE INDEX IF NOT EXISTS edgenode_isonline ON edgenode(isonline)"
+           }
+         },
+         { 3, "Store timestamps as epoch microseconds",
+           {},
+           convertTimestampsToEpoch
+         },
+         { 4, "Partition the event log by day",
+           {},
+           partitionLog
+         }
+      };
+      return steps;
+   }
+
+   //!
+   //! \brief The ScopedTransaction class
+   //! Wraps a SAVEPOINT so it works both on its own and nested inside an already open transaction.
+   //! Everything done in the scope is rolled back unless commit() is called
+   //!
+   class ScopedTransaction
+   {
+   public:
+      ScopedTransaction(const QSqlDatabase& a_database, const QString& a_name)
+         : m_Database(a_database)
+         , m_Name(a_name)
+      {
+         QSqlQuery query(m_Database);
+         if(!query.exec(QString("SAVEPOINT %1").arg(m_Name)))
+         {
+            throw std::runtime_error("Failed to begin transaction: " + query.lastError().text().toStdString());
+         }
+      }
+
+      ~ScopedTransaction()
+      {
+         if(!m_Committed)
+         {
+            QSqlQuery query(m_Database);
+            query.exec(QString("ROLLBACK TO %1").arg(m_Name));
+            query.exec(QString("RELEASE %1").arg(m_Name));
+         }
+      }
+
+      void commit()
+      {
+         QSqlQuery query(m_Database);
+         if(!query.exec(QString("RELEASE %1").arg(m_Name)))
+         {
+            throw std::runtime_error("Failed to commit transaction: " + query.lastError().text().toStdString());
+         }
+         m_Committed = true;
+      }
+
+   private:
+      QSqlDatabase m_Database;
+      QString m_Name;
+      bool m_Committed = false;
+   };
+
+   bool isUsbId(const QString& a_text)
+   {
+      CompactIds::UsbId usbId;
+      return CompactIds::parseUsbId(a_text, usbId);
+   }
+
+   //!
+   //! \brief The macAddressText and usbIdText functions
+   //! Convert a stored column value back to text. Only the compact layout stores integers
+   //!
+   QString macAddressText(const QVariant& a_value)
+   {
+      if(a_value.typeId() == QMetaType::LongLong || a_value.typeId() == QMetaType::Int)
+      {
+         return CompactIds::formatMacAddress(static_cast<CompactIds::MacAddress>(a_value.toLongLong()));
+      }
+      return a_value.toString();
+   }
+
+   QString usbIdText(const QVariant& a_value)
+   {
+      if(a_value.typeId() == QMetaType::LongLong || a_value.typeId() == QMetaType::Int)
+      {
+         return CompactIds::formatUsbId(static_cast<CompactIds::UsbId>(a_value.toInt()));
+      }
+      return a_value.toString();
+   }
+
+   //!
+   //! \brief The deviceStatusValue and deviceStatusFromValue functions
+   //! Convert a Device status to and from the character stored in the status column
+   //!
+   const char* deviceStatusValue(DatabaseHandler::DeviceStatus a_status)
+   {
+      switch(a_status)
+      {
+      case DatabaseHandler::DeviceStatus::Whitelisted:
+         return DEVICE_STATUS_WHITELISTED;
+      case DatabaseHandler::DeviceStatus::Blacklisted:
+         return DEVICE_STATUS_BLACKLISTED;
+      default:
+         return DEVICE_STATUS_UNKNOWN;
+      }
+   }
+
+   DatabaseHandler::DeviceStatus deviceStatusFromValue(const QVariant& a_value)
+   {
+      const QString status = a_value.toString();
+      if(status == QLatin1String(DEVICE_STATUS_WHITELISTED))
+      {
+         return DatabaseHandler::DeviceStatus::Whitelisted;
+      }
+      if(status == QLatin1String(DEVICE_STATUS_BLACKLISTED))
+      {
+         return DatabaseHandler::DeviceStatus::Blacklisted;
+      }
+      return DatabaseHandler::DeviceStatus::Unknown;
+   }
+
+   //!
+   //! \brief The timestampValue function
+   //! Converts an API timestamp to the epoch microseconds stored in the database
+   //!
+   qint64 timestampValue(const QString& a_timestamp)
+   {
+      qint64 microseconds = 0;
+      if(!Timestamp::parse(a_timestamp, microseconds))
+      {
+         qWarning() << __PRETTY_FUNCTION__ << "Invalid timestamp: " << a_timestamp;
+         throw std::runtime_error("Invalid timestamp: " + a_timestamp.toStdString());
+      }
+      return microseconds;
+   }
+
+   QString timestampText(const QVariant& a_value)
+   {
+      if(a_value.typeId() == QMetaType::LongLong || a_value.typeId() == QMetaType::Int)
+      {
+         return Timestamp::toText(a_value.toLongLong());
+      }
+      return a_value.toString();
+   }
+
+   //!
+   //! \brief The row reader functions
+   //! Fill a reused row object from the columns starting at a_first, shared by the streaming and paging functions
+   //!
+   void readEdgeNode(const QSqlQuery& a_query, int a_first, DatabaseHandler::EdgeNode& a_edgeNode)
+   {
+      a_edgeNode.macAddress = macAddressText(a_query.value(a_first));
+      a_edgeNode.isOnline = a_query.value(a_first + 1).toBool();
+      a_edgeNode.lastHeartbeat = timestampText(a_query.value(a_first + 2));
+   }
+
+   void readDevice(const QSqlQuery& a_query, int a_first, DatabaseHandler::Device& a_device)
+   {
+      a_device.productId = usbIdText(a_query.value(a_first));
+      a_device.vendorId = usbIdText(a_query.value(a_first + 1));
+      a_device.serialNumber = a_query.value(a_first + 2).toString();
+   }
+
+   void readConnectedDevice(const QSqlQuery& a_query, int a_first, DatabaseHandler::ConnectedDevice& a_connectedDevice)
+   {
+      a_connectedDevice.connectedEdgeNodeMacAddress = macAddressText(a_query.value(a_first));
+      a_connectedDevice.deviceProductId = usbIdText(a_query.value(a_first + 1));
+      a_connectedDevice.deviceVendorId = usbIdText(a_query.value(a_first + 2));
+      a_connectedDevice.deviceSerialNumber = a_query.value(a_first + 3).toString();
+   }
+
+   void readProductVendor(const QSqlQuery& a_query, int a_first, DatabaseHandler::ProductVendor& a_productVendor)
+   {
+      a_productVendor.productId = usbIdText(a_query.value(a_first));
+      a_productVendor.vendorId = usbIdText(a_query.value(a_first + 1));
+      a_productVendor.productName = a_query.value(a_first + 2).toString();
+      a_productVendor.vendorName = a_query.value(a_first + 3).toString();
+   }
+
+   void readVirusHash(const QSqlQuery& a_query, int a_first, DatabaseHandler::VirusHash& a_virusHash)
+   {
+      a_virusHash.virusHash = a_query.value(a_first).toString();
+      a_virusHash.description = a_query.value(a_first + 1).toString();
+   }
+
+   void readLogEvent(const QSqlQuery& a_query, int a_first, DatabaseHandler::LogEvent& a_logEvent)
+   {
+      a_logEvent.edgeNodeMacAddress = macAddressText(a_query.value(a_first));
+      a_logEvent.deviceProductId = usbIdText(a_query.value(a_first + 1));
+      a_logEvent.deviceVendorId = usbIdText(a_query.value(a_first + 2));
+      a_logEvent.deviceSerialNumber = a_query.value(a_first + 3).toString();
+      a_logEvent.timestamp = timestampText(a_query.value(a_first + 4));
+      a_logEvent.eventDescription = a_query.value(a_first + 5).toString();
+   }
+
+   //!
+   //! \brief The prepareScan function
+   //! Prepares a scan on a statement of its own. Scans hand their rows to callbacks that may run queries themselves,
+   //! which must neither re-execute nor release the statement being read, so scans never use cached statements
+   //!
+   void prepareScan(QSqlQuery& a_query, const QString& a_operation, const char* a_sql)
+   {
+      a_query.setForwardOnly(true);
+      if(!a_query.prepare(a_sql))
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to prepare query for" << a_operation << ": " << a_query.lastError();
+         throw std::runtime_error("Failed to prepare query for " + a_operation.toStdString());
+      }
+   }
+
+   //!
+   //! \brief The streamRows function
+   //! Hands every row of an executed query to a_callback, finishing the query early when the callback returns false.
+   //! Returns false if the iteration was stopped by the callback
+   //!
+   template<typename T, typename Reader>
+   bool streamRows(QSqlQuery& a_query, Reader a_read, const DatabaseHandler::RowCallback<T>& a_callback)
+   {
+      T row;
+      while(a_query.next())
+      {
+         a_read(a_query, 0, row);
+         if(!a_callback(row))
+         {
+            a_query.finish();
+            return false;
+         }
+      }
+      return true;
+   }
+
+   //!
+   //! \brief The readPage function
+   //! Reads an executed keyset query whose first column is the row key and returns the last key read
+   //!
+   template<typename T, typename Reader>
+   qint64 readPage(QSqlQuery& a_query, Reader a_read, std::vector<T>& a_page, qint64 a_resumeToken)
+   {
+      a_page.clear();
+      while(a_query.next())
+      {
+         a_resumeToken = a_query.value(0).toLongLong();
+         a_page.emplace_back();
+         a_read(a_query, 1, a_page.back());
+      }
+      return a_resumeToken;
+   }
 }
 
 //!
 //! \brief The DatabaseHandler constructor
-//! Creates the database and its tables and populates the productvendor and virushash tables
+//! Creates or migrates the database and its tables and populates the productvendor and virushash tables
 //!
 DatabaseHandler::DatabaseHandler(const QString& a_databasePath)
+   : m_ConnectionPool(std::make_unique<DatabaseConnectionPool>(a_databasePath, DatabaseConnectionPool::maxReadersFromEnvironment()))
+   , m_Devices(DEVICE_CACHE_CAPACITY)
+   , m_VirusHashIndex(std::make_unique<VirusHashIndex>())
 {
    bool exists = QFile::exists(a_databasePath);
    if(!exists)
@@ -35,129 +521,1477 @@ DatabaseHandler::DatabaseHandler(const QString& a_databasePath)
       }
    }
 
-   QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE");
-   db.setDatabaseName(a_databasePath);
+   m_ConnectionPool->setConnectionClosedObserver([this](const QString& a_connectionName)
+   {
+      forgetConnection(a_connectionName);
+   });
+
+   QSqlDatabase db;
+   try
+   {
+      db = m_ConnectionPool->connection();
+   }
+   catch(std::exception& e)
+   {
+      qFatal("Failed to open database: %s", e.what());
+   }
+
+   if(db.isOpen())
+   {
+      migrateSchema();
+
+      if(!exists)
+      {
+         DatabaseDataFileParser::parseDeviceProductVendor(*this);
+         DatabaseDataFileParser::parseVirusHash(*this);
+      }
+      else
+      {
+         reloadCaches();
+      }
+   }
+}
+
+//!
+//! \brief The DatabaseHandler destructor
+//! Releases the cached prepared statements before the connection goes away
+//!
+DatabaseHandler::~DatabaseHandler()
+{
+   m_ConnectionPool->setConnectionClosedObserver(nullptr);
+   QMutexLocker locker(&m_PreparedQueriesMutex);
+   m_PreparedQueries.clear();
+}
+
+//!
+//! \brief The getPreparedQueryStatistics function
+//! Retrieves the hit and miss counters of the prepared statement cache
+//!
+DatabaseHandler::PreparedQueryStatistics DatabaseHandler::getPreparedQueryStatistics() const
+{
+   QMutexLocker locker(&m_PreparedQueriesMutex);
+   return m_PreparedQueryStatistics;
+}
+
+//!
+//! \brief The invalidatePreparedQueries function
+//! Drops every cached prepared statement. Must be called whenever the schema changes,
+//! as cached statements keep the column layout they were prepared against.
+//! Statements may be in use on other threads, so they are only marked stale here and are
+//! re-prepared by the thread owning their connection on its next use
+//!
+void DatabaseHandler::invalidatePreparedQueries() const
+{
+   QMutexLocker locker(&m_PreparedQueriesMutex);
+   ++m_PreparedQueriesGeneration;
+   ++m_PreparedQueryStatistics.invalidations;
+}
+
+//!
+//! \brief The beginTransaction function
+//! Starts a transaction on the connection of the calling thread. Inside an open transaction it sets a savepoint
+//!
+void DatabaseHandler::beginTransaction() const
+{
+   DB_OPERATION("beginTransaction");
+
+   // Only the thread of a connection changes its entry, so the entry can be read and updated in two steps
+   QSqlDatabase db = database();
+   const QString connectionName = db.connectionName();
+   qsizetype savepoint = -1;
+   {
+      QMutexLocker locker(&m_TransactionsMutex);
+      auto transaction = m_Transactions.constFind(connectionName);
+      if(transaction != m_Transactions.constEnd())
+      {
+         savepoint = static_cast<qsizetype>(transaction->savepoints.size());
+      }
+   }
+
+   if(savepoint < 0)
+   {
+      if(!db.transaction())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to begin transaction: " << db.lastError();
+         throw std::runtime_error("Failed to begin transaction");
+      }
+      QMutexLocker locker(&m_TransactionsMutex);
+      m_Transactions.insert(connectionName, PendingTransaction());
+      return;
+   }
+
+   QSqlQuery query(db);
+   if(!query.exec(QString("SAVEPOINT transaction%1").arg(savepoint)))
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to begin nested transaction: " << query.lastError();
+      throw std::runtime_error("Failed to begin nested transaction");
+   }
+   QMutexLocker locker(&m_TransactionsMutex);
+   PendingTransaction& transaction = m_Transactions[connectionName];
+   transaction.savepoints.push_back(transaction.cacheChanges.size());
+}
+
+//!
+//! \brief The commitTransaction function
+//! Commits the transaction on the connection of the calling thread and applies its changes to the caches.
+//! Committing a nested transaction releases its savepoint and keeps its changes queued
+//!
+void DatabaseHandler::commitTransaction() const
+{
+   DB_OPERATION("commitTransaction");
+
+   QSqlDatabase db = database();
+   const QString connectionName = db.connectionName();
+   qsizetype savepoint = -1;
+   {
+      QMutexLocker locker(&m_TransactionsMutex);
+      auto transaction = m_Transactions.constFind(connectionName);
+      if(transaction != m_Transactions.constEnd())
+      {
+         savepoint = static_cast<qsizetype>(transaction->savepoints.size()) - 1;
+      }
+   }
+
+   if(savepoint >= 0)
+   {
+      QSqlQuery query(db);
+      if(!query.exec(QString("RELEASE transaction%1").arg(savepoint)))
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to commit nested transaction: " << query.lastError();
+         throw std::runtime_error("Failed to commit nested transaction");
+      }
+      QMutexLocker locker(&m_TransactionsMutex);
+      m_Transactions[connectionName].savepoints.pop_back();
+      return;
+   }
+
+   if(!db.commit())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to commit transaction: " << db.lastError();
+      throw std::runtime_error("Failed to commit transaction");
+   }
+
+   std::vector<std::function<void()>> cacheChanges;
+   {
+      QMutexLocker locker(&m_TransactionsMutex);
+      auto transaction = m_Transactions.find(connectionName);
+      if(transaction != m_Transactions.end())
+      {
+         cacheChanges.swap(transaction->cacheChanges);
+         m_Transactions.erase(transaction);
+      }
+   }
+   for(const std::function<void()>& cacheChange : cacheChanges)
+   {
+      cacheChange();
+   }
+}
+
+//!
+//! \brief The rollbackTransaction function
+//! Rolls back the transaction on the connection of the calling thread and drops its cache changes.
+//! Rolling back a nested transaction only undoes the writes made since its savepoint
+//!
+void DatabaseHandler::rollbackTransaction() const
+{
+   DB_OPERATION("rollbackTransaction");
+
+   QSqlDatabase db = database();
+   const QString connectionName = db.connectionName();
+   qsizetype savepoint = -1;
+   {
+      QMutexLocker locker(&m_TransactionsMutex);
+      auto transaction = m_Transactions.find(connectionName);
+      if(transaction != m_Transactions.end())
+      {
+         if(transaction->savepoints.empty())
+         {
+            m_Transactions.erase(transaction);
+         }
+         else
+         {
+            savepoint = static_cast<qsizetype>(transaction->savepoints.size()) - 1;
+            transaction->cacheChanges.resize(transaction->savepoints.back());
+            transaction->savepoints.pop_back();
+         }
+      }
+   }
+
+   {
+      // A partition created in the rolled back writes is gone again, so every day is checked on its next write
+      QMutexLocker locker(&m_LogPartitionsMutex);
+      m_LogPartitionDays.clear();
+   }
+
+   if(savepoint >= 0)
+   {
+      QSqlQuery query(db);
+      if(!query.exec(QString("ROLLBACK TO transaction%1").arg(savepoint)) || !query.exec(QString("RELEASE transaction%1").arg(savepoint)))
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to roll back nested transaction: " << query.lastError();
+         throw std::runtime_error("Failed to roll back nested transaction");
+      }
+      return;
+   }
+
+   if(!db.rollback())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to roll back transaction: " << db.lastError();
+      throw std::runtime_error("Failed to roll back transaction");
+   }
+}
+
+//!
+//! \brief The applyOnCommit function
+//! Helper function to change an in-memory cache after a write. Inside a transaction the change waits for the
+//! outermost commit and is dropped on rollback, so the caches never show writes other connections cannot see
+//!
+void DatabaseHandler::applyOnCommit(std::function<void()> a_change) const
+{
+   {
+      const QString connectionName = database().connectionName();
+      QMutexLocker locker(&m_TransactionsMutex);
+      auto transaction = m_Transactions.find(connectionName);
+      if(transaction != m_Transactions.end())
+      {
+         transaction->cacheChanges.push_back(std::move(a_change));
+         return;
+      }
+   }
+   a_change();
+}
+
+//!
+//! \brief The setSynchronousMode function
+//! Sets how often SQLite syncs to disk on the connection of the calling thread, trading durability for commit latency
+//!
+void DatabaseHandler::setSynchronousMode(SynchronousMode a_mode) const
+{
+   DB_OPERATION("setSynchronousMode");
+
+   const char* mode = "FULL";
+   switch(a_mode)
+   {
+   case SynchronousMode::Off:
+      mode = "OFF";
+      break;
+   case SynchronousMode::Normal:
+      mode = "NORMAL";
+      break;
+   case SynchronousMode::Full:
+      mode = "FULL";
+      break;
+   }
+
+   QSqlQuery query(database());
+   if(!query.exec(QString("PRAGMA synchronous = %1").arg(mode)))
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to set synchronous mode: " << query.lastError();
+      throw std::runtime_error("Failed to set synchronous mode");
+   }
+}
+
+//!
+//! \brief The releaseThreadConnection function
+//! Closes the connection of the calling thread together with its prepared statements.
+//! Threads other than the one owning the handler that exit without calling it have theirs closed on exit
+//!
+void DatabaseHandler::releaseThreadConnection() const
+{
+   // The connection of the owner thread lives as long as the handler
+   m_ConnectionPool->releaseConnection();
+}
+
+//!
+//! \brief The forgetConnection function
+//! Helper function dropping the prepared statements and pending cache changes of a connection about to close.
+//! Runs on the thread of the connection. Closing the connection rolls back a transaction left open
+//!
+void DatabaseHandler::forgetConnection(const QString& a_connectionName) const
+{
+   {
+      QMutexLocker locker(&m_TransactionsMutex);
+      m_Transactions.remove(a_connectionName);
+   }
+   QMutexLocker locker(&m_PreparedQueriesMutex);
+   for(auto it = m_PreparedQueries.begin(); it != m_PreparedQueries.end();)
+   {
+      if(it.key().first == a_connectionName)
+      {
+         it = m_PreparedQueries.erase(it);
+      }
+      else
+      {
+         ++it;
+      }
+   }
+}
+
+//!
+//! \brief The bindWriterThread function
+//! Makes the calling thread the only one that writes, until it releases its connection
+//!
+void DatabaseHandler::bindWriterThread() const
+{
+   m_ConnectionPool->bindWriter();
+}
+
+//!
+//! \brief The getSchemaVersion function
+//! Retrieves the schema version of the database
+//!
+int DatabaseHandler::getSchemaVersion() const
+{
+   DB_OPERATION("getSchemaVersion");
+
+   QSqlQuery query(database());
+   if(!query.exec("PRAGMA user_version") || !query.next())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get schema version: " << query.lastError();
+      throw std::runtime_error("Failed to get schema version");
+   }
+
+   return query.value(0).toInt();
+}
+
+//!
+//! \brief The getLatestSchemaVersion static function
+//! Retrieves the schema version this code base migrates databases to
+//!
+int DatabaseHandler::getLatestSchemaVersion()
+{
+   return migrations().back().version;
+}
+
+//!
+//! \brief The usesCompactIds function
+//! Returns whether the database stores MAC addresses and vendor and product IDs as integers
+//!
+bool DatabaseHandler::usesCompactIds() const
+{
+   return m_CompactIds;
+}
+
+//!
+//! \brief The reloadCaches function
+//! Rebuilds every in-memory cache from the database
+//!
+void DatabaseHandler::reloadCaches()
+{
+   DB_OPERATION("reloadCaches");
+
+   loadVirusHashIndex();
+   reloadDeviceCaches();
+}
+
+//!
+//! \brief The reloadDeviceCaches function
+//! Rebuilds the in-memory caches derived from the device related tables, including the connected device index.
+//! Must also be called after a transaction containing device related writes has been rolled back
+//!
+void DatabaseHandler::reloadDeviceCaches()
+{
+   DB_OPERATION("reloadDeviceCaches");
+
+   loadDeviceIdCache();
+   loadConnectedDeviceIndex();
+}
+
+//!
+//! \brief The registerOrUpdateEdgeNode function
+//! Registers a new Edge Node if it doesn't exist, or updates an existing one if it exists.
+//! Existing rows are updated in place, so they keep the rowid getEdgeNodePage resumes from
+//!
+void DatabaseHandler::registerOrUpdateEdgeNode(const QString &a_macAddress, bool a_isOnline, const QString& a_lastHeartbeatTimestamp) const
+{
+   DB_OPERATION("registerOrUpdateEdgeNode");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerOrUpdateEdgeNode"),
+                                    "INSERT INTO edgenode(macaddress, isonline, lastheartbeat) VALUES(?, ?, ?) "
+                                    "ON CONFLICT(macaddress) DO UPDATE SET isonline = excluded.isonline, lastheartbeat = excluded.lastheartbeat");
+   query.bindValue(0, macAddressValue(a_macAddress));
+   query.bindValue(1, (a_isOnline ? 1 : 0));
+   query.bindValue(2, timestampValue(a_lastHeartbeatTimestamp));
+
+   if(!query.exec())
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Failed to register edge node: " << query.lastError();
+      throw std::runtime_error("Failed to register edge node");
+   }
+}
+
+//!
+//! \brief The getEdgeNode function
+//! Retrieves an Edge Node
+//!
+bool DatabaseHandler::getEdgeNode(EdgeNode &a_edgeNode, const QString &a_macAddress) const
+{
+   DB_OPERATION("getEdgeNode");
+
+   bool success = false;
+   QSqlQuery& query = preparedQuery(QStringLiteral("getEdgeNode"),
+                                    "SELECT macaddress, isonline, lastheartbeat FROM edgenode WHERE macaddress = ?");
+   query.bindValue(0, macAddressValue(a_macAddress));
+
+   if(query.exec())
+   {
+      if(query.next())
+      {
+         a_edgeNode.macAddress = macAddressText(query.value(0));
+         a_edgeNode.isOnline = query.value(1).toBool();
+         a_edgeNode.lastHeartbeat = timestampText(query.value(2));
+         success = true;
+      }
+      query.finish();
+   }
+   else
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get edge node: " << query.lastError();
+      throw std::runtime_error("Failed to get edge node");
+   }
+
+   return success;
+}
+
+//!
+//! \brief The getAllEdgeNodeKeys function
+//! Retrieves all Edge Node mac addresses
+//!
+void DatabaseHandler::getAllEdgeNodeKeys(QVector<QString> &a_macAddresses) const
+{
+   DB_OPERATION("getAllEdgeNodeKeys");
+
+   try
+   {
+      getKeysFromTable("macaddress", "edgenode",  a_macAddresses, macAddressText);
+   }
+   catch(std::exception& e)
+   {
+      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
+      throw e;
+   }
+}
+
+//!
+//! \brief The getAllEdgeNodes function
+//! Retrieves all Eedge Nodes
+//!
+void DatabaseHandler::getAllEdgeNodes(std::vector<std::unique_ptr<EdgeNode> >& a_edgeNodes) const
+{
+   DB_OPERATION("getAllEdgeNodes");
+
+   forEachEdgeNode([&a_edgeNodes](const EdgeNode& a_row)
+   {
+      a_edgeNodes.push_back(std::make_unique<EdgeNode>(a_row));
+      return true;
+   });
+}
+
+//!
+//! \brief The forEachEdgeNode function
+//! Streams all edge nodes to a_callback without materializing the table
+//!
+void DatabaseHandler::forEachEdgeNode(const RowCallback<EdgeNode>& a_callback) const
+{
+   DB_OPERATION("forEachEdgeNode");
+
+   QSqlQuery query(database());
+   prepareScan(query, QStringLiteral("forEachEdgeNode"),
+                      "SELECT macaddress, isonline, lastheartbeat FROM edgenode");
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all edge nodes: " << query.lastError();
+      throw std::runtime_error("Failed to get all edge nodes");
+   }
+   streamRows<EdgeNode>(query, readEdgeNode, a_callback);
+}
+
+//!
+//! \brief The getEdgeNodePage function
+//! Retrieves the next page of edge nodes using keyset pagination
+//!
+qint64 DatabaseHandler::getEdgeNodePage(std::vector<EdgeNode>& a_page, qint64 a_resumeToken, int a_limit) const
+{
+   DB_OPERATION("getEdgeNodePage");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("getEdgeNodePage"),
+                                    "SELECT rowid, macaddress, isonline, lastheartbeat FROM edgenode "
+                                    "WHERE rowid > ? ORDER BY rowid LIMIT ?");
+   query.bindValue(0, a_resumeToken);
+   query.bindValue(1, a_limit);
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of edge nodes: " << query.lastError();
+      throw std::runtime_error("Failed to get page of edge nodes");
+   }
+   return readPage<EdgeNode>(query, readEdgeNode, a_page, a_resumeToken);
+}
+
+//!
+//! \brief The setEdgeNodeOnlineStatus function
+//! Updates the online status of an Edge Node
+//!
+void DatabaseHandler::setEdgeNodeOnlineStatus(const QString &a_macAddress, bool a_isOnline, const QString &a_lastHeartbeatTimestamp)
+{
+   DB_OPERATION("setEdgeNodeOnlineStatus");
+
+   QSqlQuery* query = nullptr;
+   if(a_lastHeartbeatTimestamp.isEmpty())
+   {
+      query = &preparedQuery(QStringLiteral("setEdgeNodeOnlineStatus"),
+                             "UPDATE edgenode SET isonline = ? WHERE macAddress = ?");
+      query->bindValue(0, (a_isOnline ? 1 : 0));
+      query->bindValue(1, macAddressValue(a_macAddress));
+   }
+   else
+   {
+      query = &preparedQuery(QStringLiteral("setEdgeNodeOnlineStatusAndHeartbeat"),
+                             "UPDATE edgenode SET isonline = ?, lastheartbeat = ? WHERE macAddress = ?");
+      query->bindValue(0, (a_isOnline ? 1 : 0));
+      query->bindValue(1, timestampValue(a_lastHeartbeatTimestamp));
+      query->bindValue(2, macAddressValue(a_macAddress));
+   }
+
+   if(!query->exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to set edge node online status: " << query->lastError();
+      throw std::runtime_error("Failed to set edge node online status");
+   }
+}
+
+//!
+//! \brief The registerOrUpdateEdgeNodes function
+//! Writes the online status and last heartbeat of many Edge Nodes in one transaction, registering the ones
+//! missing from the table. Rows are updated in place, so the Device connections referencing them are kept
+//!
+void DatabaseHandler::registerOrUpdateEdgeNodes(const std::vector<EdgeNode>& a_edgeNodes)
+{
+   DB_OPERATION("registerOrUpdateEdgeNodes");
+
+   QVariantList macAddresses;
+   QVariantList onlineStatuses;
+   QVariantList heartbeats;
+   macAddresses.reserve(a_edgeNodes.size());
+   onlineStatuses.reserve(a_edgeNodes.size());
+   heartbeats.reserve(a_edgeNodes.size());
+
+   for(const EdgeNode& edgeNode : a_edgeNodes)
+   {
+      macAddresses.append(macAddressValue(edgeNode.macAddress));
+      onlineStatuses.append(edgeNode.isOnline ? 1 : 0);
+      heartbeats.append(timestampValue(edgeNode.lastHeartbeat));
+   }
+
+   ScopedTransaction transaction(database(), "registerorupdateedgenodes");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerOrUpdateEdgeNodes"),
+                                    "INSERT INTO edgenode(macaddress, isonline, lastheartbeat) VALUES(?, ?, ?) "
+                                    "ON CONFLICT(macaddress) DO UPDATE SET isonline = excluded.isonline, lastheartbeat = excluded.lastheartbeat");
+   query.bindValue(0, macAddresses);
+   query.bindValue(1, onlineStatuses);
+   query.bindValue(2, heartbeats);
+
+   if(!query.execBatch())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register or update edge nodes: " << query.lastError();
+      throw std::runtime_error("Failed to register or update edge nodes");
+   }
+
+   transaction.commit();
+}
+
+//!
+//! \brief The edgeWentOffline function
+//! Marks an Edge Node offline and disconnects all its Devices, logging a disconnect event for each.
+//! Its latency is recorded once, as edgesWentOffline
+//!
+int DatabaseHandler::edgeWentOffline(const QString& a_macAddress, const QString& a_timestamp)
+{
+   return edgesWentOffline({ qMakePair(a_macAddress, a_timestamp) });
+}
+
+//!
+//! \brief The edgesWentOffline function
+//! Marks many Edge Nodes offline at once, as happens when a site loses power. The disconnect events are copied
+//! from the connecteddevice table by one statement per log partition, and every statement runs as a batch over
+//! all Edge Nodes
+//!
+int DatabaseHandler::edgesWentOffline(const QVector<QPair<QString, QString>>& a_macAddressTimestamps)
+{
+   DB_OPERATION("edgesWentOffline");
+
+   if(a_macAddressTimestamps.isEmpty())
+   {
+      return 0;
+   }
+
+   QVariantList macAddresses;
+   QHash<qint64, QPair<QVariantList, QVariantList>> eventsByPartitionDay;
+   macAddresses.reserve(a_macAddressTimestamps.size());
+   for(const QPair<QString, QString>& macAddressTimestamp : a_macAddressTimestamps)
+   {
+      const QVariant macAddress = macAddressValue(macAddressTimestamp.first);
+      const qint64 logtime = timestampValue(macAddressTimestamp.second);
+      macAddresses.append(macAddress);
+      QPair<QVariantList, QVariantList>& events = eventsByPartitionDay[logPartitionDay(logtime)];
+      events.first.append(logtime);
+      events.second.append(macAddress);
+   }
+
+   ScopedTransaction transaction(database(), "edgeswentoffline");
+   int disconnected = 0;
+   try
+   {
+      for(auto events = eventsByPartitionDay.cbegin(); events != eventsByPartitionDay.cend(); ++events)
+      {
+         const QString partition = logPartitionForWrite(events->first.first().toLongLong());
+         const QString sql = QString("INSERT OR IGNORE INTO %1(edgenodemacaddress, deviceid, logtime, loginfo) "
+                                     "SELECT edgenodemacaddress, deviceid, ?, ? FROM connecteddevice "
+                                     "WHERE edgenodemacaddress = ?").arg(partition);
+         QSqlQuery& query = preparedQuery(QStringLiteral("edgesWentOffline:log:") + partition, sql.toUtf8().constData(),
+                                          QStringLiteral("edgesWentOffline:log:"));
+         query.bindValue(0, events->first);
+         query.bindValue(1, QVariantList(events->first.size(), QString::fromLatin1(DEVICE_DISCONNECTED_EVENT)));
+         query.bindValue(2, events->second);
+
+         if(!query.execBatch())
+         {
+            qCritical() << __PRETTY_FUNCTION__ << "Failed to log device disconnects: " << query.lastError();
+            throw std::runtime_error("Failed to log device disconnects");
+         }
+      }
+
+      QSqlQuery& offlineQuery = preparedQuery(QStringLiteral("edgesWentOffline:offline"),
+                                              "UPDATE edgenode SET isonline = 0 WHERE macaddress = ?");
+      offlineQuery.bindValue(0, macAddresses);
+      if(!offlineQuery.execBatch())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to set edge nodes offline: " << offlineQuery.lastError();
+         throw std::runtime_error("Failed to set edge nodes offline");
+      }
+
+      const qint64 changesBefore = getTotalChanges();
+      QSqlQuery& disconnectQuery = preparedQuery(QStringLiteral("edgesWentOffline:disconnect"),
+                                                 "DELETE FROM connecteddevice WHERE edgenodemacaddress = ?");
+      disconnectQuery.bindValue(0, macAddresses);
+      if(!disconnectQuery.execBatch())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to unregister connected devices on edge nodes: " << disconnectQuery.lastError();
+         throw std::runtime_error("Failed to unregister connected devices on edge nodes");
+      }
+      disconnected = static_cast<int>(getTotalChanges() - changesBefore);
+
+      transaction.commit();
+   }
+   catch(...)
+   {
+      // The partitions may have been created in the rolled back transaction, create them again next time
+      for(auto events = eventsByPartitionDay.cbegin(); events != eventsByPartitionDay.cend(); ++events)
+      {
+         forgetLogPartition(events->first.first().toLongLong());
+      }
+      throw;
+   }
+
+   QVector<QString> edgeNodeKeys;
+   edgeNodeKeys.reserve(a_macAddressTimestamps.size());
+   for(const QPair<QString, QString>& macAddressTimestamp : a_macAddressTimestamps)
+   {
+      edgeNodeKeys.append(connectedEdgeNodeKey(macAddressTimestamp.first));
+   }
+   applyOnCommit([this, edgeNodeKeys]()
+   {
+      for(const QString& edgeNodeKey : edgeNodeKeys)
+      {
+         forgetConnectedDevicesOnEdgeNode(edgeNodeKey);
+      }
+   });
+   return disconnected;
+}
+
+//!
+//! \brief The getOnlineEdgeNodes function
+//! Retrieves all the online Edge Nodes
+//!
+void DatabaseHandler::getOnlineEdgeNodes(QVector<QString> &a_macAddresses) const
+{
+   DB_OPERATION("getOnlineEdgeNodes");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("getOnlineEdgeNodes"),
+                                    "SELECT macaddress FROM edgenode WHERE isonline = 1");
+   if(query.exec())
+   {
+      while (query.next())
+      {
+         a_macAddresses.push_back( macAddressText(query.value(0)));
+      }
+   }
+   else
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to set edge node online status: " << query.lastError();
+      throw std::runtime_error("Failed to set edge node online status");
+   }
+}
+
+//!
+//! \brief The registerDevice function
+//! Registers a Device if it does not already exist
+//!
+void DatabaseHandler::registerDevice(const QString &a_productId, const QString &a_vendorId, const QString &a_serialNumber ) const
+{
+   DB_OPERATION("registerDevice");
+
+   if(getDeviceId(a_productId, a_vendorId, a_serialNumber, false) >= 0)
+   {
+      return; // Ignore if it exists
+   }
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerDevice"),
+                                    "INSERT OR IGNORE INTO device(productid, vendorid, serialnumber, status) "
+                                    "VALUES(?, ?, ?, ?)");
+   query.bindValue(0, usbIdValue(a_productId));
+   query.bindValue(1, usbIdValue(a_vendorId));
+   query.bindValue(2, a_serialNumber);
+   query.bindValue(3, DEVICE_STATUS_UNKNOWN);
+
+   quint64 generation = 0;
+   {
+      QMutexLocker locker(&m_DevicesMutex);
+      generation = m_DevicesGeneration;
+   }
+   if(!query.exec())
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Failed to register device: " << query.lastError();
+      throw std::runtime_error("Failed to register device");
+   }
+
+   if(query.numRowsAffected() == 1)
+   {
+      applyOnCommit([this, key = canonicalDeviceKey(a_productId, a_vendorId, a_serialNumber),
+                     device = CachedDevice{query.lastInsertId().toLongLong(), DeviceStatus::Unknown}, generation]()
+      {
+         cacheDevice(key, device, generation);
+      });
+   }
+   else
+   {
+      getDeviceId(a_productId, a_vendorId, a_serialNumber); // Registered through another connection, cache its id
+   }
+}
+
+//!
+//! \brief The getDevice function
+//! Retrieves a Device
+//!
+bool DatabaseHandler::getDevice(Device &a_device, const QString &a_productId, const QString &a_vendorId, const QString &a_serialNumber) const
+{
+   DB_OPERATION("getDevice");
+
+   bool success = false;
+   QSqlQuery& query = preparedQuery(QStringLiteral("getDevice"),
+                                    "SELECT productid, vendorid, serialnumber FROM device WHERE productid = ? AND vendorid = ? AND serialnumber = ?");
+   query.bindValue(0, usbIdValue(a_productId));
+   query.bindValue(1, usbIdValue(a_vendorId));
+   query.bindValue(2, a_serialNumber);
+
+   if(query.exec())
+   {
+      if(query.next())
+      {
+         a_device.productId = usbIdText(query.value(0));
+         a_device.vendorId = usbIdText(query.value(1));
+         a_device.serialNumber = query.value(2).toString();
+         success = true;
+      }
+      query.finish();
+   }
+   else
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get device: " << query.lastError();
+      throw std::runtime_error("Failed to get device");
+   }
+
+   return success;
+}
+
+//!
+//! \brief The getAllDevices function
+//! Retrieves all Devices
+//!
+void DatabaseHandler::getAllDevices(std::vector<std::unique_ptr<Device> >& a_devices) const
+{
+   DB_OPERATION("getAllDevices");
+
+   forEachDevice([&a_devices](const Device& a_row)
+   {
+      a_devices.push_back(std::make_unique<Device>(a_row));
+      return true;
+   });
+}
+
+//!
+//! \brief The forEachDevice function
+//! Streams all devices to a_callback without materializing the table
+//!
+void DatabaseHandler::forEachDevice(const RowCallback<Device>& a_callback) const
+{
+   DB_OPERATION("forEachDevice");
+
+   QSqlQuery query(database());
+   prepareScan(query, QStringLiteral("forEachDevice"),
+                      "SELECT productid, vendorid, serialnumber FROM device");
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all devices: " << query.lastError();
+      throw std::runtime_error("Failed to get all devices");
+   }
+   streamRows<Device>(query, readDevice, a_callback);
+}
+
+//!
+//! \brief The getDevicePage function
+//! Retrieves the next page of devices using keyset pagination
+//!
+qint64 DatabaseHandler::getDevicePage(std::vector<Device>& a_page, qint64 a_resumeToken, int a_limit) const
+{
+   DB_OPERATION("getDevicePage");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("getDevicePage"),
+                                    "SELECT id, productid, vendorid, serialnumber FROM device "
+                                    "WHERE id > ? ORDER BY id LIMIT ?");
+   query.bindValue(0, a_resumeToken);
+   query.bindValue(1, a_limit);
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of devices: " << query.lastError();
+      throw std::runtime_error("Failed to get page of devices");
+   }
+   return readPage<Device>(query, readDevice, a_page, a_resumeToken);
+}
+
+//!
+//! \brief The getDeviceStatus function
+//! Retrieves whether a Device is Unknown, Whitelisted or Blacklisted, or not registered at all.
+//! A cached Device is answered without a query
+//!
+DatabaseHandler::DeviceStatus DatabaseHandler::getDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+{
+   DB_OPERATION("getDeviceStatus");
+
+   CachedDevice device;
+   if(!findDevice(device, a_productId, a_vendorId, a_serialNumber))
+   {
+      return DeviceStatus::NotRegistered;
+   }
+   return device.status;
+}
+
+//!
+//! \brief The setDeviceBlacklisted function
+//! Updates the Device status to Blacklisted
+//!
+void DatabaseHandler::setDeviceBlacklisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+{
+   DB_OPERATION("setDeviceBlacklisted");
+
+   try
+   {
+      setDeviceStatus(a_productId, a_vendorId, a_serialNumber, DeviceStatus::Blacklisted);
+   }
+   catch (std::exception& e)
+   {
+      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
+      throw e; // Forward the exception so it can be handled correctly by the caller";
+   }
+}
+
+//!
+//! \brief The isDeviceBlackListed function
+//! Checks if a Device is Blacklisted
+//!
+bool DatabaseHandler::isDeviceBlackListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+{
+   DB_OPERATION("isDeviceBlackListed");
+
+   bool retVal = true; // Assume the worst
+   try
+   {
+      retVal = getDeviceStatus(a_productId, a_vendorId, a_serialNumber) == DeviceStatus::Blacklisted;
+   }
+   catch(std::exception& e)
+   {
+      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
+      throw e; // Forward the exception so it can be handled correctly by the caller";
+   }
+
+   return retVal;
+}
+
+//!
+//! \brief The setDeviceWhitelisted function
+//! Updates the Device status to Whitelisted
+//!
+void DatabaseHandler::setDeviceWhitelisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+{
+   DB_OPERATION("setDeviceWhitelisted");
+
+   try
+   {
+      setDeviceStatus(a_productId, a_vendorId, a_serialNumber, DeviceStatus::Whitelisted);
+   }
+   catch (std::exception& e)
+   {
+      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
+      throw e; // Forward the exception so it can be handled correctly by the caller";
+   }
+}
+
+//!
+//! \brief The isDeviceWhiteListed function
+//! Checks if a Device is Whitelisted
+//!
+bool DatabaseHandler::isDeviceWhiteListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+{
+   DB_OPERATION("isDeviceWhiteListed");
+
+   bool retVal = false;
+   try
+   {
+      retVal = getDeviceStatus(a_productId, a_vendorId, a_serialNumber) == DeviceStatus::Whitelisted;
+   }
+   catch(std::exception& e)
+   {
+      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
+      throw e; // Forward the exception so it can be handled correctly by the caller";
+   }
+
+   return retVal;
+}
+
+//!
+//! \brief The registerConnectedDevice function
+//! Registers a connection between a Device and the Edge Node it is connected to
+//!
+void DatabaseHandler::registerConnectedDevice(const QString &a_edgeNodeMacAddress, const QString &a_deviceProductId, const QString &a_deviceVendorId, const QString &a_deviceSerialNumber, const QString &a_timestamp)
+{
+   DB_OPERATION("registerConnectedDevice");
+
+   const qint64 deviceId = getDeviceId(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   if(deviceId < 0)
+   {
+      return; // Unknown Devices are ignored
+   }
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerConnectedDevice"),
+                                    "INSERT INTO connecteddevice(edgenodemacaddress, deviceid, connecttime) "
+                                    "VALUES(?, ?, ?)");
+   query.bindValue(0, macAddressValue(a_edgeNodeMacAddress));
+   query.bindValue(1, deviceId);
+   query.bindValue(2, timestampValue(a_timestamp));
+
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register connected device: " << query.lastError();
+      throw std::runtime_error("Failed to register connected device");
+   }
+
+   applyOnCommit([this, edgeNodeKey = connectedEdgeNodeKey(a_edgeNodeMacAddress),
+                  deviceKey = canonicalDeviceKey(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber)]()
+   {
+      QMutexLocker locker(&m_ConnectedDevicesMutex);
+      m_DevicesByEdgeNode[edgeNodeKey].insert(deviceKey);
+      m_EdgeNodesByDevice[deviceKey].insert(edgeNodeKey);
+   });
+}
+
+//!
+//! \brief The unregisterConnectedDevicesOnEdgeNode function
+//! Unregisters all Device connections to an Edge Node
+//!
+void DatabaseHandler::unregisterConnectedDevicesOnEdgeNode(const QString &a_edgeNodeMacAddress)
+{
+   DB_OPERATION("unregisterConnectedDevicesOnEdgeNode");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("unregisterConnectedDevicesOnEdgeNode"),
+                                    "DELETE FROM connecteddevice "
+                                    "WHERE edgenodemacaddress = ?");
+   query.bindValue(0, macAddressValue(a_edgeNodeMacAddress));
+
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to unregister all connected devices on edge node: " << query.lastError();
+      throw std::runtime_error("Failed to unregister all connected devices on edge node");
+   }
+
+   applyOnCommit([this, edgeNodeKey = connectedEdgeNodeKey(a_edgeNodeMacAddress)]()
+   {
+      forgetConnectedDevicesOnEdgeNode(edgeNodeKey);
+   });
+}
+
+//!
+//! \brief The unregisterConnectedDevice function
+//! Unregisters a connection between a Device and the Edge Node it was connected to
+//!
+void DatabaseHandler::unregisterConnectedDevice(const QString &a_edgeNodeMacAddress, const QString &a_deviceProductId, const QString &a_deviceVendorId, const QString &a_deviceSerialNumber)
+{
+   DB_OPERATION("unregisterConnectedDevice");
+
+   const qint64 deviceId = getDeviceId(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   if(deviceId < 0)
+   {
+      return; // Unknown Devices can't be connected
+   }
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("unregisterConnectedDevice"),
+                                    "DELETE FROM connecteddevice "
+                                    "WHERE edgenodemacaddress = ? AND deviceid = ?");
+   query.bindValue(0, macAddressValue(a_edgeNodeMacAddress));
+   query.bindValue(1, deviceId);
+
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to unregister connected device: " << query.lastError();
+      throw std::runtime_error("Failed to unregister connected device");
+   }
+
+   applyOnCommit([this, edgeNodeKey = connectedEdgeNodeKey(a_edgeNodeMacAddress),
+                  deviceKey = canonicalDeviceKey(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber)]()
+   {
+      QMutexLocker locker(&m_ConnectedDevicesMutex);
+      auto devices = m_DevicesByEdgeNode.find(edgeNodeKey);
+      if(devices != m_DevicesByEdgeNode.end())
+      {
+         devices->remove(deviceKey);
+         if(devices->isEmpty())
+         {
+            m_DevicesByEdgeNode.erase(devices);
+         }
+      }
+      auto edgeNodes = m_EdgeNodesByDevice.find(deviceKey);
+      if(edgeNodes != m_EdgeNodesByDevice.end())
+      {
+         edgeNodes->remove(edgeNodeKey);
+         if(edgeNodes->isEmpty())
+         {
+            m_EdgeNodesByDevice.erase(edgeNodes);
+         }
+      }
+   });
+}
+
+//!
+//! \brief The registerConnectedDevice function
+//! Retrieves all connnections between Devicees and Edge Nodes
+//!
+void DatabaseHandler::getAllConnectedDevices(std::vector<std::unique_ptr<ConnectedDevice> >& a_connectedDevices)
+{
+   DB_OPERATION("getAllConnectedDevices");
+
+   forEachConnectedDevice([&a_connectedDevices](const ConnectedDevice& a_row)
+   {
+      a_connectedDevices.push_back(std::make_unique<ConnectedDevice>(a_row));
+      return true;
+   });
+}
+
+//!
+//! \brief The forEachConnectedDevice function
+//! Streams all connected devices to a_callback without materializing the table
+//!
+void DatabaseHandler::forEachConnectedDevice(const RowCallback<ConnectedDevice>& a_callback) const
+{
+   DB_OPERATION("forEachConnectedDevice");
+
+   QSqlQuery query(database());
+   prepareScan(query, QStringLiteral("forEachConnectedDevice"),
+                      "SELECT edgenodemacaddress, productid, vendorid, serialnumber "
+                      "FROM connecteddevice "
+                      "INNER JOIN device ON device.id = connecteddevice.deviceid");
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all connected devices: " << query.lastError();
+      throw std::runtime_error("Failed to get all connected devices");
+   }
+   streamRows<ConnectedDevice>(query, readConnectedDevice, a_callback);
+}
+
+//!
+//! \brief The getConnectedDevicePage function
+//! Retrieves the next page of connected devices using keyset pagination
+//!
+qint64 DatabaseHandler::getConnectedDevicePage(std::vector<ConnectedDevice>& a_page, qint64 a_resumeToken, int a_limit) const
+{
+   DB_OPERATION("getConnectedDevicePage");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("getConnectedDevicePage"),
+                                    "SELECT connecteddevice.rowid, edgenodemacaddress, productid, vendorid, serialnumber "
+                                    "FROM connecteddevice "
+                                    "INNER JOIN device ON device.id = connecteddevice.deviceid "
+                                    "WHERE connecteddevice.rowid > ? ORDER BY connecteddevice.rowid LIMIT ?");
+   query.bindValue(0, a_resumeToken);
+   query.bindValue(1, a_limit);
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of connected devices: " << query.lastError();
+      throw std::runtime_error("Failed to get page of connected devices");
+   }
+   return readPage<ConnectedDevice>(query, readConnectedDevice, a_page, a_resumeToken);
+}
+
+//!
+//! \brief The getDevicesConnectedToEdgeNode function
+//! Retrieves the Devices currently connected to an Edge Node from the connected device index
+//!
+void DatabaseHandler::getDevicesConnectedToEdgeNode(std::vector<Device>& a_devices, const QString& a_edgeNodeMacAddress) const
+{
+   DB_OPERATION("getDevicesConnectedToEdgeNode");
+
+   a_devices.clear();
+   const QString edgeNodeKey = connectedEdgeNodeKey(a_edgeNodeMacAddress);
+   QMutexLocker locker(&m_ConnectedDevicesMutex);
+   const auto devices = m_DevicesByEdgeNode.constFind(edgeNodeKey);
+   if(devices == m_DevicesByEdgeNode.constEnd())
+   {
+      return;
+   }
+
+   a_devices.reserve(static_cast<std::size_t>(devices->size()));
+   for(const DeviceKey& deviceKey : *devices)
+   {
+      a_devices.push_back(Device{deviceKey.vendorId, deviceKey.productId, deviceKey.serialNumber});
+   }
+}
+
+//!
+//! \brief The getEdgeNodesOfConnectedDevice function
+//! Retrieves the Edge Nodes a Device is currently connected to from the connected device index
+//!
+void DatabaseHandler::getEdgeNodesOfConnectedDevice(QVector<QString>& a_macAddresses, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber) const
+{
+   DB_OPERATION("getEdgeNodesOfConnectedDevice");
+
+   a_macAddresses.clear();
+   const DeviceKey deviceKey = canonicalDeviceKey(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   QMutexLocker locker(&m_ConnectedDevicesMutex);
+   const auto edgeNodes = m_EdgeNodesByDevice.constFind(deviceKey);
+   if(edgeNodes != m_EdgeNodesByDevice.constEnd())
+   {
+      a_macAddresses = edgeNodes->values();
+   }
+}
+
+//!
+//! \brief The isDeviceConnected function
+//! Checks the connected device index for a Device connected to any Edge Node
+//!
+bool DatabaseHandler::isDeviceConnected(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber) const
+{
+   DB_OPERATION("isDeviceConnected");
+
+   const DeviceKey deviceKey = canonicalDeviceKey(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   QMutexLocker locker(&m_ConnectedDevicesMutex);
+   return m_EdgeNodesByDevice.contains(deviceKey);
+}
+
+//!
+//! \brief The registerProductVendor function
+//! Registers a product vendor combination
+//!
+void DatabaseHandler::registerProductVendor(const QString &a_productId, const QString &a_productName, const QString &a_vendorId, const QString &a_vendorName)
+{
+   DB_OPERATION("registerProductVendor");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerProductVendor"),
+                                    "INSERT INTO productvendor(productid, vendorid, productname, vendorname)"
+                                    "VALUES(?, ?, ?, ?)");
+   query.bindValue(0, usbIdValue(a_productId));
+   query.bindValue(1, usbIdValue(a_vendorId));
+   query.bindValue(2, a_productName);
+   query.bindValue(3, a_vendorName);
+
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register productvendor: " << query.lastError();
+      throw std::runtime_error("Failed to register productvendor");
+   }
+}
+
+//!
+//! \brief The registerProductVendors function
+//! Registers a chunk of product vendor combinations in one transaction using a single prepared statement
+//! Combinations that already exist are skipped. Returns the number of inserted rows
+//! Rows with ids the compact layout cannot store are skipped as well and counted in a_invalidRows
+//!
+int DatabaseHandler::registerProductVendors(const std::vector<ProductVendor>& a_productVendors, int* a_invalidRows)
+{
+   DB_OPERATION("registerProductVendors");
+
+   QVariantList productIds;
+   QVariantList vendorIds;
+   QVariantList productNames;
+   QVariantList vendorNames;
+   productIds.reserve(a_productVendors.size());
+   vendorIds.reserve(a_productVendors.size());
+   productNames.reserve(a_productVendors.size());
+   vendorNames.reserve(a_productVendors.size());
+
+   int invalidRows = 0;
+   for(const ProductVendor& productVendor : a_productVendors)
+   {
+      if(m_CompactIds && !(isUsbId(productVendor.productId) && isUsbId(productVendor.vendorId)))
+      {
+         qWarning() << __PRETTY_FUNCTION__ << "Skipping productvendor with invalid ids: " << productVendor.productId << productVendor.vendorId;
+         ++invalidRows;
+         continue;
+      }
+      productIds.append(usbIdValue(productVendor.productId));
+      vendorIds.append(usbIdValue(productVendor.vendorId));
+      productNames.append(productVendor.productName);
+      vendorNames.append(productVendor.vendorName);
+   }
+   if(a_invalidRows != nullptr)
+   {
+      *a_invalidRows = invalidRows;
+   }
+
+   ScopedTransaction transaction(database(), "registerproductvendors");
+   const qint64 changesBefore = getTotalChanges();
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerProductVendors"),
+                                    "INSERT OR IGNORE INTO productvendor(productid, vendorid, productname, vendorname)"
+                                    "VALUES(?, ?, ?, ?)");
+   query.bindValue(0, productIds);
+   query.bindValue(1, vendorIds);
+   query.bindValue(2, productNames);
+   query.bindValue(3, vendorNames);
+
+   if(!query.execBatch())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register productvendors: " << query.lastError();
+      throw std::runtime_error("Failed to register productvendors");
+   }
+
+   const int inserted = static_cast<int>(getTotalChanges() - changesBefore);
+   transaction.commit();
+   return inserted;
+}
+
+//!
+//! \brief The getProductVendor function
+//! Retrieves a product vendor combination
+//!
+bool DatabaseHandler::getProductVendor(ProductVendor& a_productVendor, const QString &a_productId, const QString a_vendorId)
+{
+   DB_OPERATION("getProductVendor");
+
+   bool success = false;
+   QSqlQuery& query = preparedQuery(QStringLiteral("getProductVendor"),
+                                    "SELECT productid, vendorid, productname, vendorname FROM productvendor WHERE productid = ? AND vendorid = ?");
+   query.bindValue(0, usbIdValue(a_productId));
+   query.bindValue(1, usbIdValue(a_vendorId));
+
+   if(query.exec())
+   {
+      if(query.next())
+      {
+         a_productVendor.productId = usbIdText(query.value(0));
+         a_productVendor.vendorId = usbIdText(query.value(1));
+         a_productVendor.productName = query.value(2).toString();
+         a_productVendor.vendorName = query.value(3).toString();
+         success = true;
+      }
+      query.finish();
+   }
+   else
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get productvendor: " << query.lastError();
+      throw std::runtime_error("Failed to get productvendor");
+   }
+
+   return success;
+}
+
+//!
+//! \brief The getAllProductVendors function
+//! Retrieves all product vendor combination
+//!
+void DatabaseHandler::getAllProductVendors(std::vector<std::unique_ptr<ProductVendor> >& a_productVendors)
+{
+   DB_OPERATION("getAllProductVendors");
+
+   forEachProductVendor([&a_productVendors](const ProductVendor& a_row)
+   {
+      a_productVendors.push_back(std::make_unique<ProductVendor>(a_row));
+      return true;
+   });
+}
+
+//!
+//! \brief The forEachProductVendor function
+//! Streams all productvendors to a_callback without materializing the table
+//!
+void DatabaseHandler::forEachProductVendor(const RowCallback<ProductVendor>& a_callback) const
+{
+   DB_OPERATION("forEachProductVendor");
+
+   QSqlQuery query(database());
+   prepareScan(query, QStringLiteral("forEachProductVendor"),
+                      "SELECT productid, vendorid, productname, vendorname FROM productvendor");
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all productvendors: " << query.lastError();
+      throw std::runtime_error("Failed to get all productvendors");
+   }
+   streamRows<ProductVendor>(query, readProductVendor, a_callback);
+}
+
+//!
+//! \brief The getProductVendorPage function
+//! Retrieves the next page of productvendors using keyset pagination
+//!
+qint64 DatabaseHandler::getProductVendorPage(std::vector<ProductVendor>& a_page, qint64 a_resumeToken, int a_limit) const
+{
+   DB_OPERATION("getProductVendorPage");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("getProductVendorPage"),
+                                    "SELECT rowid, productid, vendorid, productname, vendorname FROM productvendor "
+                                    "WHERE rowid > ? ORDER BY rowid LIMIT ?");
+   query.bindValue(0, a_resumeToken);
+   query.bindValue(1, a_limit);
+   if(!query.exec())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of productvendors: " << query.lastError();
+      throw std::runtime_error("Failed to get page of productvendors");
+   }
+   return readPage<ProductVendor>(query, readProductVendor, a_page, a_resumeToken);
+}
+
+//!
+//! \brief The registerVirusHash function
+//! Registers a virus file hash
+//!
+void DatabaseHandler::registerVirusHash(const QString &a_virusHash, const QString &a_description)
+{
+   DB_OPERATION("registerVirusHash");
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerVirusHash"),
+                                    "INSERT INTO virushash(hashkey, description)"
+                                    "VALUES(?, ?)");
+   query.bindValue(0, a_virusHash);
+   query.bindValue(1, a_description);
 
-   if(!db.open())
+   if(!query.exec())
    {
-      qFatal("Failed to open database: %s", db.lastError().text().toStdString().c_str());
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register virus hash: " << query.lastError();
+      throw std::runtime_error("Failed to register virus hash");
    }
-   else
-   {
-      QSqlQuery query;
-      query.exec("PRAGMA foreign_keys = ON;");
 
-      if(!exists)
-      {
-         if(!query.exec("CREATE TABLE edgenode(macaddress VARCHAR(8) PRIMARY KEY, isonline BIT NOT NULL, lastheartbeat TIMESTAMP NOT NULL)"))
-         {
-            qFatal("Failed to create edgenode table: %s", query.lastError().text().toStdString().c_str());
-         }
+   const VirusHashIndex::Digest digest = VirusHashIndex::digest(a_virusHash);
+   applyOnCommit([this, digest]()
+   {
+      m_VirusHashIndex->insert(digest);
+   });
+}
 
-         if(!query.exec("CREATE TABLE virushash(hashkey VARCHAR(32) PRIMARY KEY, description VARCHAR(100))"))
-         {
-            qFatal("Failed to create virushash table: %s", query.lastError().text().toStdString().c_str());
-         }
+//!
+//! \brief The registerVirusHashes function
+//! Registers a chunk of virus file hashes in one transaction using a single prepared statement
+//! Hashes that already exist are skipped. Returns the number of inserted rows
+//!
+int DatabaseHandler::registerVirusHashes(const std::vector<VirusHash>& a_virusHashes)
+{
+   DB_OPERATION("registerVirusHashes");
 
-         if(!query.exec("CREATE TABLE productvendor(productid VARCHAR(4), vendorid VARCHAR(4), productname VARCHAR(30), vendorname VARCHAR(30), "
-                        "PRIMARY KEY(productid, vendorid))"))
-         {
-            qFatal("Failed to create productvendor table: %s", query.lastError().text().toStdString().c_str());
-         }
+   QVariantList hashKeys;
+   QVariantList descriptions;
+   hashKeys.reserve(a_virusHashes.size());
+   descriptions.reserve(a_virusHashes.size());
 
-         // An auto ID is used to decrease the number of columns required in referencing tables
-         if(!query.exec("CREATE TABLE device(id INTEGER PRIMARY KEY AUTOINCREMENT, productid VARCHAR(4), vendorid VARCHAR(4), serialnumber VARCHAR(8), status CHAR(1) NOT NULL, "
-                        "UNIQUE(productid, vendorid, serialnumber), "
-                        "FOREIGN KEY(productid, vendorid) REFERENCES productvendor(productid, vendorid))"))
-         {
-            qFatal("Failed to create device table: %s", query.lastError().text().toStdString().c_str());
-         }
+   for(const VirusHash& virusHash : a_virusHashes)
+   {
+      hashKeys.append(virusHash.virusHash);
+      descriptions.append(virusHash.description);
+   }
 
-         if(!query.exec("CREATE TABLE connecteddevice(edgenodemacaddress VARCHAR(8), deviceid INTEGER, connecttime TIMESTAMP, "
-                        "FOREIGN KEY (edgenodemacaddress) REFERENCES edgenode(macaddress), "
-                        "FOREIGN KEY (deviceid) REFERENCES device(id), "
-                        "PRIMARY KEY(edgenodemacaddress, deviceid))"))
-         {
-            qFatal("Failed to create connecteddevice table: %s", query.lastError().text().toStdString().c_str());
-         }
+   ScopedTransaction transaction(database(), "registervirushashes");
+   const qint64 changesBefore = getTotalChanges();
 
-         if(!query.exec("CREATE TABLE log(edgenodemacaddress VARCHAR(8), "
-                        "deviceid INTEGER, "
-                        "logtime TIMESTAMP, "
-                        "loginfo VARCHAR(100), "
-                        "FOREIGN KEY (edgenodemacaddress) REFERENCES edgenode(macaddress), "
-                        "FOREIGN KEY (deviceid) REFERENCES device(id), "
-                        "PRIMARY KEY(edgenodemacaddress, deviceid, logtime))"))
-         {
-            qFatal("Failed to create log table: %s", query.lastError().text().toStdString().c_str());
-         }
+   QSqlQuery& query = preparedQuery(QStringLiteral("registerVirusHashes"),
+                                    "INSERT OR IGNORE INTO virushash(hashkey, description)"
+                                    "VALUES(?, ?)");
+   query.bindValue(0, hashKeys);
+   query.bindValue(1, descriptions);
 
-         DatabaseDataFileParser::parseDeviceProductVendor(*this);
-         DatabaseDataFileParser::parseVirusHash(*this);
-      }
+   if(!query.execBatch())
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to register virus hashes: " << query.lastError();
+      throw std::runtime_error("Failed to register virus hashes");
    }
-}
 
-//!
-//! \brief The registerOrUpdateEdgeNode function
-//! Registers a new Edge Node if it doesn't exist, or updates an existing one if it exists
-//!
-void DatabaseHandler::registerOrUpdateEdgeNode(const QString &a_macAddress, bool a_isOnline, const QString& a_lastHeartbeatTimestamp) const
-{
-   QSqlQuery query;
-   // NOT an UPSERT, but it's ok as we update every attribute of the table and we don't use an auto id.
-   query.prepare("INSERT OR REPLACE INTO edgenode(macaddress, isonline, lastheartbeat)"
-                 "VALUES(?, ?, ?)");
-   query.bindValue(0, a_macAddress);
-   query.bindValue(1, (a_isOnline ? 1 : 0));
-   query.bindValue(2, a_lastHeartbeatTimestamp);
+   const int inserted = static_cast<int>(getTotalChanges() - changesBefore);
+   transaction.commit();
 
-   if(!query.exec())
+   std::vector<VirusHashIndex::Digest> digests;
+   digests.reserve(a_virusHashes.size());
+   for(const VirusHash& virusHash : a_virusHashes)
    {
-      qWarning() << __PRETTY_FUNCTION__ << "Failed to register edge node: " << query.lastError();
-      throw std::runtime_error("Failed to register edge node");
+      digests.push_back(VirusHashIndex::digest(virusHash.virusHash));
    }
+   applyOnCommit([this, digests = std::move(digests), inserted]()
+   {
+      m_VirusHashIndex->reserve(m_VirusHashIndex->size() + inserted);
+      for(const VirusHashIndex::Digest& digest : digests)
+      {
+         m_VirusHashIndex->insert(digest);
+      }
+   });
+   return inserted;
 }
 
 //!
-//! \brief The getEdgeNode function
-//! Retrieves an Edge Node
+//! \brief The getVirusHash function
+//! Retrieves a virus hash with description
 //!
-bool DatabaseHandler::getEdgeNode(EdgeNode &a_edgeNode, const QString &a_macAddress) const
+bool DatabaseHandler::getVirusHash(VirusHash &a_vHash, const QString &a_virusHash) const
 {
+   DB_OPERATION("getVirusHash");
+
    bool success = false;
-   QSqlQuery query;
-   query.prepare("SELECT * FROM edgenode WHERE macaddress = ?");
-   query.bindValue(0, a_macAddress);
+   QSqlQuery& query = preparedQuery(QStringLiteral("getVirusHash"),
+                                    "SELECT hashkey, description FROM virushash WHERE hashkey = ?");
+   query.bindValue(0, a_virusHash);
 
    if(query.exec())
    {
       if(query.next())
       {
-         a_edgeNode.macAddress = query.value(0).toString();
-         a_edgeNode.isOnline = query.value(1).toBool();
-         a_edgeNode.lastHeartbeat = query.value(2).toString();
+         a_vHash.virusHash = query.value(0).toString();
+         a_vHash.description = query.value(1).toString();
          success = true;
       }
+      query.finish();
    }
    else
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get edge node: " << query.lastError();
-      throw std::runtime_error("Failed to get edge node");
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get virus hash: " << query.lastError();
+      throw std::runtime_error("Failed to get virus hash");
    }
 
    return success;
 }
 
 //!
-//! \brief The getAllEdgeNodeKeys function
-//! Retrieves all Edge Node mac addresses
+//! \brief The getAllVirusHashKeys function
+//! Retrieves all virus hashes
 //!
-void DatabaseHandler::getAllEdgeNodeKeys(QVector<QString> &a_macAddresses) const
+void DatabaseHandler::getAllVirusHashKeys(QVector<QString> &a_virusHashes) const
 {
+   DB_OPERATION("getAllVirusHashKeys");
+
    try
    {
-      getKeysFromTable("macaddress", "edgenode",  a_macAddresses);
+      getKeysFromTable("hashkey", "virushash",  a_virusHashes);
    }
    catch(std::exception& e)
    {
@@ -167,639 +2001,914 @@ void DatabaseHandler::getAllEdgeNodeKeys(QVector<QString> &a_macAddresses) const
 }
 
 //!
-//! \brief The getAllEdgeNodes function
-//! Retrieves all Eedge Nodes
+//! \brief The getAllVirusHashes function
+//! Retrieves all virus hashes with descriptions
 //!
-void DatabaseHandler::getAllEdgeNodes(std::vector<std::unique_ptr<EdgeNode> > &a_edgeNodes) const
+void DatabaseHandler::getAllVirusHashes(std::vector<std::unique_ptr<VirusHash> >& a_virusHashes) const
 {
-   QSqlQuery query;
-   if(query.exec("SELECT * FROM edgenode"))
-   {
-      while(query.next())
-      {
-         std::unique_ptr<EdgeNode> node =  std::make_unique<EdgeNode>();
-         node->macAddress = query.value(0).toString();
-         node->isOnline = query.value(1).toBool();
-         node->lastHeartbeat = query.value(2).toString();
-         a_edgeNodes.push_back(std::move(node));
-      }
-   }
-   else
+   DB_OPERATION("getAllVirusHashes");
+
+   forEachVirusHash([&a_virusHashes](const VirusHash& a_row)
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all edge nodes: " << query.lastError();
-      throw std::runtime_error("Failed to get all edge nodes");
-   }
+      a_virusHashes.push_back(std::make_unique<VirusHash>(a_row));
+      return true;
+   });
 }
 
 //!
-//! \brief The setEdgeNodeOnlineStatus function
-//! Updates the online status of an Edge Node
+//! \brief The forEachVirusHash function
+//! Streams all virus hashes to a_callback without materializing the table
 //!
-void DatabaseHandler::setEdgeNodeOnlineStatus(const QString &a_macAddress, bool a_isOnline, const QString &a_lastHeartbeatTimestamp)
+void DatabaseHandler::forEachVirusHash(const RowCallback<VirusHash>& a_callback) const
 {
-   QSqlQuery query;
-   if(a_lastHeartbeatTimestamp.isEmpty())
-   {
-      query.prepare("UPDATE edgenode SET isonline = ? WHERE macAddress = ?");
-      query.bindValue(0, (a_isOnline ? 1 : 0));
-      query.bindValue(1, a_macAddress);
-   }
-   else
+   DB_OPERATION("forEachVirusHash");
+
+   QSqlQuery query(database());
+   prepareScan(query, QStringLiteral("forEachVirusHash"),
+                      "SELECT hashkey, description FROM virushash");
+   if(!query.exec())
    {
-      query.prepare("UPDATE edgenode SET isonline = ?, lastheartbeat = ? WHERE macAddress = ?");
-      query.bindValue(0, (a_isOnline ? 1 : 0));
-      query.bindValue(1, a_lastHeartbeatTimestamp);
-      query.bindValue(2, a_macAddress);
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all virus hashes: " << query.lastError();
+      throw std::runtime_error("Failed to get all virus hashes");
    }
+   streamRows<VirusHash>(query, readVirusHash, a_callback);
+}
+
+//!
+//! \brief The getVirusHashPage function
+//! Retrieves the next page of virus hashes using keyset pagination
+//!
+qint64 DatabaseHandler::getVirusHashPage(std::vector<VirusHash>& a_page, qint64 a_resumeToken, int a_limit) const
+{
+   DB_OPERATION("getVirusHashPage");
 
+   QSqlQuery& query = preparedQuery(QStringLiteral("getVirusHashPage"),
+                                    "SELECT rowid, hashkey, description FROM virushash "
+                                    "WHERE rowid > ? ORDER BY rowid LIMIT ?");
+   query.bindValue(0, a_resumeToken);
+   query.bindValue(1, a_limit);
    if(!query.exec())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to set edge node online status: " << query.lastError();
-      throw std::runtime_error("Failed to set edge node online status");
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of virus hashes: " << query.lastError();
+      throw std::runtime_error("Failed to get page of virus hashes");
    }
+   return readPage<VirusHash>(query, readVirusHash, a_page, a_resumeToken);
 }
 
 //!
-//! \brief The getOnlineEdgeNodes function
-//! Retrieves all the online Edge Nodes
+//! \brief The isHashInVirusDatabase function
+//! Checks if a virus hash can be found in the database using the in-memory virus hash index
 //!
-void DatabaseHandler::getOnlineEdgeNodes(QVector<QString> &a_macAddresses) const
+bool DatabaseHandler::isHashInVirusDatabase(const QString &a_hash) const
+{
+   DB_OPERATION("isHashInVirusDatabase");
+
+   // The index mirrors the virushash table, so SQLite is never queried here
+   return m_VirusHashIndex->contains(a_hash);
+}
+
+//!
+//! \brief The checkVirusHashes function
+//! Checks a whole set of file hashes in one sweep over the in-memory virus hash index.
+//! Bit i of a_matches is set if a_hashes[i] is a known virus hash, and the descriptions of all matches are
+//! retrieved with set-based queries. Returns the number of matching entries in a_hashes
+//!
+int DatabaseHandler::checkVirusHashes(const QVector<QString>& a_hashes, QBitArray& a_matches, std::vector<std::unique_ptr<VirusHash>>& a_matchingHashes) const
 {
-   QSqlQuery query;
+   DB_OPERATION("checkVirusHashes");
 
-   if(query.exec("SELECT macaddress FROM edgenode WHERE isonline = 1"))
+   a_matches.fill(false, a_hashes.size());
+
+   QVariantList matchingKeys;
+   for(qsizetype i = 0; i < a_hashes.size(); ++i)
    {
-      while (query.next())
+      if(m_VirusHashIndex->contains(a_hashes[i]))
       {
-         a_macAddresses.push_back( query.value(0).toString());
+         a_matches.setBit(i);
+         matchingKeys.append(a_hashes[i]);
       }
    }
-   else
+
+   if(matchingKeys.isEmpty())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to set edge node online status: " << query.lastError();
-      throw std::runtime_error("Failed to set edge node online status");
+      return 0;
+   }
+
+   QString sql("SELECT hashkey, description FROM virushash WHERE hashkey IN (?");
+   for(int i = 1; i < VIRUS_HASH_LOOKUP_CHUNK_SIZE; ++i)
+   {
+      sql.append(", ?");
+   }
+   sql.append(")");
+   QSqlQuery& query = preparedQuery(QStringLiteral("checkVirusHashes"), sql.toUtf8().constData());
+
+   for(qsizetype chunkStart = 0; chunkStart < matchingKeys.size(); chunkStart += VIRUS_HASH_LOOKUP_CHUNK_SIZE)
+   {
+      // A partial chunk is padded by repeating its last key, which does not change the result of IN
+      for(int i = 0; i < VIRUS_HASH_LOOKUP_CHUNK_SIZE; ++i)
+      {
+         query.bindValue(i, matchingKeys.at(qMin(chunkStart + i, matchingKeys.size() - 1)));
+      }
+
+      if(query.exec())
+      {
+         while(query.next())
+         {
+            std::unique_ptr<VirusHash> virusHash = std::make_unique<VirusHash>();
+            virusHash->virusHash = query.value(0).toString();
+            virusHash->description = query.value(1).toString();
+            a_matchingHashes.push_back(std::move(virusHash));
+         }
+      }
+      else
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to check virus hashes: " << query.lastError();
+         throw std::runtime_error("Failed to check virus hashes");
+      }
    }
+
+   return static_cast<int>(matchingKeys.size());
 }
 
 //!
-//! \brief The registerDevice function
-//! Registers a Device if it does not already exist
+//! \brief The logEvent function
+//! Logs an event related to a given Device on a given Edge Node
 //!
-void DatabaseHandler::registerDevice(const QString &a_productId, const QString &a_vendorId, const QString &a_serialNumber ) const
+void DatabaseHandler::logEvent(const QString& edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp, const QString& a_eventDescription)
 {
-   QSqlQuery query;
+   DB_OPERATION("logEvent");
 
-   // Ignore if it exists
-   query.prepare("INSERT INTO device(productid, vendorid, serialnumber, status) "
-                 "SELECT ?, ?, ?, ? "
-                 "WHERE NOT EXISTS(SELECT * "
-                 "FROM device "
-                 "WHERE productid = ? AND vendorid = ? AND serialnumber = ?)");
-   query.bindValue(0, a_productId);
-   query.bindValue(1, a_vendorId);
-   query.bindValue(2, a_serialNumber);
-   query.bindValue(3, DEVICE_STATUS_UNKNOWN);
-   query.bindValue(4, a_productId);
-   query.bindValue(5, a_vendorId);
-   query.bindValue(6, a_serialNumber);
+   const qint64 deviceId = getDeviceId(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   if(deviceId < 0)
+   {
+      return; // Events of unknown Devices are ignored
+   }
 
-   if(!query.exec())
+   const qint64 logtime = timestampValue(a_timestamp);
+   try
    {
-      qWarning() << __PRETTY_FUNCTION__ << "Failed to register device: " << query.lastError();
-      throw std::runtime_error("Failed to register device");
+      const QString partition = logPartitionForWrite(logtime);
+      const QString sql = QString("INSERT INTO %1(edgenodemacaddress, deviceid, logtime, loginfo) "
+                                  "VALUES(?, ?, ?, ?)").arg(partition);
+      QSqlQuery& query = preparedQuery(QStringLiteral("logEvent:") + partition, sql.toUtf8().constData(), QStringLiteral("logEvent:"));
+      query.bindValue(0, macAddressValue(edgeNodeMacAddress));
+      query.bindValue(1, deviceId);
+      query.bindValue(2, logtime);
+      query.bindValue(3, a_eventDescription);
+
+      if(!query.exec())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to log event: " << query.lastError();
+         throw std::runtime_error("Failed to log event");
+      }
+   }
+   catch(...)
+   {
+      // The partition may have been created in a transaction that was rolled back, create it again next time
+      forgetLogPartition(logtime);
+      throw;
    }
 }
 
 //!
-//! \brief The getDevice function
-//! Retrieves a Device
+//! \brief The getLoggedEvent function
+//! Retrieves a specific logged event
 //!
-bool DatabaseHandler::getDevice(Device &a_device, const QString &a_productId, const QString &a_vendorId, const QString &a_serialNumber) const
+bool DatabaseHandler::getLoggedEvent(LogEvent& logEvent, const QString& a_edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp) const
 {
-   bool success = false;
-   QSqlQuery query;
-   query.prepare("SELECT productid, vendorid, serialnumber FROM device WHERE productid = ? AND vendorid = ? AND serialnumber = ?");
-   query.bindValue(0, a_productId);
-   query.bindValue(1, a_vendorId);
-   query.bindValue(2, a_serialNumber);
+   DB_OPERATION("getLoggedEvent");
 
-   if(query.exec())
+   bool success = false;
+   const qint64 deviceId = getDeviceId(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   if(deviceId < 0)
    {
-      if(query.next())
-      {
-         a_device.productId = query.value(0).toString();
-         a_device.vendorId = query.value(1).toString();
-         a_device.serialNumber = query.value(2).toString();
-         success = true;
-      }
+      return success;
    }
-   else
+
+   const qint64 logtime = timestampValue(a_timestamp);
+   streamLoggedEvents(QStringLiteral("getLoggedEvent"),
+                      QStringLiteral(" WHERE edgenodemacaddress = ? AND deviceid = ? AND logtime = ?"),
+                      {macAddressValue(a_edgeNodeMacAddress), deviceId, logtime}, logtime, logtime + 1,
+                      [&logEvent, &success](const LogEvent& a_row)
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get device: " << query.lastError();
-      throw std::runtime_error("Failed to get device");
-   }
+      logEvent = a_row;
+      success = true;
+      return false;
+   });
 
    return success;
 }
 
 //!
-//! \brief The getAllDevices function
-//! Retrieves all Devices
+//! \brief The getAllLoggedEvents function
+//! Retrieves all logged events.
+//!
+void DatabaseHandler::getAllLoggedEvents(std::vector<std::unique_ptr<LogEvent> >& a_loggedEvents) const
+{
+   DB_OPERATION("getAllLoggedEvents");
+
+   forEachLoggedEvent([&a_loggedEvents](const LogEvent& a_row)
+   {
+      a_loggedEvents.push_back(std::make_unique<LogEvent>(a_row));
+      return true;
+   });
+}
+
+//!
+//! \brief The forEachLoggedEvent function
+//! Streams all logged events to a_callback without materializing the table
+//!
+void DatabaseHandler::forEachLoggedEvent(const RowCallback<LogEvent>& a_callback) const
+{
+   DB_OPERATION("forEachLoggedEvent");
+
+   streamLoggedEvents(QStringLiteral("forEachLoggedEvent"), QString(), {}, 0, (LOG_PARTITION_LAST_DAY + 1) * MICROSECONDS_PER_DAY, a_callback);
+}
+
+//!
+//! \brief The getLoggedEventPage function
+//! Retrieves the next page of logged events using keyset pagination
 //!
-void DatabaseHandler::getAllDevices(std::vector<std::unique_ptr<Device> > &a_devices) const
+qint64 DatabaseHandler::getLoggedEventPage(std::vector<LogEvent>& a_page, qint64 a_resumeToken, int a_limit) const
 {
-   QSqlQuery query;
-   if(query.exec("SELECT productid, vendorid, serialnumber FROM device"))
+   DB_OPERATION("getLoggedEventPage");
+
+   a_page.clear();
+   const qint64 resumeDay = a_resumeToken >> LOG_PAGE_TOKEN_ROWID_BITS;
+   const qint64 resumeRowId = a_resumeToken & ((qint64(1) << LOG_PAGE_TOKEN_ROWID_BITS) - 1);
+
+   for(const QString& partition : getLogPartitions(resumeDay, LOG_PARTITION_LAST_DAY))
    {
+      const qint64 day = logPartitionDay(partition);
+      const QString sql = QString("SELECT log.rowid, edgenodemacaddress, productid, vendorid, serialnumber, logtime, loginfo "
+                                  "FROM %1 AS log "
+                                  "INNER JOIN device ON device.id = log.deviceid "
+                                  "WHERE log.rowid > ? ORDER BY log.rowid LIMIT ?").arg(partition);
+      // Reads fan out over every partition they cover, so their statements are not cached
+      QSqlQuery query(database());
+      query.setForwardOnly(true);
+      if(!query.prepare(sql))
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to prepare query for" << partition << ": " << query.lastError();
+         throw std::runtime_error("Failed to prepare query for " + partition.toStdString());
+      }
+      query.bindValue(0, day == resumeDay ? resumeRowId : 0);
+      query.bindValue(1, a_limit - static_cast<int>(a_page.size()));
+      if(!query.exec())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to get page of logged events: " << query.lastError();
+         throw std::runtime_error("Failed to get page of logged events");
+      }
+
       while(query.next())
       {
-         std::unique_ptr<Device> device =  std::make_unique<Device>();
-         device->productId = query.value(0).toString();
-         device->vendorId = query.value(1).toString();
-         device->serialNumber = query.value(2).toString();
-         a_devices.push_back(std::move(device));
+         a_resumeToken = (day << LOG_PAGE_TOKEN_ROWID_BITS) | query.value(0).toLongLong();
+         a_page.emplace_back();
+         readLogEvent(query, 1, a_page.back());
+      }
+      if(static_cast<int>(a_page.size()) >= a_limit)
+      {
+         break;
       }
    }
-   else
-   {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all devices: " << query.lastError();
-      throw std::runtime_error("Failed to get all devices");
-   }
+   return a_resumeToken;
 }
 
 //!
-//! \brief The setDeviceBlacklisted function
-//! Updates the Device status to Blacklisted
+//! \brief The forEachLoggedEventBetween function
+//! Streams all logged events in a time window
 //!
-void DatabaseHandler::setDeviceBlacklisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+void DatabaseHandler::forEachLoggedEventBetween(const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const
 {
-   try
-   {
-      setDeviceStatus(a_productId, a_vendorId, a_serialNumber, DEVICE_STATUS_BLACKLISTED);
-   }
-   catch (std::exception& e)
+   DB_OPERATION("forEachLoggedEventBetween");
+
+   const qint64 from = Timestamp::fromDateTime(a_from);
+   const qint64 to = Timestamp::fromDateTime(a_to);
+   streamLoggedEvents(QStringLiteral("forEachLoggedEventBetween"),
+                      QStringLiteral(" WHERE log.logtime >= ? AND log.logtime < ? ORDER BY log.logtime"),
+                      {from, to}, from, to, a_callback);
+}
+
+//!
+//! \brief The forEachLoggedEventOnEdgeNode function
+//! Streams the events logged on an Edge Node in a time window
+//!
+void DatabaseHandler::forEachLoggedEventOnEdgeNode(const QString& a_edgeNodeMacAddress, const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const
+{
+   DB_OPERATION("forEachLoggedEventOnEdgeNode");
+
+   const qint64 from = Timestamp::fromDateTime(a_from);
+   const qint64 to = Timestamp::fromDateTime(a_to);
+   streamLoggedEvents(QStringLiteral("forEachLoggedEventOnEdgeNode"),
+                      QStringLiteral(" WHERE log.edgenodemacaddress = ? AND log.logtime >= ? AND log.logtime < ? ORDER BY log.logtime"),
+                      {macAddressValue(a_edgeNodeMacAddress), from, to}, from, to, a_callback);
+}
+
+//!
+//! \brief The forEachLoggedEventForDevice function
+//! Streams the events logged for a Device in a time window
+//!
+void DatabaseHandler::forEachLoggedEventForDevice(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const
+{
+   DB_OPERATION("forEachLoggedEventForDevice");
+
+   const qint64 deviceId = getDeviceId(a_deviceProductId, a_deviceVendorId, a_deviceSerialNumber);
+   if(deviceId < 0)
    {
-      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
-      throw e; // Forward the exception so it can be handled correctly by the caller";
+      return; // Unknown Devices have no events
    }
+
+   const qint64 from = Timestamp::fromDateTime(a_from);
+   const qint64 to = Timestamp::fromDateTime(a_to);
+   streamLoggedEvents(QStringLiteral("forEachLoggedEventForDevice"),
+                      QStringLiteral(" WHERE log.deviceid = ? AND log.logtime >= ? AND log.logtime < ? ORDER BY log.logtime"),
+                      {deviceId, from, to}, from, to, a_callback);
 }
 
 //!
-//! \brief The isDeviceBlackListed function
-//! Checks if a Device is Blacklisted
+//! \brief The getLogPartitions function
+//! Retrieves the names of all event log partitions, oldest first
 //!
-bool DatabaseHandler::isDeviceBlackListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+QVector<QString> DatabaseHandler::getLogPartitions() const
 {
-   bool retVal = true; // Assume the worst
-   try
+   DB_OPERATION("getLogPartitions");
+
+   return getLogPartitions(0, LOG_PARTITION_LAST_DAY);
+}
+
+//!
+//! \brief The dropLogPartitionsBefore function
+//! Drops every event log partition whose day ends before a_cutoff. Returns the number of dropped partitions
+//!
+int DatabaseHandler::dropLogPartitionsBefore(const QDateTime& a_cutoff)
+{
+   DB_OPERATION("dropLogPartitionsBefore");
+
+   const qint64 cutoffDay = logPartitionDay(Timestamp::fromDateTime(a_cutoff));
+   const QVector<QString> partitions = cutoffDay > 0 ? getLogPartitions(0, cutoffDay - 1) : QVector<QString>();
+   if(partitions.isEmpty())
+   {
+      return 0;
+   }
+
+   {
+      // Statements of this connection on the partitions are not in use, release them so the tables can be dropped
+      const QString connectionName = database().connectionName();
+      QMutexLocker locker(&m_PreparedQueriesMutex);
+      for(auto it = m_PreparedQueries.begin(); it != m_PreparedQueries.end();)
+      {
+         const qsizetype separator = it.key().second.lastIndexOf(':');
+         if(it.key().first == connectionName && separator >= 0 && partitions.contains(it.key().second.mid(separator + 1)))
+         {
+            it = m_PreparedQueries.erase(it);
+         }
+         else
+         {
+            ++it;
+         }
+      }
+   }
+
    {
-      retVal = checkDeviceStatus(a_productId, a_vendorId, a_serialNumber, DEVICE_STATUS_BLACKLISTED);
+      ScopedTransaction transaction(database(), "droplogpartitions");
+      QSqlQuery query(database());
+      for(const QString& partition : partitions)
+      {
+         if(!query.exec(QString("DROP TABLE %1").arg(partition)))
+         {
+            qCritical() << __PRETTY_FUNCTION__ << "Failed to drop log partition" << partition << ": " << query.lastError();
+            throw std::runtime_error("Failed to drop log partition " + partition.toStdString());
+         }
+      }
+      transaction.commit();
    }
-   catch(std::exception& e)
+
    {
-      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
-      throw e; // Forward the exception so it can be handled correctly by the caller";
+      QMutexLocker locker(&m_LogPartitionsMutex);
+      for(const QString& partition : partitions)
+      {
+         m_LogPartitionDays.remove(logPartitionDay(partition));
+      }
    }
+   // Statements cached by other connections may still refer to the dropped tables
+   invalidatePreparedQueries();
 
-   return retVal;
+   qInfo() << "Dropped" << partitions.size() << "log partitions before" << logPartitionName(cutoffDay);
+   return static_cast<int>(partitions.size());
 }
 
 //!
-//! \brief The setDeviceWhitelisted function
-//! Updates the Device status to Whitelisted
+//! \brief The database function
+//! Helper function to retrieve the connection of the calling thread from the connection pool
 //!
-void DatabaseHandler::setDeviceWhitelisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+QSqlDatabase DatabaseHandler::database() const
 {
-   try
-   {
-      setDeviceStatus(a_productId, a_vendorId, a_serialNumber, DEVICE_STATUS_WHITELISTED);
-   }
-   catch (std::exception& e)
-   {
-      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
-      throw e; // Forward the exception so it can be handled correctly by the caller";
-   }
+   return m_ConnectionPool->connection();
 }
 
 //!
-//! \brief The isDeviceWhiteListed function
-//! Checks if a Device is Whitelisted
+//! \brief The preparedQuery function
+//! Helper function to retrieve the cached prepared statement of an operation on the current connection.
+//! The statement is prepared on first use and afterwards only rebound and re-executed.
+//! When a_replacedOperations is set, the statements of this connection whose operation starts with it are
+//! released as the new one is prepared
 //!
-bool DatabaseHandler::isDeviceWhiteListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
+QSqlQuery& DatabaseHandler::preparedQuery(const QString& a_operation, const char* a_sql, const QString& a_replacedOperations) const
 {
-   bool retVal = false;
-   try
+   QSqlDatabase db = database();
+   const QPair<QString, QString> key(db.connectionName(), a_operation);
+
+   QMutexLocker locker(&m_PreparedQueriesMutex);
+   auto it = m_PreparedQueries.constFind(key);
+   if(it != m_PreparedQueries.constEnd() && it->generation == m_PreparedQueriesGeneration)
    {
-      retVal = checkDeviceStatus(a_productId, a_vendorId, a_serialNumber, DEVICE_STATUS_WHITELISTED);
+      ++m_PreparedQueryStatistics.hits;
+      return *(it->query);
    }
-   catch(std::exception& e)
+
+   ++m_PreparedQueryStatistics.misses;
+   std::shared_ptr<QSqlQuery> query = std::make_shared<QSqlQuery>(db);
+   // Results are only ever walked forwards, so the driver does not need to keep every row read
+   query->setForwardOnly(true);
+   if(!query->prepare(a_sql))
    {
-      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
-      throw e; // Forward the exception so it can be handled correctly by the caller";
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to prepare query for" << a_operation << ": " << query->lastError();
+      throw std::runtime_error("Failed to prepare query for " + a_operation.toStdString());
    }
 
-   return retVal;
+   if(!a_replacedOperations.isEmpty())
+   {
+      m_PreparedQueries.removeIf([&key, &a_replacedOperations](const std::pair<const QPair<QString, QString>&, PreparedQuery&>& a_entry)
+      {
+         return a_entry.first.first == key.first && a_entry.first.second.startsWith(a_replacedOperations);
+      });
+   }
+   m_PreparedQueries.insert(key, PreparedQuery{query, m_PreparedQueriesGeneration});
+   return *query;
 }
 
 //!
-//! \brief The registerConnectedDevice function
-//! Registers a connection between a Device and the Edge Node it is connected to
+//! \brief The loadVirusHashIndex function
+//! Helper function to build the in-memory virus hash index from the virushash table
 //!
-void DatabaseHandler::registerConnectedDevice(const QString &a_edgeNodeMacAddress, const QString &a_deviceProductId, const QString &a_deviceVendorId, const QString &a_deviceSerialNumber, const QString &a_timestamp)
+void DatabaseHandler::loadVirusHashIndex()
 {
-   QSqlQuery query;
-   query.prepare("INSERT INTO connecteddevice(edgenodemacaddress, deviceid, connecttime) "
-                 "SELECT ?, device.id, ? "
-                 "FROM device "
-                 "WHERE device.productid = ? AND device.vendorid = ? AND device.serialnumber = ?");
-   query.bindValue(0, a_edgeNodeMacAddress);
-   query.bindValue(1, a_timestamp);
-   query.bindValue(2, a_deviceProductId);
-   query.bindValue(3, a_deviceVendorId);
-   query.bindValue(4, a_deviceSerialNumber);
+   m_VirusHashIndex->clear();
 
-   if(!query.exec())
+   QSqlQuery& countQuery = preparedQuery(QStringLiteral("loadVirusHashIndexCount"),
+                                         "SELECT count(*) FROM virushash");
+   if(countQuery.exec() && countQuery.next())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to register connected device: " << query.lastError();
-      throw std::runtime_error("Failed to register connected device");
+      m_VirusHashIndex->reserve(countQuery.value(0).toLongLong());
+   }
+   countQuery.finish();
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("loadVirusHashIndex"),
+                                    "SELECT hashkey FROM virushash");
+   if(query.exec())
+   {
+      while(query.next())
+      {
+         m_VirusHashIndex->insert(query.value(0).toString());
+      }
+   }
+   else
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to load virus hash index: " << query.lastError();
+      throw std::runtime_error("Failed to load virus hash index");
    }
 }
 
 //!
-//! \brief The unregisterConnectedDevicesOnEdgeNode function
-//! Unregisters all Device connections to an Edge Node
+//! \brief The getLogPartitions function
+//! Retrieves the names of the event log partitions from a_fromDay to a_toDay, oldest first.
+//! The list is read through the calling connection, so it matches what its queries can see
 //!
-void DatabaseHandler::unregisterConnectedDevicesOnEdgeNode(const QString &a_edgeNodeMacAddress)
+QVector<QString> DatabaseHandler::getLogPartitions(qint64 a_fromDay, qint64 a_toDay) const
 {
-   QSqlQuery query;
-   query.prepare("DELETE FROM connecteddevice "
-                 "WHERE edgenodemacaddress = ?");
-   query.bindValue(0, a_edgeNodeMacAddress);
+   QVector<QString> partitions;
+   QSqlQuery& query = preparedQuery(QStringLiteral("getLogPartitions"),
+                                    "SELECT name FROM sqlite_master "
+                                    "WHERE type = 'table' AND name GLOB 'log_[0-9]*' AND name >= ? AND name <= ? ORDER BY name");
+   query.bindValue(0, logPartitionName(qMax<qint64>(a_fromDay, 0)));
+   query.bindValue(1, logPartitionName(qMin(a_toDay, LOG_PARTITION_LAST_DAY)));
 
    if(!query.exec())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to unregister all connected devices on edge node: " << query.lastError();
-      throw std::runtime_error("Failed to unregister all connected devices on edge node");
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to get log partitions: " << query.lastError();
+      throw std::runtime_error("Failed to get log partitions");
+   }
+   while(query.next())
+   {
+      partitions.append(query.value(0).toString());
    }
+   return partitions;
 }
 
 //!
-//! \brief The unregisterConnectedDevice function
-//! Unregisters a connection between a Device and the Edge Node it was connected to
+//! \brief The logPartitionForWrite function
+//! Returns the partition an event at a_logtime is written to, creating it on first use
 //!
-void DatabaseHandler::unregisterConnectedDevice(const QString &a_edgeNodeMacAddress, const QString &a_deviceProductId, const QString &a_deviceVendorId, const QString &a_deviceSerialNumber)
+QString DatabaseHandler::logPartitionForWrite(qint64 a_logtime) const
 {
-   QSqlQuery query;
-   query.prepare("DELETE FROM connecteddevice "
-                 "WHERE edgenodemacaddress = ? AND deviceid = (SELECT id FROM device WHERE productid = ? AND vendorid = ? AND serialnumber = ?)");
-   query.bindValue(0, a_edgeNodeMacAddress);
-   query.bindValue(1, a_deviceProductId);
-   query.bindValue(2, a_deviceVendorId);
-   query.bindValue(3, a_deviceSerialNumber);
+   const qint64 day = logPartitionDay(a_logtime);
+   const QString partition = logPartitionName(day);
 
-   if(!query.exec())
+   QMutexLocker locker(&m_LogPartitionsMutex);
+   if(!m_LogPartitionDays.contains(day))
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to unregister connected device: " << query.lastError();
-      throw std::runtime_error("Failed to unregister connected device");
+      createLogPartition(database(), partition, m_CompactIds);
+      m_LogPartitionDays.insert(day);
    }
+   return partition;
+}
+
+void DatabaseHandler::forgetLogPartition(qint64 a_logtime) const
+{
+   QMutexLocker locker(&m_LogPartitionsMutex);
+   m_LogPartitionDays.remove(logPartitionDay(a_logtime));
 }
 
 //!
-//! \brief The registerConnectedDevice function
-//! Retrieves all connnections between Devicees and Edge Nodes
+//! \brief The streamLoggedEvents function
+//! Runs a logged event query on every partition overlapping [a_from, a_to) in order, until a_callback stops it
 //!
-void DatabaseHandler::getAllConnectedDevices(std::vector<std::unique_ptr<ConnectedDevice> > &a_connectedDevices)
+void DatabaseHandler::streamLoggedEvents(const QString& a_operation, const QString& a_condition, const QVariantList& a_values, qint64 a_from, qint64 a_to, const RowCallback<LogEvent>& a_callback) const
 {
-   QSqlQuery query;
-   if(query.exec("SELECT edgenodemacaddress, productid, vendorid, serialnumber "
-                 "FROM connecteddevice "
-                 "INNER JOIN device ON device.id = connecteddevice.deviceid"))
+   if(a_to <= a_from)
    {
-      while(query.next())
-      {
-         std::unique_ptr<ConnectedDevice> connectedDevice =  std::make_unique<ConnectedDevice>();
-         connectedDevice->connectedEdgeNodeMacAddress = query.value(0).toString();
-         connectedDevice->deviceProductId = query.value(1).toString();
-         connectedDevice->deviceVendorId = query.value(2).toString();
-         connectedDevice->deviceSerialNumber = query.value(3).toString();
-         a_connectedDevices.push_back(std::move(connectedDevice));
-      }
+      return;
    }
-   else
+
+   for(const QString& partition : getLogPartitions(logPartitionDay(a_from), logPartitionDay(a_to - 1)))
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all connected devices: " << query.lastError();
-      throw std::runtime_error("Failed to get all connected devices");
+      const QString sql = QString("SELECT edgenodemacaddress, productid, vendorid, serialnumber, logtime, loginfo "
+                                  "FROM %1 AS log "
+                                  "INNER JOIN device ON device.id = log.deviceid%2").arg(partition, a_condition);
+      // Reads fan out over every partition they cover, so their statements are not cached
+      QSqlQuery query(database());
+      query.setForwardOnly(true);
+      if(!query.prepare(sql))
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to prepare query for" << a_operation << "on" << partition << ": " << query.lastError();
+         throw std::runtime_error("Failed to prepare query for " + a_operation.toStdString());
+      }
+      for(qsizetype i = 0; i < a_values.size(); ++i)
+      {
+         query.bindValue(static_cast<int>(i), a_values.at(i));
+      }
+
+      if(!query.exec())
+      {
+         qCritical() << __PRETTY_FUNCTION__ << "Failed to get logged events: " << query.lastError();
+         throw std::runtime_error("Failed to get logged events");
+      }
+      if(!streamRows<LogEvent>(query, readLogEvent, a_callback))
+      {
+         return;
+      }
    }
 }
 
 //!
-//! \brief The registerProductVendor function
-//! Registers a product vendor combination
+//! \brief The findDevice function
+//! Helper function to resolve a Device triple to its id and status, using the device cache when possible.
+//! Returns false if the Device is not registered
 //!
-void DatabaseHandler::registerProductVendor(const QString &a_productId, const QString &a_productName, const QString &a_vendorId, const QString &a_vendorName)
+bool DatabaseHandler::findDevice(CachedDevice& a_device, const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, bool a_queryOnMiss) const
 {
-   QSqlQuery query;
-   query.prepare("INSERT INTO productvendor(productid, vendorid, productname, vendorname)"
-                 "VALUES(?, ?, ?, ?)");
-   query.bindValue(0, a_productId);
-   query.bindValue(1, a_vendorId);
-   query.bindValue(2, a_productName);
-   query.bindValue(3, a_vendorName);
+   const DeviceKey key = canonicalDeviceKey(a_productId, a_vendorId, a_serialNumber);
+   quint64 generation = 0;
+   {
+      QMutexLocker locker(&m_DevicesMutex);
+      const CachedDevice* cachedDevice = m_Devices.object(key);
+      if(cachedDevice != nullptr)
+      {
+         a_device = *cachedDevice;
+         return true;
+      }
+      generation = m_DevicesGeneration;
+   }
 
-   if(!query.exec())
+   if(!a_queryOnMiss)
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to register productvendor: " << query.lastError();
-      throw std::runtime_error("Failed to register productvendor");
+      return false;
    }
-}
 
-//!
-//! \brief The getProductVendor function
-//! Retrieves a product vendor combination
-//!
-bool DatabaseHandler::getProductVendor(ProductVendor& a_productVendor, const QString &a_productId, const QString a_vendorId)
-{
-   bool success = false;
-   QSqlQuery query;
-   query.prepare("SELECT * FROM productvendor WHERE productid = ? AND vendorid = ?");
-   query.bindValue(0, a_productId);
-   query.bindValue(1, a_vendorId);
+   bool found = false;
+   QSqlQuery& query = preparedQuery(QStringLiteral("findDevice"),
+                                    "SELECT id, status FROM device WHERE productid = ? AND vendorid = ? AND serialnumber = ?");
+   query.bindValue(0, usbIdValue(a_productId));
+   query.bindValue(1, usbIdValue(a_vendorId));
+   query.bindValue(2, a_serialNumber);
 
    if(query.exec())
    {
       if(query.next())
       {
-         a_productVendor.productId = query.value(0).toString();
-         a_productVendor.vendorId = query.value(1).toString();
-         a_productVendor.productName = query.value(2).toString();
-         a_productVendor.vendorName = query.value(3).toString();
-         success = true;
+         a_device.id = query.value(0).toLongLong();
+         a_device.status = deviceStatusFromValue(query.value(1));
+         found = true;
       }
+      query.finish();
    }
    else
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get productvendor: " << query.lastError();
-      throw std::runtime_error("Failed to get productvendor");
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to find device: " << query.lastError();
+      throw std::runtime_error("Failed to find device");
    }
 
-   return success;
+   if(found)
+   {
+      // Inside a transaction the row may hold an uncommitted status, so it is cached on commit only
+      applyOnCommit([this, key, device = a_device, generation]()
+      {
+         cacheDevice(key, device, generation);
+      });
+   }
+   return found;
 }
 
 //!
-//! \brief The getAllProductVendors function
-//! Retrieves all product vendor combination
+//! \brief The getDeviceId function
+//! Helper function to resolve a Device triple to its id. Returns -1 if the Device is not registered
 //!
-void DatabaseHandler::getAllProductVendors(std::vector<std::unique_ptr<ProductVendor> >& a_productVendors)
+qint64 DatabaseHandler::getDeviceId(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, bool a_queryOnMiss) const
 {
-   QSqlQuery query;
-   if(query.exec("SELECT * FROM productvendor"))
-   {
-      while(query.next())
-      {
-         std::unique_ptr<ProductVendor> productVendor =  std::make_unique<ProductVendor>();
-         productVendor->productId = query.value(0).toString();
-         productVendor->vendorId = query.value(1).toString();
-         productVendor->productName = query.value(2).toString();
-         productVendor->vendorName = query.value(3).toString();
-         a_productVendors.push_back(std::move(productVendor));
-      }
-   }
-   else
-   {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all productvendors: " << query.lastError();
-      throw std::runtime_error("Failed to get all productvendors");
-   }
+   CachedDevice device;
+   return findDevice(device, a_productId, a_vendorId, a_serialNumber, a_queryOnMiss) ? device.id : -1;
 }
 
 //!
-//! \brief The registerVirusHash function
-//! Registers a virus file hash
+//! \brief The cacheDevice function
+//! Helper function to add a Device to the device cache. a_generation is the cache generation from before the
+//! Device was read, the Device is dropped when a status was written since
 //!
-void DatabaseHandler::registerVirusHash(const QString &virusHash, const QString &a_description)
+void DatabaseHandler::cacheDevice(const DeviceKey& a_key, const CachedDevice& a_device, quint64 a_generation) const
 {
-   QSqlQuery query;
-   query.prepare("INSERT INTO virushash(hashkey, description)"
-                 "VALUES(?, ?)");
-   query.bindValue(0, virusHash);
-   query.bindValue(1, a_description);
-
-   if(!query.exec())
+   QMutexLocker locker(&m_DevicesMutex);
+   if(a_generation == m_DevicesGeneration)
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to register virus hash: " << query.lastError();
-      throw std::runtime_error("Failed to register virus hash");
+      m_Devices.insert(a_key, new CachedDevice(a_device));
    }
 }
 
 //!
-//! \brief The getVirusHash function
-//! Retrieves a virus hash with description
+//! \brief The loadDeviceIdCache function
+//! Helper function to warm the device cache with the most recently registered Devices
 //!
-bool DatabaseHandler::getVirusHash(VirusHash &a_vHash, const QString &a_virusHash) const
+void DatabaseHandler::loadDeviceIdCache()
 {
-   bool success = false;
-   QSqlQuery query;
-   query.prepare("SELECT * FROM virushash WHERE hashkey = ?");
-   query.bindValue(0, a_virusHash);
+   quint64 generation = 0;
+   {
+      QMutexLocker locker(&m_DevicesMutex);
+      m_Devices.clear();
+      generation = ++m_DevicesGeneration;
+   }
+
+   QSqlQuery& query = preparedQuery(QStringLiteral("loadDeviceIdCache"),
+                                    "SELECT id, productid, vendorid, serialnumber, status FROM device ORDER BY id DESC LIMIT ?");
+   query.bindValue(0, DEVICE_CACHE_CAPACITY);
 
    if(query.exec())
    {
-      if(query.next())
+      while(query.next())
       {
-         a_vHash.virusHash = query.value(0).toString();
-         a_vHash.description = query.value(1).toString();
-         success = true;
+         cacheDevice(DeviceKey{usbIdText(query.value(1)), usbIdText(query.value(2)), query.value(3).toString()},
+                     CachedDevice{query.value(0).toLongLong(), deviceStatusFromValue(query.value(4))}, generation);
       }
    }
    else
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get virus hash: " << query.lastError();
-      throw std::runtime_error("Failed to get virus hash");
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to load device cache: " << query.lastError();
+      throw std::runtime_error("Failed to load device cache");
    }
-
-   return success;
 }
 
 //!
-//! \brief The getAllVirusHashKeys function
-//! Retrieves all virus hashes
+//! \brief The canonicalDeviceKey function
+//! Helper function to convert a Device triple to the text form the database reads back, the key of the device cache
+//! and the connected device index
 //!
-void DatabaseHandler::getAllVirusHashKeys(QVector<QString> &a_virusHashes) const
+DatabaseHandler::DeviceKey DatabaseHandler::canonicalDeviceKey(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const
 {
-   try
+   if(!m_CompactIds)
    {
-      getKeysFromTable("hashkey", "virushash",  a_virusHashes);
+      return DeviceKey{a_productId, a_vendorId, a_serialNumber};
    }
-   catch(std::exception& e)
+   return DeviceKey{usbIdText(usbIdValue(a_productId)), usbIdText(usbIdValue(a_vendorId)), a_serialNumber};
+}
+
+//!
+//! \brief The connectedEdgeNodeKey function
+//! Helper function to convert a MAC address to the text form the database reads back, the key of the connected device index
+//!
+QString DatabaseHandler::connectedEdgeNodeKey(const QString& a_macAddress) const
+{
+   if(!m_CompactIds)
    {
-      qCritical() <<  __PRETTY_FUNCTION__ << e.what();
-      throw e;
+      return a_macAddress;
    }
+   return macAddressText(macAddressValue(a_macAddress));
 }
 
 //!
-//! \brief The getAllVirusHashes function
-//! Retrieves all virus hashes with descriptions
+//! \brief The forgetConnectedDevicesOnEdgeNode function
+//! Helper function to remove every connection of an Edge Node from the connected device index
 //!
-void DatabaseHandler::getAllVirusHashes(std::vector<std::unique_ptr<VirusHash> > &a_virusHashes) const
+void DatabaseHandler::forgetConnectedDevicesOnEdgeNode(const QString& a_edgeNodeKey)
 {
-   QSqlQuery query;
-   if(query.exec("SELECT * FROM virushash"))
+   QMutexLocker locker(&m_ConnectedDevicesMutex);
+   const QSet<DeviceKey> devices = m_DevicesByEdgeNode.take(a_edgeNodeKey);
+   for(const DeviceKey& deviceKey : devices)
    {
-      while(query.next())
+      auto edgeNodes = m_EdgeNodesByDevice.find(deviceKey);
+      if(edgeNodes != m_EdgeNodesByDevice.end())
       {
-         std::unique_ptr<VirusHash> virusHash =  std::make_unique<VirusHash>();
-         virusHash->virusHash = query.value(0).toString();
-         virusHash->description = query.value(1).toString();
-         a_virusHashes.push_back(std::move(virusHash));
+         edgeNodes->remove(a_edgeNodeKey);
+         if(edgeNodes->isEmpty())
+         {
+            m_EdgeNodesByDevice.erase(edgeNodes);
+         }
       }
    }
-   else
+}
+
+//!
+//! \brief The loadConnectedDeviceIndex function
+//! Helper function to rebuild the connected device index from the connecteddevice table
+//!
+void DatabaseHandler::loadConnectedDeviceIndex()
+{
+   QHash<QString, QSet<DeviceKey>> devicesByEdgeNode;
+   QHash<DeviceKey, QSet<QString>> edgeNodesByDevice;
+   forEachConnectedDevice([&devicesByEdgeNode, &edgeNodesByDevice](const ConnectedDevice& a_row)
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all virus hashes: " << query.lastError();
-      throw std::runtime_error("Failed to get all virus hashes");
-   }
+      const DeviceKey deviceKey{a_row.deviceProductId, a_row.deviceVendorId, a_row.deviceSerialNumber};
+      devicesByEdgeNode[a_row.connectedEdgeNodeMacAddress].insert(deviceKey);
+      edgeNodesByDevice[deviceKey].insert(a_row.connectedEdgeNodeMacAddress);
+      return true;
+   });
+
+   QMutexLocker locker(&m_ConnectedDevicesMutex);
+   m_DevicesByEdgeNode.swap(devicesByEdgeNode);
+   m_EdgeNodesByDevice.swap(edgeNodesByDevice);
 }
 
 //!
-//! \brief The isHashInVirusDatabase function
-//! Checks if a virus hash can be found in the database
+//! \brief The migrateSchema function
+//! Helper function to bring the database schema up to the latest version.
+//! Databases created before schema versioning have the version 1 tables but user_version 0
 //!
-bool DatabaseHandler::isHashInVirusDatabase(const QString &a_hash) const
+void DatabaseHandler::migrateSchema()
 {
-   bool found = true; // Assume the worst
-   QSqlQuery query;
-   query.prepare("SELECT * FROM virushash WHERE hashkey = ?");
-   query.bindValue(0, a_hash);
+   m_CompactIds = detectCompactIds();
+   int version = getSchemaVersion();
 
-   if(query.exec())
+   if(version == 0)
    {
-      if(!query.next())
+      QSqlQuery query(database());
+      if(query.exec("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'edgenode'") && query.next())
       {
-         found = false;
+         version = 1;
       }
    }
-   else
+
+   bool migrated = false;
+   for(const Migration& migration : migrations())
    {
-      qCritical() <<  __PRETTY_FUNCTION__ << "Failed to check virus hash: " << query.lastError();
-      throw std::runtime_error("Failed to check virus hash");
+      if(migration.version <= version)
+      {
+         continue;
+      }
+
+      QElapsedTimer timer;
+      timer.start();
+      try
+      {
+         ScopedTransaction transaction(database(), "migration");
+         QSqlQuery query(database());
+         for(const char* statement : migration.statements)
+         {
+            if(!query.exec(schemaStatement(statement, m_CompactIds)))
+            {
+               throw std::runtime_error(query.lastError().text().toStdString());
+            }
+         }
+         if(migration.convert)
+         {
+            migration.convert(database(), m_CompactIds);
+         }
+
+         if(!query.exec(QString("PRAGMA user_version = %1").arg(migration.version)))
+         {
+            throw std::runtime_error(query.lastError().text().toStdString());
+         }
+         query.finish();
+         transaction.commit();
+      }
+      catch(std::exception& e)
+      {
+         qFatal("Failed to migrate database schema to version %d: %s", migration.version, e.what());
+      }
+
+      qInfo() << "Migrated database schema to version" << migration.version << "(" << migration.description << ") in" << timer.elapsed() << "ms";
+      version = migration.version;
+      migrated = true;
    }
 
-   return found;
+   if(migrated)
+   {
+      invalidatePreparedQueries();
+   }
 }
 
 //!
-//! \brief The logEvent function
-//! Logs an event related to a given Device on a given Edge Node
+//! \brief The detectCompactIds function
+//! Reads the layout of an existing database from its edgenode table. New databases use the layout set in the environment
 //!
-void DatabaseHandler::logEvent(const QString& edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp, const QString& a_eventDescription)
+bool DatabaseHandler::detectCompactIds() const
 {
-   QSqlQuery query;
-   query.prepare("INSERT INTO log(edgenodemacaddress, deviceid, logtime, loginfo) "
-                 "SELECT ?, device.id, ?, ? "
-                 "FROM device "
-                 "WHERE device.productid = ? AND device.vendorid = ? AND device.serialnumber = ?");
-   query.bindValue(0, edgeNodeMacAddress);
-   query.bindValue(1, a_timestamp);
-   query.bindValue(2, a_eventDescription);
-   query.bindValue(3, a_deviceProductId);
-   query.bindValue(4, a_deviceVendorId);
-   query.bindValue(5, a_deviceSerialNumber);
-
-   if(!query.exec())
+   QSqlQuery query(database());
+   if(query.exec("SELECT type FROM pragma_table_info('edgenode') WHERE name = 'macaddress'") && query.next())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to log event: " << query.lastError();
-      throw std::runtime_error("Failed to log event");
+      return query.value(0).toString().compare("INTEGER", Qt::CaseInsensitive) == 0;
    }
+   return CompactIds::enabledInEnvironment();
 }
 
 //!
-//! \brief The getLoggedEvent function
-//! Retrieves a specific logged event
+//! \brief The macAddressValue function
+//! Converts a MAC address to the value stored by the database layout
 //!
-bool DatabaseHandler::getLoggedEvent(LogEvent& logEvent, const QString& a_edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp) const
+QVariant DatabaseHandler::macAddressValue(const QString& a_macAddress) const
 {
-   bool success = false;
-   QSqlQuery query;
-   query.prepare("SELECT edgenodemacaddress, productid, vendorid, serialnumber, logtime, loginfo "
-                 "FROM log "
-                 "INNER JOIN device ON device.id = log.deviceid "
-                 "WHERE edgenodemacaddress = ? "
-                 "AND deviceid = (SELECT id "
-                 "FROM device "
-                 "WHERE productid = ? AND vendorid = ? AND serialnumber = ?) "
-                 "AND logtime = ? ");
-   query.bindValue(0, a_edgeNodeMacAddress);
-   query.bindValue(1, a_deviceProductId);
-   query.bindValue(2, a_deviceVendorId);
-   query.bindValue(3, a_deviceSerialNumber);
-   query.bindValue(4, a_timestamp);
-
-   if(query.exec())
+   if(!m_CompactIds)
    {
-      if(query.next())
-      {
-         logEvent.edgeNodeMacAddress = query.value(0).toString();
-         logEvent.deviceProductId = query.value(1).toString();
-         logEvent.deviceVendorId = query.value(2).toString();
-         logEvent.deviceSerialNumber = query.value(3).toString();
-         logEvent.timestamp = query.value(4).toString();
-         logEvent.eventDescription = query.value(5).toString();
-         success = true;
-      }
+      return a_macAddress;
    }
-   else
+
+   CompactIds::MacAddress macAddress;
+   if(!CompactIds::parseMacAddress(a_macAddress, macAddress))
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get log event: " << query.lastError();
-      throw std::runtime_error("Failed to get log event");
+      qWarning() << __PRETTY_FUNCTION__ << "Invalid MAC address: " << a_macAddress;
+      throw std::runtime_error("Invalid MAC address: " + a_macAddress.toStdString());
    }
-
-   return success;
+   return static_cast<qint64>(macAddress);
 }
 
 //!
-//! \brief The getAllLoggedEvents function
-//! Retrieves all logged events.
+//! \brief The usbIdValue function
+//! Converts a vendor or product ID to the value stored by the database layout
 //!
-void DatabaseHandler::getAllLoggedEvents(std::vector<std::unique_ptr<LogEvent> >& a_loggedEvents) const
+QVariant DatabaseHandler::usbIdValue(const QString& a_usbId) const
 {
-   QSqlQuery query;
-   if(query.exec("SELECT edgenodemacaddress, productid, vendorid, serialnumber, logtime, loginfo "
-                 "FROM log "
-                 "INNER JOIN device ON device.id = log.deviceid"))
+   if(!m_CompactIds)
    {
-      while(query.next())
-      {
-         std::unique_ptr<LogEvent> logEvent =  std::make_unique<LogEvent>();
-         logEvent->edgeNodeMacAddress = query.value(0).toString();
-         logEvent->deviceProductId = query.value(1).toString();
-         logEvent->deviceVendorId = query.value(2).toString();
-         logEvent->deviceSerialNumber = query.value(3).toString();
-         logEvent->timestamp = query.value(4).toString();
-         logEvent->eventDescription = query.value(5).toString();
-         a_loggedEvents.push_back(std::move(logEvent));
-      }
+      return a_usbId;
    }
-   else
+
+   CompactIds::UsbId usbId;
+   if(!CompactIds::parseUsbId(a_usbId, usbId))
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Invalid vendor or product id: " << a_usbId;
+      throw std::runtime_error("Invalid vendor or product id: " + a_usbId.toStdString());
+   }
+   return static_cast<int>(usbId);
+}
+
+//!
+//! \brief The getTotalChanges function
+//! Helper function to retrieve the number of rows changed on the connection since it was opened
+//!
+qint64 DatabaseHandler::getTotalChanges() const
+{
+   QSqlQuery& query = preparedQuery(QStringLiteral("getTotalChanges"),
+                                    "SELECT total_changes()");
+   if(!query.exec() || !query.next())
    {
-      qCritical() << __PRETTY_FUNCTION__ << "Failed to get all logged events: " << query.lastError();
-      throw std::runtime_error("Failed to get all logged events");
+      throw std::runtime_error("Failed to get total changes: " + query.lastError().text().toStdString());
    }
+
+   const qint64 totalChanges = query.value(0).toLongLong();
+   query.finish();
+   return totalChanges;
 }
 
 //!
 //! \brief The getKeysFromTable function
 //! Helper function to retrieve the VARCHAR keys if a given table
 //!
-void DatabaseHandler::getKeysFromTable(const QString a_keyName, const QString &a_tableName, QVector<QString> &a_result) const
+void DatabaseHandler::getKeysFromTable(const QString a_keyName, const QString &a_tableName, QVector<QString> &a_result, KeyFormatter a_format) const
 {
-   QSqlQuery query;
-   query.prepare(QString("SELECT %1 FROM %2").arg(a_keyName, a_tableName));
+   const QString sql = QString("SELECT %1 FROM %2").arg(a_keyName, a_tableName);
+   QSqlQuery& query = preparedQuery(QString("getKeysFromTable:%1.%2").arg(a_tableName, a_keyName), sql.toUtf8().constData());
 
    if(query.exec())
    {
       while (query.next())
       {
-         a_result.push_back( query.value(0).toString());
+         a_result.push_back( a_format == nullptr ? query.value(0).toString() : a_format(query.value(0)));
       }
    }
    else
@@ -810,48 +2919,33 @@ void DatabaseHandler::getKeysFromTable(const QString a_keyName, const QString &a
 
 //!
 //! \brief The setDeviceStatus function
-//! Helper function to set the status of a given Device
+//! Helper function to set the status of a given Device. The device cache takes the new status when the outermost
+//! transaction commits, until then status checks return the committed status
 //!
-void DatabaseHandler::setDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, const QString& a_status) const
+void DatabaseHandler::setDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, DeviceStatus a_status) const
 {
-   QSqlQuery query;
-   query.prepare("UPDATE device SET status = ? WHERE productid = ? AND vendorid = ? AND serialnumber = ?");
-   query.bindValue(0, a_status);
-   query.bindValue(1, a_productId);
-   query.bindValue(2, a_vendorId);
-   query.bindValue(3, a_serialNumber);
-
-   if(!query.exec())
+   CachedDevice device;
+   if(!findDevice(device, a_productId, a_vendorId, a_serialNumber))
    {
-      throw std::runtime_error("Failed to set device status: " + query.lastError().text().toStdString());
+      return; // Unknown Devices have no status
    }
-}
 
-//!
-//! \brief The checkDeviceStatus function
-//! Helper function to check the status of a given Device
-//!
-bool DatabaseHandler::checkDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, const QString& a_status) const
-{
-   bool retVal = false;
-   QSqlQuery query;
-   query.prepare("SELECT * FROM device WHERE productId = ? AND vendorid = ? AND serialnumber = ? AND status = ?");
-   query.bindValue(0, a_productId);
-   query.bindValue(1, a_vendorId);
-   query.bindValue(2, a_serialNumber);
-   query.bindValue(3, a_status);
+   QSqlQuery& query = preparedQuery(QStringLiteral("setDeviceStatus"),
+                                    "UPDATE device SET status = ? WHERE id = ?");
+   query.bindValue(0, deviceStatusValue(a_status));
+   query.bindValue(1, device.id);
 
-   if(query.exec())
-   {
-      if(query.next())
-      {
-         retVal = true;
-      }
-   }
-   else
+   if(!query.exec())
    {
-      throw std::runtime_error("Failed to check device status: " + query.lastError().text().toStdString());
+      qCritical() << __PRETTY_FUNCTION__ << "Failed to set device status: " << query.lastError();
+      throw std::runtime_error("Failed to set device status: " + query.lastError().text().toStdString());
    }
 
-   return retVal;
+   device.status = a_status;
+   applyOnCommit([this, key = canonicalDeviceKey(a_productId, a_vendorId, a_serialNumber), device]()
+   {
+      QMutexLocker locker(&m_DevicesMutex);
+      ++m_DevicesGeneration;
+      m_Devices.insert(key, new CachedDevice(device));
+   });
 }
@@ -1,7 +1,21 @@
 #pragma once
 #include <QString>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QMutex>
+#include <QCache>
+#include <memory>
+#include <functional>
 
 class QSqlQuery;
+class QSqlDatabase;
+class QBitArray;
+class QThread;
+class QVariant;
+class QDateTime;
+class VirusHashIndex;
+class DatabaseConnectionPool;
 //!
 //! \brief The DatabaseHandler class
 //! Creates the required database tables and provides an API to run predefined queries
@@ -11,6 +25,55 @@ class DatabaseHandler
 {
 public:
     DatabaseHandler( const QString& a_databasePath );
+    ~DatabaseHandler();
+
+    // Prepared statement cache
+    struct PreparedQueryStatistics
+    {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 invalidations = 0;
+    };
+    PreparedQueryStatistics getPreparedQueryStatistics() const;
+    void invalidatePreparedQueries() const;
+
+    // Transactions and connections. Every thread uses its own connection. Only the thread bound as the writer,
+    // or the constructing thread while none is bound, may write. Other threads read through query only connections.
+    // Transactions nest: inner ones are savepoints. The in-memory caches only take the writes of a transaction
+    // once the outermost one commits
+    enum class SynchronousMode
+    {
+        Off,
+        Normal,
+        Full
+    };
+    void beginTransaction() const;
+    void commitTransaction() const;
+    void rollbackTransaction() const;
+    void setSynchronousMode(SynchronousMode a_mode) const;
+    void bindWriterThread() const;
+    void releaseThreadConnection() const;
+
+    // Streaming and keyset pagination
+    // forEach* functions hand every row to a_callback as soon as it is read. The row object is reused between calls,
+    // and returning false from the callback stops the iteration.
+    // get*Page functions replace the contents of a_page with up to a_limit rows following a_resumeToken
+    // and return the token to resume from. Pass 0 for the first page. An empty page marks the end
+    template<typename T>
+    using RowCallback = std::function<bool(const T&)>;
+    static constexpr qint64 FIRST_PAGE = 0;
+
+    // Schema versioning
+    int getSchemaVersion() const;
+    static int getLatestSchemaVersion();
+
+    // Compact layout. Databases created with HOSTSECURE_DB_COMPACT_IDS set store MAC addresses and vendor and product IDs
+    // as integers. The API keeps using text, invalid ids are rejected with an exception in that layout
+    bool usesCompactIds() const;
+
+    // In-memory caches. Must be reloaded when tables are modified outside of this API
+    void reloadCaches();
+    void reloadDeviceCaches();
 
     // Edge node
     struct EdgeNode
@@ -23,8 +86,16 @@ public:
     bool getEdgeNode(EdgeNode& a_edgeNode, const QString& a_macAddress) const;
     void getAllEdgeNodeKeys(QVector<QString>& a_macAddresses) const;
     void getAllEdgeNodes(std::vector<std::unique_ptr<EdgeNode>>& a_edgeNodes) const;
+    void forEachEdgeNode(const RowCallback<EdgeNode>& a_callback) const;
+    qint64 getEdgeNodePage(std::vector<EdgeNode>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
     void setEdgeNodeOnlineStatus(const QString& a_macAddress, bool a_isOnline, const QString& a_lastHeartbeatTimestamp = "");
+    void registerOrUpdateEdgeNodes(const std::vector<EdgeNode>& a_edgeNodes);
     void getOnlineEdgeNodes(QVector<QString>& a_macAddresses) const;
+    // Marks Edge Nodes offline, logs "Device disconnected" for every Device connected to them and removes their
+    // connections, all in one transaction. Takes pairs of MAC address and disconnect timestamp.
+    // Returns the number of Device connections removed
+    int edgeWentOffline(const QString& a_macAddress, const QString& a_timestamp);
+    int edgesWentOffline(const QVector<QPair<QString, QString>>& a_macAddressTimestamps);
 
     //Device
     struct Device
@@ -36,6 +107,17 @@ public:
     void registerDevice(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
     bool getDevice(Device& a_device, const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
     void getAllDevices(std::vector<std::unique_ptr<Device>>& a_devices) const;
+    void forEachDevice(const RowCallback<Device>& a_callback) const;
+    qint64 getDevicePage(std::vector<Device>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
+    // Statuses are served from the device cache, only a cache miss queries the database
+    enum class DeviceStatus
+    {
+        NotRegistered,
+        Unknown,
+        Whitelisted,
+        Blacklisted
+    };
+    DeviceStatus getDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
     void setDeviceBlacklisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
     bool isDeviceBlackListed(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
     void setDeviceWhitelisted(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
@@ -53,6 +135,12 @@ public:
     void unregisterConnectedDevicesOnEdgeNode(const QString& a_edgeNodeMacAddress);
     void unregisterConnectedDevice(const QString& a_edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber);
     void getAllConnectedDevices(std::vector<std::unique_ptr<ConnectedDevice>>& a_connectedDevices);
+    void forEachConnectedDevice(const RowCallback<ConnectedDevice>& a_callback) const;
+    qint64 getConnectedDevicePage(std::vector<ConnectedDevice>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
+    // Served from an in-memory index of the live connections, without querying the database
+    void getDevicesConnectedToEdgeNode(std::vector<Device>& a_devices, const QString& a_edgeNodeMacAddress) const;
+    void getEdgeNodesOfConnectedDevice(QVector<QString>& a_macAddresses, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber) const;
+    bool isDeviceConnected(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber) const;
 
 
     // ProductVendor
@@ -64,8 +152,11 @@ public:
         QString vendorName = "";
     };
     void registerProductVendor(const QString& a_productId, const QString& a_productName, const QString& a_vendorId, const QString& a_vendorName);
+    int registerProductVendors(const std::vector<ProductVendor>& a_productVendors, int* a_invalidRows = nullptr);
     bool getProductVendor(ProductVendor& a_productVendor, const QString& a_productId, const QString a_vendorId);
     void getAllProductVendors(std::vector<std::unique_ptr<ProductVendor>>& a_productVendors);
+    void forEachProductVendor(const RowCallback<ProductVendor>& a_callback) const;
+    qint64 getProductVendorPage(std::vector<ProductVendor>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
 
     // Virus
     struct VirusHash
@@ -74,10 +165,14 @@ public:
         QString description = "";
     };
     void registerVirusHash(const QString& a_virusHash, const QString& a_description);
+    int registerVirusHashes(const std::vector<VirusHash>& a_virusHashes);
     bool getVirusHash(VirusHash& a_vHash, const QString& a_virusHash) const;
     void getAllVirusHashKeys(QVector<QString>& a_virusHashes) const;
-    void getAllVirusHashes(std::vector<std::unique_ptr<VirusHash>>& a_virusHashes) const ;
+    void getAllVirusHashes(std::vector<std::unique_ptr<VirusHash>>& a_virusHashes) const;
+    void forEachVirusHash(const RowCallback<VirusHash>& a_callback) const;
+    qint64 getVirusHashPage(std::vector<VirusHash>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
     bool isHashInVirusDatabase(const QString& a_hash) const;
+    int checkVirusHashes(const QVector<QString>& a_hashes, QBitArray& a_matches, std::vector<std::unique_ptr<VirusHash>>& a_matchingHashes) const;
 
     // Event logging
     struct LogEvent
@@ -92,9 +187,109 @@ public:
     void logEvent(const QString& a_edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp, const QString& a_eventDescription);
     bool getLoggedEvent(LogEvent& a_logEvent, const QString& a_edgeNodeMacAddress, const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QString& a_timestamp) const;
     void getAllLoggedEvents(std::vector<std::unique_ptr<LogEvent>>& a_loggedEvents) const;
+    void forEachLoggedEvent(const RowCallback<LogEvent>& a_callback) const;
+    qint64 getLoggedEventPage(std::vector<LogEvent>& a_page, qint64 a_resumeToken = FIRST_PAGE, int a_limit = 1000) const;
+    // The event log is partitioned by UTC day. Queries fan out over the partitions they cover,
+    // and retention drops whole partitions instead of deleting rows
+    QVector<QString> getLogPartitions() const;
+    int dropLogPartitionsBefore(const QDateTime& a_cutoff);
+    // Time window queries over [a_from, a_to), oldest first. Each is a range scan on a logtime index
+    void forEachLoggedEventBetween(const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const;
+    void forEachLoggedEventOnEdgeNode(const QString& a_edgeNodeMacAddress, const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const;
+    void forEachLoggedEventForDevice(const QString& a_deviceProductId, const QString& a_deviceVendorId, const QString& a_deviceSerialNumber, const QDateTime& a_from, const QDateTime& a_to, const RowCallback<LogEvent>& a_callback) const;
 
 private:
-    void getKeysFromTable(const QString a_keyName, const QString& a_tableName, QVector<QString>& a_result) const;
-    void setDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, const QString& a_status) const;
-    bool checkDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, const QString& a_status) const;
+    friend class TestHandler; // Checks and cleans up the tables directly
+
+    QSqlDatabase database() const;
+    QSqlQuery& preparedQuery(const QString& a_operation, const char* a_sql, const QString& a_replacedOperations = QString()) const;
+    void migrateSchema();
+    bool detectCompactIds() const;
+    QVariant macAddressValue(const QString& a_macAddress) const;
+    QVariant usbIdValue(const QString& a_usbId) const;
+    qint64 getTotalChanges() const;
+    void loadVirusHashIndex();
+    QVector<QString> getLogPartitions(qint64 a_fromDay, qint64 a_toDay) const;
+    QString logPartitionForWrite(qint64 a_logtime) const;
+    void forgetLogPartition(qint64 a_logtime) const;
+    void streamLoggedEvents(const QString& a_operation, const QString& a_condition, const QVariantList& a_values, qint64 a_from, qint64 a_to, const RowCallback<LogEvent>& a_callback) const;
+
+    struct DeviceKey
+    {
+        QString productId;
+        QString vendorId;
+        QString serialNumber;
+
+        bool operator==(const DeviceKey& a_other) const
+        {
+            return productId == a_other.productId && vendorId == a_other.vendorId && serialNumber == a_other.serialNumber;
+        }
+        friend size_t qHash(const DeviceKey& a_key, size_t a_seed = 0)
+        {
+            return qHashMulti(a_seed, a_key.productId, a_key.vendorId, a_key.serialNumber);
+        }
+    };
+    struct CachedDevice
+    {
+        qint64 id = -1;
+        DeviceStatus status = DeviceStatus::Unknown;
+    };
+    bool findDevice(CachedDevice& a_device, const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, bool a_queryOnMiss = true) const;
+    qint64 getDeviceId(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, bool a_queryOnMiss = true) const;
+    void cacheDevice(const DeviceKey& a_key, const CachedDevice& a_device, quint64 a_generation) const;
+    void loadDeviceIdCache();
+    DeviceKey canonicalDeviceKey(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber) const;
+    QString connectedEdgeNodeKey(const QString& a_macAddress) const;
+    void loadConnectedDeviceIndex();
+    void forgetConnectedDevicesOnEdgeNode(const QString& a_edgeNodeKey);
+    using KeyFormatter = QString (*)(const QVariant&);
+    void getKeysFromTable(const QString a_keyName, const QString& a_tableName, QVector<QString>& a_result, KeyFormatter a_format = nullptr) const;
+    void setDeviceStatus(const QString& a_productId, const QString& a_vendorId, const QString& a_serialNumber, DeviceStatus a_status) const;
+    void applyOnCommit(std::function<void()> a_change) const;
+    void forgetConnection(const QString& a_connectionName) const;
+
+    std::unique_ptr<DatabaseConnectionPool> m_ConnectionPool;
+
+    // Long-lived prepared statements keyed by connection name and operation. Statements on log partitions are
+    // kept for the partition last written only, so the cache does not grow with the number of partitions
+    struct PreparedQuery
+    {
+        std::shared_ptr<QSqlQuery> query;
+        quint64 generation = 0;
+    };
+    mutable QMutex m_PreparedQueriesMutex;
+    mutable QHash<QPair<QString, QString>, PreparedQuery> m_PreparedQueries;
+    mutable quint64 m_PreparedQueriesGeneration = 0;
+    mutable PreparedQueryStatistics m_PreparedQueryStatistics;
+
+    // Bounded map from Device triple to device.id and status, so writes can bind the id directly and policy
+    // checks need no query. Only committed rows are cached, and the generation changes with every committed
+    // status write, so a reader never caches a status it read before the write
+    mutable QMutex m_DevicesMutex;
+    mutable QCache<DeviceKey, CachedDevice> m_Devices;
+    mutable quint64 m_DevicesGeneration = 0;
+
+    // Live Device connections in both directions, mirroring the committed rows of the connecteddevice table.
+    // Keys are in the text form the database reads back, so lookups match in both layouts
+    mutable QMutex m_ConnectedDevicesMutex;
+    QHash<QString, QSet<DeviceKey>> m_DevicesByEdgeNode;
+    QHash<DeviceKey, QSet<QString>> m_EdgeNodesByDevice;
+
+    // Cache changes made by the open transaction of each connection. Every nesting level records the number of
+    // changes queued when it started, so rolling it back drops only its own
+    struct PendingTransaction
+    {
+        std::vector<std::function<void()>> cacheChanges;
+        std::vector<std::size_t> savepoints;
+    };
+    mutable QMutex m_TransactionsMutex;
+    mutable QHash<QString, PendingTransaction> m_Transactions;
+
+    std::unique_ptr<VirusHashIndex> m_VirusHashIndex;
+    bool m_CompactIds = false;
+
+    // Days of the log partitions this process has created or written to. Cleared by every rollback, as the
+    // rolled back writes may have created a partition
+    mutable QMutex m_LogPartitionsMutex;
+    mutable QSet<qint64> m_LogPartitionDays;
 };
@@ -0,0 +1,31 @@
+# Sources shared by the databasehandler application and the benchmarks
+
+SOURCES += \
+    $$PWD/asyncdatabasehandler.cpp \
+    $$PWD/compactids.cpp \
+    $$PWD/databaseconnectionpool.cpp \
+    $$PWD/databasedatafileparser.cpp \
+    $$PWD/databasehandler.cpp \
+    $$PWD/databasemanager.cpp \
+    $$PWD/databasemqttclient.cpp \
+    $$PWD/databasewriter.cpp \
+    $$PWD/ingestmetrics.cpp \
+    $$PWD/mqttmessagedecoder.cpp \
+    $$PWD/operationmetrics.cpp \
+    $$PWD/timestamp.cpp \
+    $$PWD/virushashindex.cpp
+
+HEADERS += \
+    $$PWD/asyncdatabasehandler.h \
+    $$PWD/compactids.h \
+    $$PWD/databaseconnectionpool.h \
+    $$PWD/databasedatafileparser.h \
+    $$PWD/databasehandler.h \
+    $$PWD/databasemanager.h \
+    $$PWD/databasemqttclient.h \
+    $$PWD/databasewriter.h \
+    $$PWD/ingestmetrics.h \
+    $$PWD/mqttmessagedecoder.h \
+    $$PWD/operationmetrics.h \
+    $$PWD/timestamp.h \
+    $$PWD/virushashindex.h
@@ -2,8 +2,25 @@
 
 #include "databasehandler.h"
 #include "databasemqttclient.h"
+#include "databasewriter.h"
+#include "compactids.h"
+#include "mqttmessagedecoder.h"
+#include "timestamp.h"
+#include "operationmetrics.h"
 
-#include <QTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <chrono>
+#include <utility>
+
+namespace
+{
+    constexpr int DEFAULT_HEARTBEAT_FLUSH_INTERVAL_MS = 10000;
+    constexpr int DEFAULT_METRICS_SNAPSHOT_INTERVAL_S = 60;
+    constexpr int DEFAULT_INGEST_METRICS_INTERVAL_S = 10;
+    constexpr const char* DEFAULT_INGEST_METRICS_TOPIC = "metrics/databasehandler";
+}
 
 //!
 //! \brief The DatabaseManager constructor
@@ -12,44 +29,167 @@
 DatabaseManager::DatabaseManager(const QString &a_databaseName, QObject *a_parent)
     : QObject(a_parent)
     , m_DatabaseHandler(new DatabaseHandler(a_databaseName))
+    , m_DatabaseWriter(std::make_unique<DatabaseWriter>(m_DatabaseHandler, DatabaseWriter::Settings::fromEnvironment()))
     , m_MqttCient(new DatabaseMqttClient(a_parent))
 {
+    initialize();
+}
+
+//!
+//! \brief The DatabaseManager constructor
+//! Sets up the connections between an existing Mqtt client, database handler and writer
+//!
+DatabaseManager::DatabaseManager(std::shared_ptr<DatabaseHandler> a_databaseHandler,
+                                 std::unique_ptr<DatabaseWriter> a_databaseWriter,
+                                 std::shared_ptr<DatabaseMqttClient> a_mqttClient,
+                                 QObject *a_parent)
+    : QObject(a_parent)
+    , m_DatabaseHandler(std::move(a_databaseHandler))
+    , m_DatabaseWriter(std::move(a_databaseWriter))
+    , m_MqttCient(std::move(a_mqttClient))
+{
+    initialize();
+}
+
+//!
+//! \brief The initialize function
+//!  Connects the Mqtt client signals, loads the Edge Node states and starts the heartbeat flush timer
+//!
+void DatabaseManager::initialize()
+{
+    m_IngestMetrics = std::make_shared<IngestMetrics>();
+    m_MqttCient->setIngestMetrics(m_IngestMetrics);
+
     connect( m_MqttCient.get(), &DatabaseMqttClient::edgeChanged, this, &DatabaseManager::edgeChanged );
     connect( m_MqttCient.get(), &DatabaseMqttClient::edgeRemoved, this, &DatabaseManager::edgeRemoved );
     connect( m_MqttCient.get(), &DatabaseMqttClient::deviceChanged, this, &DatabaseManager::deviceChanged );
     connect( m_MqttCient.get(), &DatabaseMqttClient::deviceRemoved, this, &DatabaseManager::deviceRemoved );
+
+    loadEdgeStates();
+
+    int flushInterval = DEFAULT_HEARTBEAT_FLUSH_INTERVAL_MS;
+    const char* flushIntervalSetting = getenv("HOSTSECURE_HEARTBEAT_FLUSH_MS");
+    if(flushIntervalSetting != nullptr && QString(flushIntervalSetting).toInt() > 0)
+    {
+        flushInterval = QString(flushIntervalSetting).toInt();
+    }
+    connect( &m_HeartbeatFlushTimer, &QTimer::timeout, this, &DatabaseManager::flushEdgeHeartbeats );
+    m_HeartbeatFlushTimer.start(flushInterval);
+
+    // Offline Edge Nodes are collected until control returns to the event loop
+    m_OfflineEdgesFlushTimer.setSingleShot(true);
+    m_OfflineEdgesFlushTimer.setInterval(0);
+    connect( &m_OfflineEdgesFlushTimer, &QTimer::timeout, this, &DatabaseManager::flushOfflineEdges );
+
+    // The operation latencies are written to HOSTSECURE_METRICS_FILE when it is set
+    m_MetricsSnapshotPath = QString(getenv("HOSTSECURE_METRICS_FILE"));
+    if(!m_MetricsSnapshotPath.isEmpty())
+    {
+        int snapshotInterval = DEFAULT_METRICS_SNAPSHOT_INTERVAL_S;
+        const char* snapshotIntervalSetting = getenv("HOSTSECURE_METRICS_INTERVAL_S");
+        if(snapshotIntervalSetting != nullptr && QString(snapshotIntervalSetting).toInt() > 0)
+        {
+            snapshotInterval = QString(snapshotIntervalSetting).toInt();
+        }
+        connect( &m_MetricsSnapshotTimer, &QTimer::timeout, this, &DatabaseManager::writeMetricsSnapshot );
+        m_MetricsSnapshotTimer.start(snapshotInterval * 1000);
+    }
+
+    m_IngestMetricsTopic = QString(getenv("HOSTSECURE_INGEST_METRICS_TOPIC"));
+    if(m_IngestMetricsTopic.isEmpty())
+    {
+        m_IngestMetricsTopic = DEFAULT_INGEST_METRICS_TOPIC;
+    }
+    int ingestMetricsInterval = DEFAULT_INGEST_METRICS_INTERVAL_S;
+    const char* ingestMetricsIntervalSetting = getenv("HOSTSECURE_INGEST_METRICS_INTERVAL_S");
+    if(ingestMetricsIntervalSetting != nullptr && QString(ingestMetricsIntervalSetting).toInt() > 0)
+    {
+        ingestMetricsInterval = QString(ingestMetricsIntervalSetting).toInt();
+    }
+    connect( &m_IngestMetricsTimer, &QTimer::timeout, this, &DatabaseManager::publishIngestMetrics );
+    m_IngestMetricsTimer.start(ingestMetricsInterval * 1000);
+}
+
+//!
+//! \brief The DatabaseManager destructor
+//! Commits all pending writes before the database is closed
+//!
+DatabaseManager::~DatabaseManager()
+{
+    m_HeartbeatFlushTimer.stop();
+    m_OfflineEdgesFlushTimer.stop();
+    flushOfflineEdges();
+    flushEdgeHeartbeats();
+    m_DatabaseWriter->stop();
+
+    m_MetricsSnapshotTimer.stop();
+    writeMetricsSnapshot();
+    m_IngestMetricsTimer.stop();
 }
 
 //!
 //! \brief The edgeChanged function
 //!  Registers or updates an Edge Node when an Edge Node update is received from the Mqtt client
+//!  Only new Edge Nodes and online status changes are written immediately, plain heartbeats are coalesced
 //!
 void DatabaseManager::edgeChanged(const QString &a_edgeId, const MsgEdge &a_sample)
 {
-    try
+    QString edgeId = a_edgeId;
+    if(!normalizeEdgeId(edgeId))
     {
-        m_DatabaseHandler->registerOrUpdateEdgeNode(a_edgeId, a_sample.isOnline, QDateTime::currentDateTimeUtc().toString());
+        qCritical() << "Received edge changed with unrecognizable edgeid: " << a_edgeId;
+        m_IngestMetrics->countInvalidId();
+        return;
     }
-    catch (std::exception& e)
+
+    const QString timestamp = Timestamp::nowText();
+
+    auto edgeState = m_EdgeStates.find(edgeId);
+    if(edgeState != m_EdgeStates.end() && edgeState->isOnline == a_sample.isOnline)
     {
-        // Ignore. Handled in database
+        edgeState->lastHeartbeat = timestamp;
+        m_DirtyHeartbeats.insert(edgeId);
+        return;
     }
+
+    EdgeState state;
+    state.isOnline = a_sample.isOnline;
+    state.lastHeartbeat = timestamp;
+    m_EdgeStates.insert(edgeId, state);
+    m_DirtyHeartbeats.remove(edgeId);
+
+    enqueueWrite(IngestMetrics::WriteOperation::RegisterEdgeNode,
+                 [edgeId, isOnline = a_sample.isOnline, timestamp](DatabaseHandler& a_handler)
+    {
+        a_handler.registerOrUpdateEdgeNode(edgeId, isOnline, timestamp);
+    });
 }
 
 //!
 //! \brief The edgeRemoved function
-//!  Removes an Edge Node when a remove Edge Node update is received from the Mqtt client
+//!  Marks an Edge Node offline when a remove Edge Node update is received from the Mqtt client.
+//!  Edge Nodes going offline together, as in a power outage, are written as one batch
 //!
 void DatabaseManager::edgeRemoved(const QString &a_edgeId)
 {
-    try
+    QString edgeId = a_edgeId;
+    if(!normalizeEdgeId(edgeId))
     {
-        m_DatabaseHandler->setEdgeNodeOnlineStatus(a_edgeId, false);
-        m_DatabaseHandler->unregisterConnectedDevicesOnEdgeNode(a_edgeId);
+        qCritical() << "Received edge removed with unrecognizable edgeid: " << a_edgeId;
+        m_IngestMetrics->countInvalidId();
+        return;
     }
-    catch (std::exception& e)
+
+    auto edgeState = m_EdgeStates.find(edgeId);
+    if(edgeState != m_EdgeStates.end())
     {
-        // Ignore. Handled in database
+        edgeState->isOnline = false;
+    }
+
+    m_OfflineEdges.append(qMakePair(edgeId, Timestamp::nowText()));
+    if(!m_OfflineEdgesFlushTimer.isActive())
+    {
+        m_OfflineEdgesFlushTimer.start();
     }
 }
 
@@ -59,23 +199,35 @@ void DatabaseManager::edgeRemoved(const QString &a_edgeId)
 //!
 void DatabaseManager::deviceChanged(const QString &a_edgeId, const QString &a_deviceId, const MsgDevice &a_sample)
 {
-    QStringList vendorProductIds = a_deviceId.split(":");
-    if(vendorProductIds.size() != 2)
+    QString edgeId = a_edgeId;
+    QString productId;
+    QString vendorId;
+    if(!normalizeEdgeId(edgeId) || !parseDeviceId(a_deviceId, productId, vendorId))
     {
-        qCritical() << "Received device changed with unrecognizable deviceid: " << a_deviceId;
+        qCritical() << "Received device changed with unrecognizable ids: " << a_edgeId << a_deviceId;
+        m_IngestMetrics->countInvalidId();
     }
     else
     {
-        try
+        // Edge Nodes report their own clock in any format, the database only takes valid timestamps
+        qint64 connectTime = 0;
+        if(!Timestamp::parse(a_sample.lastHeartBeat, connectTime))
         {
-            m_DatabaseHandler->registerDevice(vendorProductIds[1], vendorProductIds[0], a_sample.deviceSerial);
-            m_DatabaseHandler->registerConnectedDevice(a_edgeId, vendorProductIds[1], vendorProductIds[0], a_sample.deviceSerial, a_sample.lastHeartBeat);
-            m_DatabaseHandler->logEvent(a_edgeId, vendorProductIds[1], vendorProductIds[0], a_sample.deviceSerial, QDateTime::currentDateTimeUtc().toString(), "Device connected");
+            connectTime = Timestamp::now();
         }
-        catch (std::exception& e)
+
+        enqueueWrite(IngestMetrics::WriteOperation::ConnectDevice,
+                     [edgeId,
+                      productId,
+                      vendorId,
+                      serialNumber = a_sample.deviceSerial,
+                      connectTime = Timestamp::toText(connectTime),
+                      timestamp = Timestamp::nowText()](DatabaseHandler& a_handler)
         {
-            // Ignore. Handled in database
-        }
+            a_handler.registerDevice(productId, vendorId, serialNumber);
+            a_handler.registerConnectedDevice(edgeId, productId, vendorId, serialNumber, connectTime);
+            a_handler.logEvent(edgeId, productId, vendorId, serialNumber, timestamp, "Device connected");
+        });
     }
 }
 
@@ -85,21 +237,208 @@ void DatabaseManager::deviceChanged(const QString &a_edgeId, const QString &a_de
 //!
 void DatabaseManager::deviceRemoved(const QString &a_edgeId, const QString &a_deviceId, const QString& a_deviceSerial)
 {
-    QStringList vendorProductIds = a_deviceId.split(":");
-    if(vendorProductIds.size() != 2)
+    QString edgeId = a_edgeId;
+    QString productId;
+    QString vendorId;
+    if(!normalizeEdgeId(edgeId) || !parseDeviceId(a_deviceId, productId, vendorId))
     {
-        qCritical() << "Received device removed with unrecognizable deviceid: " << a_deviceId;
+        qCritical() << "Received device removed with unrecognizable ids: " << a_edgeId << a_deviceId;
+        m_IngestMetrics->countInvalidId();
     }
     else
+    {
+        enqueueWrite(IngestMetrics::WriteOperation::DisconnectDevice,
+                     [edgeId,
+                      productId,
+                      vendorId,
+                      serialNumber = a_deviceSerial,
+                      timestamp = Timestamp::nowText()](DatabaseHandler& a_handler)
+        {
+            a_handler.unregisterConnectedDevice(edgeId, productId, vendorId, serialNumber);
+            a_handler.logEvent(edgeId, productId, vendorId, serialNumber, timestamp, "Device disconnected");
+        });
+    }
+}
+
+//!
+//! \brief The normalizeEdgeId function
+//!  Converts an Edge Node id to the canonical MAC address form when the database uses the compact layout
+//!
+bool DatabaseManager::normalizeEdgeId(QString &a_edgeId) const
+{
+    if(!m_DatabaseHandler->usesCompactIds())
+    {
+        return true;
+    }
+
+    CompactIds::MacAddress macAddress;
+    if(!CompactIds::parseMacAddress(a_edgeId, macAddress))
+    {
+        return false;
+    }
+    a_edgeId = CompactIds::formatMacAddress(macAddress);
+    return true;
+}
+
+//!
+//! \brief The parseDeviceId function
+//!  Splits a "vendorid:productid" Device id, validating and normalizing the ids when the database uses the compact layout
+//!
+bool DatabaseManager::parseDeviceId(const QString &a_deviceId, QString &a_productId, QString &a_vendorId) const
+{
+    if(m_DatabaseHandler->usesCompactIds())
+    {
+        CompactIds::DeviceType deviceType;
+        if(!CompactIds::parseDeviceType(a_deviceId, deviceType))
+        {
+            return false;
+        }
+        a_productId = CompactIds::formatUsbId(deviceType.productId);
+        a_vendorId = CompactIds::formatUsbId(deviceType.vendorId);
+        return true;
+    }
+
+    QStringView vendorId;
+    QStringView productId;
+    if(!MqttMessageDecoder::splitDeviceId(a_deviceId, vendorId, productId))
+    {
+        return false;
+    }
+    a_productId = productId.toString();
+    a_vendorId = vendorId.toString();
+    return true;
+}
+
+//!
+//! \brief The loadEdgeStates function
+//!  Fills the Edge Node state table from the database so known Edge Nodes are not rewritten on their first heartbeat
+//!
+void DatabaseManager::loadEdgeStates()
+{
+    try
+    {
+        std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> edgeNodes;
+        m_DatabaseHandler->getAllEdgeNodes(edgeNodes);
+        m_EdgeStates.reserve(static_cast<qsizetype>(edgeNodes.size()));
+        for(const std::unique_ptr<DatabaseHandler::EdgeNode>& edgeNode : edgeNodes)
+        {
+            EdgeState state;
+            state.isOnline = edgeNode->isOnline;
+            state.lastHeartbeat = edgeNode->lastHeartbeat;
+            m_EdgeStates.insert(edgeNode->macAddress, state);
+        }
+    }
+    catch (std::exception& e)
+    {
+        // Ignore. Handled in database. Every Edge Node is written on its first heartbeat instead
+    }
+}
+
+//!
+//! \brief The flushEdgeHeartbeats function
+//!  Writes all heartbeats received since the last flush in one batch
+//!
+void DatabaseManager::flushEdgeHeartbeats()
+{
+    if(m_DirtyHeartbeats.isEmpty())
+    {
+        return;
+    }
+
+    // The whole row is written, so an Edge Node whose registering write was lost is registered again
+    std::vector<DatabaseHandler::EdgeNode> edgeNodes;
+    edgeNodes.reserve(static_cast<std::size_t>(m_DirtyHeartbeats.size()));
+    for(const QString& edgeId : std::as_const(m_DirtyHeartbeats))
+    {
+        const EdgeState state = m_EdgeStates.value(edgeId);
+        edgeNodes.push_back({ edgeId, state.isOnline, state.lastHeartbeat });
+    }
+    m_DirtyHeartbeats.clear();
+
+    enqueueWrite(IngestMetrics::WriteOperation::UpdateHeartbeats,
+                 [edgeNodes = std::move(edgeNodes)](DatabaseHandler& a_handler)
+    {
+        a_handler.registerOrUpdateEdgeNodes(edgeNodes);
+    });
+}
+
+//!
+//! \brief The flushOfflineEdges function
+//!  Hands all Edge Nodes that went offline since the last flush to the writer as one batch
+//!
+void DatabaseManager::flushOfflineEdges()
+{
+    if(m_OfflineEdges.isEmpty())
+    {
+        return;
+    }
+
+    enqueueWrite(IngestMetrics::WriteOperation::RemoveEdgeNode,
+                 [offlineEdges = std::exchange(m_OfflineEdges, {})](DatabaseHandler& a_handler)
+    {
+        a_handler.edgesWentOffline(offlineEdges);
+    });
+}
+
+//!
+//! \brief The writeMetricsSnapshot function
+//!  Writes the latency histograms of the database operations to the metrics file, if one is configured
+//!
+void DatabaseManager::writeMetricsSnapshot()
+{
+    if(!m_MetricsSnapshotPath.isEmpty())
+    {
+        OperationMetrics::writeSnapshot(m_MetricsSnapshotPath);
+    }
+}
+
+//!
+//! \brief The enqueueWrite function
+//!  Hands a write to the database writer. The lag from now until the write has run and its failures are counted
+//!  in the ingest metrics
+//!
+void DatabaseManager::enqueueWrite(IngestMetrics::WriteOperation a_operation, std::function<void(DatabaseHandler&)> a_write)
+{
+    // Writes keep the order of the messages, so pending offline Edge Nodes go first
+    if(a_operation != IngestMetrics::WriteOperation::RemoveEdgeNode)
+    {
+        flushOfflineEdges();
+    }
+
+    m_DatabaseWriter->enqueue([metrics = m_IngestMetrics,
+                               a_operation,
+                               write = std::move(a_write),
+                               received = std::chrono::steady_clock::now()](DatabaseHandler& a_handler)
     {
         try
         {
-            m_DatabaseHandler->unregisterConnectedDevice(a_edgeId, vendorProductIds[1], vendorProductIds[0], a_deviceSerial);
-            m_DatabaseHandler->logEvent(a_edgeId, vendorProductIds[1], vendorProductIds[0], a_deviceSerial, QDateTime::currentDateTimeUtc().toString(), "Device disconnected");
+            write(a_handler);
         }
         catch (std::exception& e)
         {
-            // Ignore. Handled in database
+            metrics->countWriteFailure(a_operation);
+            throw;
         }
-    }
+        const auto lag = std::chrono::steady_clock::now() - received;
+        metrics->recordLag(std::chrono::duration_cast<std::chrono::nanoseconds>(lag).count());
+    });
+}
+
+//!
+//! \brief The publishIngestMetrics function
+//!  Publishes the ingest counters and the writer queue state as one compact JSON message
+//!
+void DatabaseManager::publishIngestMetrics()
+{
+    QJsonObject snapshot = m_IngestMetrics->takeSnapshot();
+
+    const DatabaseWriter::Metrics writerMetrics = m_DatabaseWriter->getMetrics();
+    QJsonObject writer;
+    writer["queueDepth"] = static_cast<qint64>(writerMetrics.queueDepth);
+    writer["committed"] = static_cast<qint64>(writerMetrics.committed);
+    writer["failed"] = static_cast<qint64>(writerMetrics.failed);
+    writer["rollbacks"] = static_cast<qint64>(writerMetrics.rollbacks);
+    snapshot["writer"] = writer;
+
+    m_MqttCient->publishMetrics(m_IngestMetricsTopic, QJsonDocument(snapshot).toJson(QJsonDocument::Compact));
 }
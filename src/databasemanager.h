@@ -1,20 +1,37 @@
 #pragma once
 #include <QObject>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QVector>
+#include <QTimer>
+
+#include "ingestmetrics.h"
+
+#include <functional>
+#include <memory>
 
 class MsgEdge;
 class MsgDevice;
 class DatabaseHandler;
+class DatabaseWriter;
 class DatabaseMqttClient;
 //!
 //! \brief The DatabaseManager class
 //! The manager of the databasehandler component. It is responsible for the communication between the Mqtt client
-//! and the databasehandler API.
+//! and the databasehandler API. All writes are handed to a DatabaseWriter, which commits them in groups on its own thread.
+//! The ingest counters are published periodically on the HOSTSECURE_INGEST_METRICS_TOPIC topic.
 //!
 class DatabaseManager : public QObject
 {
     Q_OBJECT
 public:
     explicit DatabaseManager( const QString& a_databaseName, QObject* a_parent = nullptr );
+    DatabaseManager( std::shared_ptr<DatabaseHandler> a_databaseHandler,
+                     std::unique_ptr<DatabaseWriter> a_databaseWriter,
+                     std::shared_ptr<DatabaseMqttClient> a_mqttClient,
+                     QObject* a_parent = nullptr );
+    ~DatabaseManager() override;
 
 private slots:
     void edgeChanged( const QString& a_edgeId, const MsgEdge& a_sample );
@@ -24,6 +41,36 @@ private slots:
     void deviceRemoved( const QString& a_edgeId, const QString& a_deviceId, const QString& a_deviceSerial );
 
 private:
+    void initialize();
+    bool normalizeEdgeId( QString& a_edgeId ) const;
+    bool parseDeviceId( const QString& a_deviceId, QString& a_productId, QString& a_vendorId ) const;
+    void loadEdgeStates();
+    void flushEdgeHeartbeats();
+    void flushOfflineEdges();
+    void writeMetricsSnapshot();
+    void publishIngestMetrics();
+    void enqueueWrite( IngestMetrics::WriteOperation a_operation, std::function<void(DatabaseHandler&)> a_write );
+
+    // Last known state of every Edge Node. Heartbeats that do not change the online status are only
+    // recorded here and written to the database in periodic batches
+    struct EdgeState
+    {
+        bool isOnline = false;
+        QString lastHeartbeat = "";
+    };
+    QHash<QString, EdgeState> m_EdgeStates;
+    QSet<QString> m_DirtyHeartbeats;
+    QTimer m_HeartbeatFlushTimer;
+    // Edge Nodes that went offline since the last write, handed to the writer as one batch
+    QVector<QPair<QString, QString>> m_OfflineEdges;
+    QTimer m_OfflineEdgesFlushTimer;
+    QTimer m_MetricsSnapshotTimer;
+    QString m_MetricsSnapshotPath;
+    QTimer m_IngestMetricsTimer;
+    QString m_IngestMetricsTopic;
+    std::shared_ptr<IngestMetrics> m_IngestMetrics;
+
     std::shared_ptr<DatabaseHandler> m_DatabaseHandler;
+    std::unique_ptr<DatabaseWriter> m_DatabaseWriter;
     std::shared_ptr<DatabaseMqttClient> m_MqttCient;
 };
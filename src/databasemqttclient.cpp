@@ -1,14 +1,18 @@
 #include "databasemqttclient.h"
+#include "ingestmetrics.h"
+#include "mqttmessagedecoder.h"
 #include <QJsonDocument>
 
 //!
 //! \brief The DatabaseMqttClient constructor
-//!  Automatically connects to the Mqtt system
+//!  Automatically connects to the Mqtt system unless a_connectToBroker is false,
+//!  in which case messages are only fed in through processMessage
 //!
-DatabaseMqttClient::DatabaseMqttClient( QObject* a_parent )
+DatabaseMqttClient::DatabaseMqttClient( QObject* a_parent, bool a_connectToBroker )
    : MqttClientBase { a_parent }
 {
-   connectToHost();
+   if ( a_connectToBroker )
+      connectToHost();
 }
 
 //!
@@ -29,37 +33,90 @@ void DatabaseMqttClient::brokerConnected()
 
 //!
 //! \brief The incomingEdge function
-//!  Called when an Edge Node related message is received
+//!  Called when an Edge Node related message is received from the broker
+//!
+void DatabaseMqttClient::incomingEdge( const QMqttMessage& a_sample )
+{
+   processMessage( a_sample.topic(), a_sample.payload() );
+}
+
+//!
+//! \brief The processMessage function
 //!  Parses the message to see if its related to the Edge Node as a whole,
 //!  or to a specific Device connected to the Edge Node, and forwards the data accordingly
 //!
-void DatabaseMqttClient::incomingEdge( QMqttMessage a_sample )
+void DatabaseMqttClient::processMessage( const QMqttTopicName& a_topic, const QByteArray& a_payload )
 {
-   QJsonDocument document = QJsonDocument::fromJson( a_sample.payload() );
-   const auto levelCount = a_sample.topic().levelCount();
-   const auto levels = a_sample.topic().levels();
+   const QString topicName = a_topic.name();
+   MqttMessageDecoder::Topic topic;
+   MqttMessageDecoder::parseTopic( topicName, topic );
+   if ( topic.levelCount != 2 && topic.levelCount != 3 )
+   {
+      if ( m_IngestMetrics != nullptr )
+         m_IngestMetrics->countMessage( IngestMetrics::MessageKind::Unexpected );
+      return;
+   }
+
+   const auto kind = topic.levelCount == 2 ? IngestMetrics::MessageKind::Edge : IngestMetrics::MessageKind::Device;
+   if ( m_IngestMetrics != nullptr )
+      m_IngestMetrics->countMessage( kind );
+
+   // An empty payload clears the retained message and means removal, any other payload has to be JSON
+   QJsonParseError parseError;
+   MqttMessageDecoder::Decoding decoding;
+   MsgEdge edgeSample;
+   MsgDevice deviceSample;
+   if ( topic.levelCount == 2 )
+      decoding = MqttMessageDecoder::decodeEdge( a_payload, edgeSample, &parseError );
+   else
+      decoding = MqttMessageDecoder::decodeDevice( a_payload, deviceSample, &parseError );
 
-   if ( levelCount >= 2 )
+   if ( decoding == MqttMessageDecoder::Decoding::NotJson )
    {
-      const auto edgeName = levels.at( 1 );
+      if ( m_IngestMetrics != nullptr )
+         m_IngestMetrics->countJsonParseFailure();
+      qWarning() << "Ignoring message on" << topicName << "that is not JSON: " << parseError.errorString();
+      return;
+   }
 
-      if ( levelCount == 2 )
-      {
-         MsgEdge sample;
-         if ( sample.fromJson( document.object() ) )
-            emit edgeChanged( edgeName, sample );
-         else
-            emit edgeRemoved( edgeName );
-      }
-      else if ( levelCount == 3 )
-      {
-         const auto deviceId = levels.at( 2 );
+   if ( decoding == MqttMessageDecoder::Decoding::Rejected && !a_payload.isEmpty() && m_IngestMetrics != nullptr )
+      m_IngestMetrics->countRejectedMessage( kind );
 
-         MsgDevice sample;
-         if ( sample.fromJson( document.object() ) )
-            emit deviceChanged( edgeName, deviceId, sample );
-         else
-            emit deviceRemoved( edgeName, deviceId, sample.deviceSerial );
-      }
+   const QString edgeName = topic.edgeId.toString();
+   if ( topic.levelCount == 2 )
+   {
+      if ( decoding == MqttMessageDecoder::Decoding::Decoded )
+         emit edgeChanged( edgeName, edgeSample );
+      else
+         emit edgeRemoved( edgeName );
+   }
+   else
+   {
+      const QString deviceId = topic.deviceId.toString();
+      if ( decoding == MqttMessageDecoder::Decoding::Decoded )
+         emit deviceChanged( edgeName, deviceId, deviceSample );
+      else
+         emit deviceRemoved( edgeName, deviceId, deviceSample.deviceSerial );
    }
 }
+
+//!
+//! \brief The setIngestMetrics function
+//!  Sets the metrics the received messages are counted in
+//!
+void DatabaseMqttClient::setIngestMetrics( std::shared_ptr<IngestMetrics> a_ingestMetrics )
+{
+   m_IngestMetrics = std::move( a_ingestMetrics );
+}
+
+//!
+//! \brief The publishMetrics function
+//!  Publishes a metrics snapshot on a_topic. Returns false when the client is not connected to a broker
+//!
+bool DatabaseMqttClient::publishMetrics( const QString& a_topic, const QByteArray& a_payload )
+{
+   if ( state() != QMqttClient::Connected )
+      return false;
+
+   return publish( QMqttTopicName( a_topic ), a_payload ) != -1;
+}
@@ -1,8 +1,13 @@
 #pragma once
 #include <mqttclientbase.h>
+#include <QMqttTopicName>
 #include <msg/msgedge.h>
 #include <msg/msgdevice.h>
 
+#include <memory>
+
+class IngestMetrics;
+
 //!
 //! \brief The DatabaseMqttClient class
 //! Handles communication with external entities
@@ -12,7 +17,11 @@ class DatabaseMqttClient : public MqttClientBase
     Q_OBJECT
 
 public:
-   explicit DatabaseMqttClient( QObject* a_parent = nullptr );
+   explicit DatabaseMqttClient( QObject* a_parent = nullptr, bool a_connectToBroker = true );
+
+   void processMessage( const QMqttTopicName& a_topic, const QByteArray& a_payload );
+   void setIngestMetrics( std::shared_ptr<IngestMetrics> a_ingestMetrics );
+   bool publishMetrics( const QString& a_topic, const QByteArray& a_payload );
 
 signals:
    void edgeChanged( const QString& a_edgeId, const MsgEdge& a_sample );
@@ -25,5 +34,7 @@ private:
    Q_DISABLE_COPY_MOVE( DatabaseMqttClient )
 
    void brokerConnected() override;
-   void incomingEdge( QMqttMessage a_sample );
+   void incomingEdge( const QMqttMessage& a_sample );
+
+   std::shared_ptr<IngestMetrics> m_IngestMetrics;
 };
@@ -0,0 +1,341 @@
+#include "databasewriter.h"
+
+#include <QDebug>
+#include <QDeadlineTimer>
+#include <QMutexLocker>
+
+namespace
+{
+   //!
+   //! \brief The environmentValue function
+   //! Reads a positive integer setting from the environment, falling back to a_default
+   //!
+   int environmentValue(const char* a_name, int a_default)
+   {
+      const char* value = getenv(a_name);
+      if(value == nullptr)
+      {
+         return a_default;
+      }
+
+      bool ok = false;
+      const int result = QString(value).toInt(&ok);
+      if(!ok || result <= 0)
+      {
+         qWarning() << "Ignoring invalid value of" << a_name << ": " << value;
+         return a_default;
+      }
+      return result;
+   }
+}
+
+//!
+//! \brief The fromEnvironment static function
+//! Creates the writer settings, overriding the defaults with the HOSTSECURE_DB_* environment variables
+//!
+DatabaseWriter::Settings DatabaseWriter::Settings::fromEnvironment()
+{
+   Settings settings;
+   settings.maxBatchSize = environmentValue("HOSTSECURE_DB_BATCH_SIZE", settings.maxBatchSize);
+   settings.maxBatchDelayMs = environmentValue("HOSTSECURE_DB_BATCH_DELAY_MS", settings.maxBatchDelayMs);
+   settings.queueCapacity = environmentValue("HOSTSECURE_DB_QUEUE_CAPACITY", settings.queueCapacity);
+
+   const QString synchronousMode = QString(getenv("HOSTSECURE_DB_SYNCHRONOUS")).toUpper();
+   if(synchronousMode == "OFF")
+   {
+      settings.synchronousMode = DatabaseHandler::SynchronousMode::Off;
+   }
+   else if(synchronousMode == "FULL")
+   {
+      settings.synchronousMode = DatabaseHandler::SynchronousMode::Full;
+   }
+   else if(synchronousMode == "NORMAL")
+   {
+      settings.synchronousMode = DatabaseHandler::SynchronousMode::Normal;
+   }
+
+   return settings;
+}
+
+//!
+//! \brief The DatabaseWriter constructor
+//! Starts the writer thread
+//!
+DatabaseWriter::DatabaseWriter(std::shared_ptr<DatabaseHandler> a_databaseHandler, const Settings& a_settings)
+   : m_DatabaseHandler(std::move(a_databaseHandler))
+   , m_Settings(a_settings)
+{
+   start();
+}
+
+//!
+//! \brief The DatabaseWriter destructor
+//! Commits everything still queued and stops the writer thread
+//!
+DatabaseWriter::~DatabaseWriter()
+{
+   stop();
+}
+
+//!
+//! \brief The enqueue function
+//! Queues a write operation. Blocks while the queue is full
+//!
+void DatabaseWriter::enqueue(Operation a_operation)
+{
+   QMutexLocker locker(&m_Mutex);
+   if(m_Queue.size() >= static_cast<std::size_t>(m_Settings.queueCapacity))
+   {
+      ++m_Metrics.producerWaits;
+      while(m_Queue.size() >= static_cast<std::size_t>(m_Settings.queueCapacity) && !m_Stopping)
+      {
+         m_QueueNotFull.wait(&m_Mutex);
+      }
+   }
+
+   if(m_Stopping)
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Dropping database write, the writer has been stopped";
+      return;
+   }
+
+   m_Queue.push_back(std::move(a_operation));
+   ++m_Metrics.enqueued;
+   m_Metrics.maxQueueDepth = qMax(m_Metrics.maxQueueDepth, static_cast<qsizetype>(m_Queue.size()));
+
+   if(m_Queue.size() == 1 || m_Queue.size() >= static_cast<std::size_t>(m_Settings.maxBatchSize))
+   {
+      m_QueueNotEmpty.wakeOne();
+   }
+}
+
+//!
+//! \brief The flush function
+//! Blocks until every operation queued so far has been committed
+//!
+void DatabaseWriter::flush()
+{
+   QMutexLocker locker(&m_Mutex);
+   const quint64 target = m_Metrics.enqueued;
+   m_FlushTarget = qMax(m_FlushTarget, target);
+   m_QueueNotEmpty.wakeOne();
+
+   while(m_Processed < target && isRunning())
+   {
+      m_BatchProcessed.wait(&m_Mutex, QDeadlineTimer(100));
+   }
+}
+
+//!
+//! \brief The stop function
+//! Commits everything still queued and waits for the writer thread to finish
+//!
+void DatabaseWriter::stop()
+{
+   {
+      QMutexLocker locker(&m_Mutex);
+      m_Stopping = true;
+      m_QueueNotEmpty.wakeAll();
+      m_QueueNotFull.wakeAll();
+   }
+   wait();
+}
+
+//!
+//! \brief The getMetrics function
+//! Retrieves the queue depth and commit counters of the writer
+//!
+DatabaseWriter::Metrics DatabaseWriter::getMetrics() const
+{
+   QMutexLocker locker(&m_Mutex);
+   Metrics metrics = m_Metrics;
+   metrics.queueDepth = static_cast<qsizetype>(m_Queue.size());
+   return metrics;
+}
+
+//!
+//! \brief The setCommitObserver function
+//! Registers a function called on the writer thread after every batch with the number of operations processed so far
+//!
+void DatabaseWriter::setCommitObserver(CommitObserver a_observer)
+{
+   QMutexLocker locker(&m_Mutex);
+   m_CommitObserver = std::move(a_observer);
+}
+
+//!
+//! \brief The run function
+//! The writer thread loop collecting operations into batches and committing them
+//!
+void DatabaseWriter::run()
+{
+   try
+   {
+      m_DatabaseHandler->bindWriterThread();
+   }
+   catch(std::exception& e)
+   {
+      // Without the writer connection nothing can be committed, fail what is queued and refuse further writes
+      qCritical() << __PRETTY_FUNCTION__ << "Stopping the database writer: " << e.what();
+      m_DatabaseHandler->releaseThreadConnection();
+      QMutexLocker locker(&m_Mutex);
+      m_Stopping = true;
+      m_Metrics.failed += m_Queue.size();
+      m_Processed += m_Queue.size();
+      m_Queue.clear();
+      m_QueueNotFull.wakeAll();
+      m_BatchProcessed.wakeAll();
+      return;
+   }
+
+   try
+   {
+      m_DatabaseHandler->setSynchronousMode(m_Settings.synchronousMode);
+   }
+   catch(std::exception& e)
+   {
+      qCritical() << __PRETTY_FUNCTION__ << e.what();
+   }
+
+   std::vector<Operation> batch;
+   batch.reserve(static_cast<std::size_t>(m_Settings.maxBatchSize));
+
+   while(true)
+   {
+      {
+         QMutexLocker locker(&m_Mutex);
+         while(m_Queue.empty() && !m_Stopping)
+         {
+            m_QueueNotEmpty.wait(&m_Mutex);
+         }
+
+         if(m_Queue.empty())
+         {
+            break; // Stopping and nothing left to commit
+         }
+
+         // Give the batch time to fill up unless it is already full or someone waits for it
+         QDeadlineTimer deadline(m_Settings.maxBatchDelayMs);
+         while(m_Queue.size() < static_cast<std::size_t>(m_Settings.maxBatchSize)
+               && !m_Stopping
+               && m_FlushTarget <= m_Processed)
+         {
+            if(!m_QueueNotEmpty.wait(&m_Mutex, deadline))
+            {
+               break;
+            }
+         }
+
+         while(!m_Queue.empty() && batch.size() < static_cast<std::size_t>(m_Settings.maxBatchSize))
+         {
+            batch.push_back(std::move(m_Queue.front()));
+            m_Queue.pop_front();
+         }
+         m_QueueNotFull.wakeAll();
+      }
+
+      commitBatch(batch);
+
+      CommitObserver observer;
+      quint64 processed = 0;
+      {
+         QMutexLocker locker(&m_Mutex);
+         m_Processed += batch.size();
+         processed = m_Processed;
+         observer = m_CommitObserver;
+         m_BatchProcessed.wakeAll();
+      }
+      if(observer)
+      {
+         observer(processed);
+      }
+      batch.clear();
+   }
+
+   m_DatabaseHandler->releaseThreadConnection();
+}
+
+//!
+//! \brief The commitBatch function
+//! Helper function executing a batch of operations in one transaction.
+//! Every operation runs in a nested transaction, so a failing one only loses its own changes, all of them.
+//! A failing commit loses the whole batch
+//!
+void DatabaseWriter::commitBatch(std::vector<Operation>& a_batch)
+{
+   quint64 committed = 0;
+   quint64 failed = 0;
+   quint64 rollbacks = 0;
+
+   try
+   {
+      m_DatabaseHandler->beginTransaction();
+   }
+   catch(std::exception& e)
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Dropping" << a_batch.size() << "database writes: " << e.what();
+      QMutexLocker locker(&m_Mutex);
+      m_Metrics.failed += a_batch.size();
+      return;
+   }
+
+   for(Operation& operation : a_batch)
+   {
+      try
+      {
+         m_DatabaseHandler->beginTransaction();
+      }
+      catch(std::exception& e)
+      {
+         // Ignore. Handled in database
+         ++failed;
+         continue;
+      }
+
+      try
+      {
+         operation(*m_DatabaseHandler);
+         m_DatabaseHandler->commitTransaction();
+         ++committed;
+      }
+      catch(std::exception& e)
+      {
+         // Ignore. Handled in database
+         ++failed;
+         try
+         {
+            m_DatabaseHandler->rollbackTransaction();
+         }
+         catch(std::exception& rollbackError)
+         {
+            qCritical() << __PRETTY_FUNCTION__ << rollbackError.what();
+         }
+      }
+   }
+
+   try
+   {
+      m_DatabaseHandler->commitTransaction();
+   }
+   catch(std::exception& e)
+   {
+      qCritical() << __PRETTY_FUNCTION__ << "Lost" << committed << "database writes: " << e.what();
+      try
+      {
+         m_DatabaseHandler->rollbackTransaction();
+      }
+      catch(std::exception& rollbackError)
+      {
+         qCritical() << __PRETTY_FUNCTION__ << rollbackError.what();
+      }
+      failed += committed;
+      committed = 0;
+      ++rollbacks;
+   }
+
+   QMutexLocker locker(&m_Mutex);
+   m_Metrics.committed += committed;
+   m_Metrics.failed += failed;
+   m_Metrics.rollbacks += rollbacks;
+   ++m_Metrics.batches;
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "databasehandler.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+//!
+//! \brief The DatabaseWriter class
+//! Executes database writes on a dedicated thread bound to the writer connection of the handler.
+//! Operations are queued in a bounded queue and committed in groups: a batch is committed once it holds
+//! maxBatchSize operations or its first operation has waited maxBatchDelayMs, so many writes share one fsync.
+//! Producers block while the queue is full
+//!
+class DatabaseWriter : public QThread
+{
+public:
+    struct Settings
+    {
+        int maxBatchSize = 256;
+        int maxBatchDelayMs = 50;
+        int queueCapacity = 10000;
+        DatabaseHandler::SynchronousMode synchronousMode = DatabaseHandler::SynchronousMode::Normal;
+
+        static Settings fromEnvironment();
+    };
+
+    struct Metrics
+    {
+        qsizetype queueDepth = 0;
+        qsizetype maxQueueDepth = 0;
+        quint64 enqueued = 0;
+        quint64 committed = 0;
+        quint64 failed = 0;
+        quint64 batches = 0;
+        quint64 rollbacks = 0;
+        quint64 producerWaits = 0;
+    };
+
+    using Operation = std::function<void(DatabaseHandler&)>;
+    using CommitObserver = std::function<void(quint64 a_processed)>;
+
+    explicit DatabaseWriter(std::shared_ptr<DatabaseHandler> a_databaseHandler, const Settings& a_settings = Settings());
+    ~DatabaseWriter() override;
+
+    void enqueue(Operation a_operation);
+    void flush();
+    void stop();
+    Metrics getMetrics() const;
+    void setCommitObserver(CommitObserver a_observer);
+
+protected:
+    void run() override;
+
+private:
+    void commitBatch(std::vector<Operation>& a_batch);
+
+    std::shared_ptr<DatabaseHandler> m_DatabaseHandler;
+    const Settings m_Settings;
+
+    mutable QMutex m_Mutex;
+    QWaitCondition m_QueueNotEmpty;
+    QWaitCondition m_QueueNotFull;
+    QWaitCondition m_BatchProcessed;
+    std::deque<Operation> m_Queue;
+    quint64 m_Processed = 0;
+    quint64 m_FlushTarget = 0;
+    bool m_Stopping = false;
+    Metrics m_Metrics;
+    CommitObserver m_CommitObserver;
+};
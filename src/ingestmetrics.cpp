@@ -0,0 +1,108 @@
+#include "ingestmetrics.h"
+
+#include <QJsonObject>
+
+namespace
+{
+   constexpr const char* MESSAGE_KIND_NAMES[] = { "edge", "device", "unexpected" };
+   constexpr const char* WRITE_OPERATION_NAMES[] = { "registerEdgeNode", "removeEdgeNode", "connectDevice", "disconnectDevice", "updateHeartbeats" };
+}
+
+//!
+//! \brief The countMessage function
+//! Counts a received message. Edge Node messages have a topic depth of 2, Device messages of 3
+//!
+void IngestMetrics::countMessage(MessageKind a_kind)
+{
+   m_Messages[static_cast<int>(a_kind)].fetch_add(1, std::memory_order_relaxed);
+}
+
+//!
+//! \brief The countJsonParseFailure function
+//! Counts a payload that is not valid JSON
+//!
+void IngestMetrics::countJsonParseFailure()
+{
+   m_JsonParseFailures.fetch_add(1, std::memory_order_relaxed);
+}
+
+//!
+//! \brief The countRejectedMessage function
+//! Counts a JSON payload rejected by the fromJson function of its message class
+//!
+void IngestMetrics::countRejectedMessage(MessageKind a_kind)
+{
+   m_Rejected[static_cast<int>(a_kind)].fetch_add(1, std::memory_order_relaxed);
+}
+
+//!
+//! \brief The countInvalidId function
+//! Counts a message whose Edge Node or Device id cannot be parsed
+//!
+void IngestMetrics::countInvalidId()
+{
+   m_InvalidIds.fetch_add(1, std::memory_order_relaxed);
+}
+
+//!
+//! \brief The countWriteFailure function
+//! Counts a database write that failed
+//!
+void IngestMetrics::countWriteFailure(WriteOperation a_operation)
+{
+   m_WriteFailures[static_cast<int>(a_operation)].fetch_add(1, std::memory_order_relaxed);
+}
+
+//!
+//! \brief The recordLag function
+//! Records the time between receiving a message and writing it to the database
+//!
+void IngestMetrics::recordLag(qint64 a_nanoseconds)
+{
+   const quint64 lag = static_cast<quint64>(qMax<qint64>(a_nanoseconds, 0));
+   m_LagCount.fetch_add(1, std::memory_order_relaxed);
+   m_LagSumNanoseconds.fetch_add(lag, std::memory_order_relaxed);
+   quint64 max = m_LagMaxNanoseconds.load(std::memory_order_relaxed);
+   while(lag > max && !m_LagMaxNanoseconds.compare_exchange_weak(max, lag, std::memory_order_relaxed))
+   {
+   }
+}
+
+//!
+//! \brief The takeSnapshot function
+//! Retrieves the counters as a compact JSON object. Counters are totals since start, the lag covers the time
+//! since the previous snapshot
+//!
+QJsonObject IngestMetrics::takeSnapshot()
+{
+   QJsonObject messages;
+   QJsonObject rejected;
+   for(int i = 0; i < MESSAGE_KINDS; ++i)
+   {
+      messages[MESSAGE_KIND_NAMES[i]] = static_cast<qint64>(m_Messages[i].load(std::memory_order_relaxed));
+      rejected[MESSAGE_KIND_NAMES[i]] = static_cast<qint64>(m_Rejected[i].load(std::memory_order_relaxed));
+   }
+
+   QJsonObject writeFailures;
+   for(int i = 0; i < WRITE_OPERATIONS; ++i)
+   {
+      writeFailures[WRITE_OPERATION_NAMES[i]] = static_cast<qint64>(m_WriteFailures[i].load(std::memory_order_relaxed));
+   }
+
+   const quint64 lagCount = m_LagCount.exchange(0, std::memory_order_relaxed);
+   const quint64 lagSum = m_LagSumNanoseconds.exchange(0, std::memory_order_relaxed);
+   const quint64 lagMax = m_LagMaxNanoseconds.exchange(0, std::memory_order_relaxed);
+   QJsonObject lag;
+   lag["writes"] = static_cast<qint64>(lagCount);
+   lag["meanMs"] = lagCount > 0 ? lagSum / 1e6 / lagCount : 0.0;
+   lag["maxMs"] = lagMax / 1e6;
+
+   QJsonObject snapshot;
+   snapshot["messages"] = messages;
+   snapshot["jsonParseFailures"] = static_cast<qint64>(m_JsonParseFailures.load(std::memory_order_relaxed));
+   snapshot["rejected"] = rejected;
+   snapshot["invalidIds"] = static_cast<qint64>(m_InvalidIds.load(std::memory_order_relaxed));
+   snapshot["writeFailures"] = writeFailures;
+   snapshot["lag"] = lag;
+   return snapshot;
+}
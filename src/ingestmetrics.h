@@ -0,0 +1,59 @@
+#pragma once
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+
+class QJsonObject;
+//!
+//! \brief The IngestMetrics class
+//! Counts the messages flowing from the Mqtt client into the database: messages per topic depth, payloads that
+//! are not JSON, payloads rejected by the message classes, ids that cannot be parsed, failed writes per
+//! operation, and the lag between receiving a message and writing it.
+//! All counters are lock-free and may be updated from any thread
+//!
+class IngestMetrics
+{
+public:
+    enum class WriteOperation
+    {
+        RegisterEdgeNode,
+        RemoveEdgeNode,
+        ConnectDevice,
+        DisconnectDevice,
+        UpdateHeartbeats,
+        Count
+    };
+
+    enum class MessageKind
+    {
+        Edge,
+        Device,
+        Unexpected,
+        Count
+    };
+
+    void countMessage(MessageKind a_kind);
+    void countJsonParseFailure();
+    void countRejectedMessage(MessageKind a_kind);
+    void countInvalidId();
+    void countWriteFailure(WriteOperation a_operation);
+    void recordLag(qint64 a_nanoseconds);
+
+    QJsonObject takeSnapshot();
+
+private:
+    static constexpr int MESSAGE_KINDS = static_cast<int>(MessageKind::Count);
+    static constexpr int WRITE_OPERATIONS = static_cast<int>(WriteOperation::Count);
+
+    std::array<std::atomic<quint64>, MESSAGE_KINDS> m_Messages {};
+    std::array<std::atomic<quint64>, MESSAGE_KINDS> m_Rejected {};
+    std::array<std::atomic<quint64>, WRITE_OPERATIONS> m_WriteFailures {};
+    std::atomic<quint64> m_JsonParseFailures { 0 };
+    std::atomic<quint64> m_InvalidIds { 0 };
+
+    // The lag is reported per snapshot interval
+    std::atomic<quint64> m_LagCount { 0 };
+    std::atomic<quint64> m_LagSumNanoseconds { 0 };
+    std::atomic<quint64> m_LagMaxNanoseconds { 0 };
+};
@@ -3,77 +3,700 @@
 #include <QFile>
 #include <QDir>
 #include <QDateTime>
+#include <QLocale>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace
 {
-   QFile logFile;
+   constexpr std::size_t DEFAULT_QUEUE_CAPACITY = 8192;
+   constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+   constexpr auto LOG_FILE_PREFIX = "hostsecure_";
+   constexpr auto LOG_FILE_SUFFIX = ".txt";
+
+   //!
+   //! \brief The LogEntry struct
+   //! A formatted message, the file line is empty for messages that are only printed to the console
+   //!
+   struct LogEntry
+   {
+      QByteArray fileLine;
+      QByteArray consoleLine;
+   };
+
+   //!
+   //! \brief The LogQueue class
+   //! Bounded lock-free multi-producer multi-consumer ring buffer.
+   //! Every slot carries a sequence number telling producers and consumers whose turn it is, so a push or pop
+   //! only contends on one atomic counter and never waits for another thread
+   //!
+   class LogQueue
+   {
+   public:
+      explicit LogQueue(std::size_t a_capacity)
+         : m_Slots(a_capacity)
+         , m_Mask(a_capacity - 1)
+      {
+         for(std::size_t i = 0; i < a_capacity; ++i)
+         {
+            m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+         }
+      }
+
+      bool push(LogEntry&& a_entry)
+      {
+         std::size_t position = m_Tail.load(std::memory_order_relaxed);
+         Slot* slot = nullptr;
+         while(true)
+         {
+            slot = &m_Slots[position & m_Mask];
+            const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if(difference == 0)
+            {
+               if(m_Tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+               {
+                  break;
+               }
+            }
+            else if(difference < 0)
+            {
+               return false; // Full
+            }
+            else
+            {
+               position = m_Tail.load(std::memory_order_relaxed);
+            }
+         }
+         slot->entry = std::move(a_entry);
+         slot->sequence.store(position + 1, std::memory_order_release);
+         return true;
+      }
+
+      bool pop(LogEntry& a_entry)
+      {
+         std::size_t position = m_Head.load(std::memory_order_relaxed);
+         Slot* slot = nullptr;
+         while(true)
+         {
+            slot = &m_Slots[position & m_Mask];
+            const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+            if(difference == 0)
+            {
+               if(m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+               {
+                  break;
+               }
+            }
+            else if(difference < 0)
+            {
+               return false; // Empty
+            }
+            else
+            {
+               position = m_Head.load(std::memory_order_relaxed);
+            }
+         }
+         a_entry = std::move(slot->entry);
+         slot->sequence.store(position + m_Mask + 1, std::memory_order_release);
+         return true;
+      }
+
+   private:
+      struct Slot
+      {
+         std::atomic<std::size_t> sequence;
+         LogEntry entry;
+      };
+
+      std::vector<Slot> m_Slots;
+      const std::size_t m_Mask;
+      alignas(64) std::atomic<std::size_t> m_Tail { 0 };
+      alignas(64) std::atomic<std::size_t> m_Head { 0 };
+   };
+
+   //!
+   //! \brief The Settings struct
+   //! The limits of the logger, read from the HOSTSECURE_LOG_* environment variables
+   //!
+   struct Settings
+   {
+      std::size_t queueCapacity = DEFAULT_QUEUE_CAPACITY;
+      qint64 maxFileBytes = 10 * 1024 * 1024;
+      qint64 maxFileAgeSeconds = 24 * 60 * 60;
+      int maxFiles = 10;
+      int rateLimit = 10;
+      qint64 rateWindowMs = 10000;
+
+      static Settings fromEnvironment();
+   };
+
+   //!
+   //! \brief The environmentValue function
+   //! Reads a non-negative integer setting from the environment, falling back to a_default
+   //!
+   qint64 environmentValue(const char* a_name, qint64 a_default)
+   {
+      const char* value = getenv(a_name);
+      if(value == nullptr)
+      {
+         return a_default;
+      }
+
+      bool ok = false;
+      const qint64 result = QString(value).toLongLong(&ok);
+      return ok && result >= 0 ? result : a_default;
+   }
+
+   //!
+   //! \brief The fromEnvironment static function
+   //! Creates the logger settings. The queue capacity is rounded up to a power of two,
+   //! a rate limit of 0 disables the suppression of repeated messages
+   //!
+   Settings Settings::fromEnvironment()
+   {
+      Settings settings;
+      const qint64 requested = qMax<qint64>(environmentValue("HOSTSECURE_LOG_QUEUE_CAPACITY", DEFAULT_QUEUE_CAPACITY), 2);
+      settings.queueCapacity = 2;
+      while(settings.queueCapacity < static_cast<std::size_t>(requested))
+      {
+         settings.queueCapacity <<= 1;
+      }
+      settings.maxFileBytes = qMax<qint64>(environmentValue("HOSTSECURE_LOG_MAX_BYTES", settings.maxFileBytes), 1024);
+      settings.maxFileAgeSeconds = qMax<qint64>(environmentValue("HOSTSECURE_LOG_MAX_AGE_S", settings.maxFileAgeSeconds), 1);
+      settings.maxFiles = static_cast<int>(qMax<qint64>(environmentValue("HOSTSECURE_LOG_MAX_FILES", settings.maxFiles), 1));
+      settings.rateLimit = static_cast<int>(environmentValue("HOSTSECURE_LOG_RATE_LIMIT", settings.rateLimit));
+      settings.rateWindowMs = qMax<qint64>(environmentValue("HOSTSECURE_LOG_RATE_WINDOW_S", settings.rateWindowMs / 1000), 1) * 1000;
+      return settings;
+   }
+
+   qint64 steadyMilliseconds()
+   {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   //!
+   //! \brief The CallSiteLimiter class
+   //! Limits every call site to rateLimit messages per window and counts the messages it suppresses.
+   //! Call sites are identified by file and line, or by the message text with its numbers and hex ids collapsed
+   //! when Qt provides no context. The call sites live in a fixed lock-free table that sweep clears of idle ones.
+   //! While the table is full, new call sites share one overflow site and its limit
+   //!
+   class CallSiteLimiter
+   {
+   public:
+      CallSiteLimiter(int a_limit, qint64 a_windowMs)
+         : m_Limit(a_limit)
+         , m_WindowMs(a_windowMs)
+      {
+      }
+
+      //!
+      //! \brief The admit function
+      //! Returns false when the message has to be suppressed. When the message opens a new window of its call site,
+      //! a_summary receives the report of the messages suppressed in the previous window
+      //!
+      bool admit(const QMessageLogContext& a_context, const QString& a_message, QByteArray& a_summary)
+      {
+         if(m_Limit <= 0)
+         {
+            return true;
+         }
+
+         CallSite* site = find(callSiteKey(a_context, a_message));
+         if(site == nullptr)
+         {
+            site = &m_Overflow;
+         }
+
+         const qint64 now = steadyMilliseconds();
+         qint64 windowStart = site->windowStart.load();
+         if(now - windowStart >= m_WindowMs && site->windowStart.compare_exchange_strong(windowStart, now))
+         {
+            a_summary = summary(*site, now - windowStart);
+            site->passed.store(0);
+            site->setText(a_message.toUtf8());
+         }
+
+         if(site->passed.fetch_add(1) < static_cast<quint32>(m_Limit))
+         {
+            return true;
+         }
+         site->suppressed.fetch_add(1);
+         return false;
+      }
+
+      //!
+      //! \brief The sweep function
+      //! Appends the reports of call sites that went quiet after messages were suppressed, and frees the slots of
+      //! call sites that logged nothing for a whole window. A message racing with the release of its slot at worst
+      //! starts a new window for its call site
+      //!
+      void sweep(QByteArray& a_lines)
+      {
+         if(m_Limit <= 0)
+         {
+            return;
+         }
+
+         const qint64 now = steadyMilliseconds();
+         for(CallSite& site : m_Sites)
+         {
+            quint64 key = site.key.load(std::memory_order_relaxed);
+            if(key == 0)
+            {
+               continue;
+            }
+            // A message arriving a window after windowStart would have opened a new window
+            if(site.suppressed.load(std::memory_order_relaxed) == 0)
+            {
+               if(now - site.windowStart.load() >= 2 * m_WindowMs)
+               {
+                  site.key.compare_exchange_strong(key, 0);
+               }
+               continue;
+            }
+            reportQuietSite(site, now, a_lines);
+         }
+         if(m_Overflow.suppressed.load(std::memory_order_relaxed) != 0)
+         {
+            reportQuietSite(m_Overflow, now, a_lines);
+         }
+      }
+
+   private:
+      static constexpr std::size_t TABLE_SIZE = 1024;
+      static constexpr std::size_t MAX_PROBES = 16;
+
+      struct CallSite
+      {
+         std::atomic<quint64> key { 0 };
+         std::atomic<qint64> windowStart { 0 };
+         std::atomic<quint32> passed { 0 };
+         std::atomic<quint64> suppressed { 0 };
+         std::atomic_flag textLock = ATOMIC_FLAG_INIT;
+         QByteArray text;
+
+         void setText(QByteArray a_text)
+         {
+            while(textLock.test_and_set(std::memory_order_acquire)) {}
+            text.swap(a_text);
+            textLock.clear(std::memory_order_release);
+         }
+
+         QByteArray getText()
+         {
+            while(textLock.test_and_set(std::memory_order_acquire)) {}
+            QByteArray result = text;
+            textLock.clear(std::memory_order_release);
+            return result;
+         }
+      };
+
+      static quint64 mix(quint64 a_value)
+      {
+         a_value ^= a_value >> 33;
+         a_value *= 0xff51afd7ed558ccdULL;
+         a_value ^= a_value >> 33;
+         return a_value;
+      }
+
+      static bool isHexCharacter(char16_t a_character)
+      {
+         return (a_character >= u'0' && a_character <= u'9') || (a_character >= u'a' && a_character <= u'f') || (a_character >= u'A' && a_character <= u'F');
+      }
+
+      //!
+      //! \brief The messageKey function
+      //! Hashes a message with every run of hex characters holding a digit, such as counts, ids and addresses,
+      //! replaced by a single '#', so messages of one format string share a key
+      //!
+      static quint64 messageKey(QStringView a_message)
+      {
+         quint64 hash = 14695981039346656037ULL;
+         const auto add = [&hash](char16_t a_character)
+         {
+            hash = (hash ^ a_character) * 1099511628211ULL;
+         };
+
+         qsizetype position = 0;
+         while(position < a_message.size())
+         {
+            qsizetype runEnd = position;
+            bool hasDigit = false;
+            while(runEnd < a_message.size() && isHexCharacter(a_message[runEnd].unicode()))
+            {
+               hasDigit = hasDigit || a_message[runEnd].isDigit();
+               ++runEnd;
+            }
+
+            if(runEnd == position)
+            {
+               add(a_message[position++].unicode());
+            }
+            else if(hasDigit)
+            {
+               add(u'#');
+               position = runEnd;
+            }
+            else
+            {
+               for(; position < runEnd; ++position)
+               {
+                  add(a_message[position].unicode());
+               }
+            }
+         }
+         return hash;
+      }
+
+      static quint64 callSiteKey(const QMessageLogContext& a_context, const QString& a_message)
+      {
+         const quint64 key = a_context.file != nullptr && a_context.line > 0
+                             ? mix(reinterpret_cast<quintptr>(a_context.file) * 31 + static_cast<quint64>(a_context.line))
+                             : mix(messageKey(a_message));
+         return key != 0 ? key : 1;
+      }
+
+      CallSite* find(quint64 a_key)
+      {
+         for(std::size_t probe = 0; probe < MAX_PROBES; ++probe)
+         {
+            CallSite& site = m_Sites[(a_key + probe) & (TABLE_SIZE - 1)];
+            quint64 key = site.key.load();
+            if(key == a_key)
+            {
+               return &site;
+            }
+            if(key == 0 && (site.key.compare_exchange_strong(key, a_key) || key == a_key))
+            {
+               return &site;
+            }
+         }
+         return nullptr;
+      }
+
+      void reportQuietSite(CallSite& a_site, qint64 a_now, QByteArray& a_lines)
+      {
+         qint64 windowStart = a_site.windowStart.load();
+         if(a_now - windowStart >= m_WindowMs && a_site.windowStart.compare_exchange_strong(windowStart, a_now))
+         {
+            a_site.passed.store(0);
+            a_lines.append(summary(a_site, a_now - windowStart));
+         }
+      }
+
+      QByteArray summary(CallSite& a_site, qint64 a_windowMs)
+      {
+         const quint64 suppressed = a_site.suppressed.exchange(0);
+         if(suppressed == 0)
+         {
+            return QByteArray();
+         }
+         const QByteArray count = QLocale(QLocale::English).toString(suppressed).toUtf8();
+         const QByteArray window = QByteArray::number((a_windowMs + 500) / 1000);
+         if(&a_site == &m_Overflow)
+         {
+            return "Suppressed " + count + " messages of call sites beyond the limiter table in last " + window + "s, such as: "
+                   + a_site.getText() + '\n';
+         }
+         return "Message repeated " + count + " times in last " + window + "s: " + a_site.getText() + '\n';
+      }
+
+      const int m_Limit;
+      const qint64 m_WindowMs;
+      CallSite m_Sites[TABLE_SIZE];
+      CallSite m_Overflow;
+   };
+
+   //!
+   //! \brief The LogWriter class
+   //! Owns the log files and the flusher thread that drains the queue into them in batches.
+   //! The current file stays open until it exceeds the maximum size or age, then a new file is started
+   //! and the oldest files are removed so at most maxFiles remain
+   //!
+   class LogWriter
+   {
+   public:
+      LogWriter(const QString& a_directory, const Settings& a_settings)
+         : m_Directory(a_directory)
+         , m_Settings(a_settings)
+         , m_Queue(a_settings.queueCapacity)
+         , m_Limiter(a_settings.rateLimit, a_settings.rateWindowMs)
+      {
+         if(openFile())
+         {
+            m_Flusher = std::thread([this]() { run(); });
+         }
+      }
+
+      ~LogWriter()
+      {
+         m_Stopping.store(true);
+         m_WakeUp.notify_one();
+         if(m_Flusher.joinable())
+         {
+            m_Flusher.join();
+         }
+         drain();
+         m_File->close();
+      }
+
+      bool isOpen() const
+      {
+         return m_File->isOpen();
+      }
+
+      QString errorString() const
+      {
+         return m_File->errorString();
+      }
+
+      //!
+      //! \brief The admit function
+      //! Applies the rate limit of the call site, queueing the report of previously suppressed messages
+      //!
+      bool admit(const QMessageLogContext& a_context, const QString& a_message)
+      {
+         QByteArray summary;
+         const bool admitted = m_Limiter.admit(a_context, a_message, summary);
+         if(!summary.isEmpty())
+         {
+            post({ summary, "Warning: " + summary });
+         }
+         return admitted;
+      }
+
+      void post(LogEntry&& a_entry)
+      {
+         if(!m_Queue.push(std::move(a_entry)))
+         {
+            m_Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+         }
+         if(m_Sleeping.load(std::memory_order_relaxed))
+         {
+            m_WakeUp.notify_one();
+         }
+      }
+
+      //!
+      //! \brief The flushAndWrite function
+      //! Writes everything queued so far followed by a_entry on the calling thread, used before aborting
+      //!
+      void flushAndWrite(const LogEntry& a_entry)
+      {
+         std::lock_guard<std::mutex> lock(m_WriteMutex);
+         drainLocked();
+         write(a_entry.fileLine, a_entry.consoleLine);
+      }
+
+      quint64 dropped() const
+      {
+         return m_Dropped.load(std::memory_order_relaxed);
+      }
+
+   private:
+      void run()
+      {
+         while(!m_Stopping.load())
+         {
+            if(drain() == 0)
+            {
+               std::unique_lock<std::mutex> lock(m_SleepMutex);
+               m_Sleeping.store(true);
+               m_WakeUp.wait_for(lock, FLUSH_INTERVAL);
+               m_Sleeping.store(false);
+            }
+         }
+      }
+
+      std::size_t drain()
+      {
+         std::lock_guard<std::mutex> lock(m_WriteMutex);
+         return drainLocked();
+      }
+
+      std::size_t drainLocked()
+      {
+         QByteArray fileBatch;
+         QByteArray consoleBatch;
+         std::size_t count = 0;
+         LogEntry entry;
+         while(m_Queue.pop(entry))
+         {
+            fileBatch.append(entry.fileLine);
+            consoleBatch.append(entry.consoleLine);
+            ++count;
+         }
+
+         QByteArray summaries;
+         m_Limiter.sweep(summaries);
+         const quint64 dropped = m_Dropped.load(std::memory_order_relaxed);
+         if(dropped != m_ReportedDropped)
+         {
+            summaries.append("Dropped " + QByteArray::number(dropped - m_ReportedDropped) + " log messages, the log queue was full\n");
+            m_ReportedDropped = dropped;
+         }
+         if(!summaries.isEmpty())
+         {
+            fileBatch.append(summaries);
+            consoleBatch.append("Warning: " + summaries);
+         }
+
+         write(fileBatch, consoleBatch);
+         return count;
+      }
+
+      void write(const QByteArray& a_fileLines, const QByteArray& a_consoleLines)
+      {
+         if(!a_fileLines.isEmpty())
+         {
+            const bool tooLarge = m_FileBytes + a_fileLines.size() > m_Settings.maxFileBytes;
+            const bool tooOld = steadyMilliseconds() - m_FileOpened >= m_Settings.maxFileAgeSeconds * 1000;
+            if(m_FileBytes > 0 && (tooLarge || tooOld))
+            {
+               m_File->close();
+               if(!openFile())
+               {
+                  fprintf(stderr, "Failed to open log file: %s\n", m_File->errorString().toUtf8().constData());
+               }
+            }
+
+            if(m_File->isOpen())
+            {
+               m_File->write(a_fileLines);
+               m_File->flush();
+               m_FileBytes += a_fileLines.size();
+            }
+         }
+         if(!a_consoleLines.isEmpty())
+         {
+            fwrite(a_consoleLines.constData(), 1, static_cast<std::size_t>(a_consoleLines.size()), stderr);
+         }
+      }
+
+      //!
+      //! \brief The openFile function
+      //! Starts a new log file named by the current time and removes the oldest files beyond maxFiles
+      //!
+      bool openFile()
+      {
+         const QString logFileName = LOG_FILE_PREFIX + QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss_zzz") + LOG_FILE_SUFFIX;
+         m_File = std::make_unique<QFile>(QDir(m_Directory).filePath(logFileName));
+         if(!m_File->open(QIODevice::WriteOnly | QIODevice::Append))
+         {
+            return false;
+         }
+         m_FileBytes = m_File->size();
+         m_FileOpened = steadyMilliseconds();
+
+         // The names sort by creation time, so the oldest files come first
+         QDir directory(m_Directory);
+         QStringList logFiles = directory.entryList({ QString(LOG_FILE_PREFIX) + "*" + LOG_FILE_SUFFIX }, QDir::Files, QDir::Name);
+         while(logFiles.size() > m_Settings.maxFiles)
+         {
+            directory.remove(logFiles.takeFirst());
+         }
+         return true;
+      }
+
+      const QString m_Directory;
+      const Settings m_Settings;
+      std::unique_ptr<QFile> m_File;
+      qint64 m_FileBytes = 0; // Guarded by m_WriteMutex
+      qint64 m_FileOpened = 0; // Guarded by m_WriteMutex
+      LogQueue m_Queue;
+      CallSiteLimiter m_Limiter;
+      std::atomic<quint64> m_Dropped { 0 };
+      quint64 m_ReportedDropped = 0; // Guarded by m_WriteMutex
+      std::mutex m_WriteMutex;
+      std::mutex m_SleepMutex;
+      std::condition_variable m_WakeUp;
+      std::atomic<bool> m_Sleeping { false };
+      std::atomic<bool> m_Stopping { false };
+      std::thread m_Flusher;
+   };
+
+   std::unique_ptr<LogWriter> logWriter;
+   std::atomic<quint64> droppedBeforeShutdown { 0 };
+
+   //!
+   //! \brief The formatConsoleLine function
+   //! Formats a message for the console, a_message is the message already converted to UTF-8
+   //!
+   QByteArray formatConsoleLine(const char* a_prefix, const QByteArray& a_message, const QMessageLogContext& a_context)
+   {
+      QByteArray line;
+      line.reserve(a_message.size() + 128);
+      line.append(a_prefix).append(": ").append(a_message).append(" \t\t(")
+          .append(a_context.file != nullptr ? a_context.file : "").append(':').append(QByteArray::number(a_context.line))
+          .append(", ").append(a_context.function != nullptr ? a_context.function : "").append(")\n");
+      return line;
+   }
 }
 
 //!
 //! \brief The loghandler function
 //!  Automcatically called by Qt when a qInfo, qDebug,  qWarning, qCritical, or qFatal is called
 //!  Logs qWarning, qCritical, and qFatal three to file,
+//!  The message is converted to UTF-8 once and queued for the flusher thread. qFatal writes synchronously before aborting
 //!  The code is strongly inspired by the qInstallMessageHandler example code
 //!
 void loghandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
+   // Repeated messages are suppressed before any formatting, so an error flood costs little more than a counter
+   if(type != QtFatalMsg && logWriter != nullptr && !logWriter->admit(context, msg))
+   {
+      return;
+   }
+
+   const QByteArray message = msg.toUtf8();
+   LogEntry entry;
+
    switch (type) {
    case QtDebugMsg:
-      fprintf(stderr, "Debug: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
+      entry.consoleLine = formatConsoleLine("Debug", message, context);
       break;
    case QtInfoMsg:
-      fprintf(stderr, "Info: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
+      entry.consoleLine = formatConsoleLine("Info", message, context);
       break;
    case QtWarningMsg:
-   {
-      if(logFile.open(QIODevice::WriteOnly| QIODevice::Append))
-      {
-         logFile.write(msg.toStdString().c_str());
-         logFile.write("\n");
-         logFile.close();
-      }
-      else
-      {
-         fprintf(stderr, "Failed to open log file: %s\n", logFile.errorString().toStdString().c_str());
-      }
-
-      fprintf(stderr, "Warning: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
+      entry.fileLine = message + '\n';
+      entry.consoleLine = formatConsoleLine("Warning", message, context);
       break;
-   }
    case QtCriticalMsg:
-   {
-      if(logFile.open(QIODevice::WriteOnly| QIODevice::Append))
-      {
-         logFile.write(msg.toStdString().c_str());
-         logFile.write("\n");
-         logFile.close();
-      }
-      else
-      {
-         fprintf(stderr, "Failed to open log file: %s\n", logFile.errorString().toStdString().c_str());
-      }
-      fprintf(stderr, "Critical: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
+      entry.fileLine = message + '\n';
+      entry.consoleLine = formatConsoleLine("Critical", message, context);
       break;
-   }
    case QtFatalMsg:
-   {
-      if(logFile.open(QIODevice::WriteOnly| QIODevice::Append))
+      entry.fileLine = message + '\n';
+      entry.consoleLine = formatConsoleLine("Fatal", message, context);
+      if(logWriter != nullptr)
       {
-         logFile.write(msg.toStdString().c_str());
-         logFile.write("\n");
-         logFile.close();
+         logWriter->flushAndWrite(entry);
       }
       else
       {
-         fprintf(stderr, "Failed to open log file: %s\n", logFile.errorString().toStdString().c_str());
+         fwrite(entry.consoleLine.constData(), 1, static_cast<std::size_t>(entry.consoleLine.size()), stderr);
       }
-      fprintf(stderr, "Fatal: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
       abort();
-   }
    default:
-      fprintf(stderr, "Undefined message type: %s \t\t(%s:%u, %s)\n", msg.toStdString().c_str(), context.file, context.line, context.function);
+      entry.consoleLine = formatConsoleLine("Undefined message type", message, context);
       break;
    }
+
+   if(logWriter != nullptr)
+   {
+      logWriter->post(std::move(entry));
+   }
 }
 
 //!
@@ -82,8 +705,6 @@ void loghandler(QtMsgType type, const QMessageLogContext &context, const QString
 //!
 LogHandler::LogHandler()
 {
-   QString logFileName = QDateTime::currentDateTime().toString() + ".txt";
-
    const char* dataDir = getenv("HOSTSECURE_DATA_DIR");
    if(dataDir == nullptr)
    {
@@ -103,25 +724,37 @@ LogHandler::LogHandler()
       }
    }
 
-   logFile.setFileName(logFilePath + logFileName);
-
-   if(logFile.open(QIODevice::ReadWrite))
+   auto writer = std::make_unique<LogWriter>(dir.absolutePath(), Settings::fromEnvironment());
+   if(writer->isOpen())
    {
-      logFile.close();
+      logWriter = std::move(writer);
       qInstallMessageHandler(loghandler);
    }
    else
    {
-      qCritical() << "Failed to create or open log file: " << logFile.errorString();
+      qCritical() << "Failed to create or open log file: " << writer->errorString();
    }
 }
 
 //!
 //! \brief The LogHandler desctructor
-//! Handles cleanup of the logger
+//! Handles cleanup of the logger, writing every queued message before the log file is closed
 //!
 LogHandler::~LogHandler()
 {
    qInstallMessageHandler(0);
-   logFile.close();
+   if(logWriter != nullptr)
+   {
+      droppedBeforeShutdown.store(logWriter->dropped());
+      logWriter.reset();
+   }
+}
+
+//!
+//! \brief The getDroppedMessages static function
+//! Retrieves the number of messages dropped because the log queue was full
+//!
+quint64 LogHandler::getDroppedMessages()
+{
+   return logWriter != nullptr ? logWriter->dropped() : droppedBeforeShutdown.load();
 }
@@ -1,16 +1,22 @@
 #pragma once
-class QFile;
+#include <QtGlobal>
 
 //!
 //! \brief The LogHandler class
 //! A very simple logger to log qWarning, qCritical, and qFatal messages to file
-//! The name of each log file is based on the current time to make every log file unique
+//! The name of each log file is based on the current time to make every log file unique.
+//! Messages are handed to a background thread through a bounded lock-free queue, so logging never blocks the caller.
+//! When the queue is full new messages are dropped and counted. A qFatal message flushes everything before aborting.
+//! Files are rotated by size and age and only the newest ones are kept. Every call site may log a limited number of
+//! messages per window, the rest is summarized as "Message repeated N times in last Ns"
 //!
 class LogHandler
 {
 public:
     friend int main(int argc, char *argv[]);
 
+    static quint64 getDroppedMessages();
+
 private:
     LogHandler();
     ~LogHandler();
@@ -0,0 +1,427 @@
+#include "mqttmessagedecoder.h"
+
+#include <msg/msgedge.h>
+#include <msg/msgdevice.h>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <array>
+#include <initializer_list>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+   constexpr int MAX_FIELDS = 32;
+
+   enum class ValueType
+   {
+      String,
+      Bool,
+      Number,
+      Null
+   };
+
+   struct Field
+   {
+      std::string_view key;
+      std::string_view value;
+      ValueType type = ValueType::Null;
+   };
+
+   //!
+   //! \brief The FlatObject struct
+   //! The members of a JSON object whose values are all scalars. Keys and string values point into the payload
+   //!
+   struct FlatObject
+   {
+      std::array<Field, MAX_FIELDS> fields;
+      int count = 0;
+
+      const Field* find(std::string_view a_key) const
+      {
+         for(int i = 0; i < count; ++i)
+         {
+            if(fields[i].key == a_key)
+            {
+               return &fields[i];
+            }
+         }
+         return nullptr;
+      }
+   };
+
+   //!
+   //! \brief The Scanner class
+   //! Reads a flat JSON object. Anything it does not handle, such as nested values, escaped strings, duplicate keys
+   //! or more than MAX_FIELDS members, makes it fail, so the caller can fall back to QJsonDocument
+   //!
+   class Scanner
+   {
+   public:
+      explicit Scanner(const QByteArray& a_payload)
+         : m_Position(a_payload.constData())
+         , m_End(a_payload.constData() + a_payload.size())
+      {
+      }
+
+      bool scanObject(FlatObject& a_object)
+      {
+         skipWhitespace();
+         if(!consume('{'))
+         {
+            return false;
+         }
+         skipWhitespace();
+         if(!consume('}'))
+         {
+            do
+            {
+               if(a_object.count == MAX_FIELDS)
+               {
+                  return false;
+               }
+               std::string_view key;
+               skipWhitespace();
+               if(!scanString(key))
+               {
+                  return false;
+               }
+               // QJsonDocument keeps the last of duplicate keys, find would return the first, so leave them to it
+               if(a_object.find(key) != nullptr)
+               {
+                  return false;
+               }
+               Field& field = a_object.fields[a_object.count++];
+               field.key = key;
+               skipWhitespace();
+               if(!consume(':'))
+               {
+                  return false;
+               }
+               skipWhitespace();
+               if(!scanValue(field))
+               {
+                  return false;
+               }
+               skipWhitespace();
+            }
+            while(consume(','));
+
+            if(!consume('}'))
+            {
+               return false;
+            }
+         }
+         skipWhitespace();
+         return m_Position == m_End;
+      }
+
+   private:
+      void skipWhitespace()
+      {
+         while(m_Position != m_End && (*m_Position == ' ' || *m_Position == '\t' || *m_Position == '\n' || *m_Position == '\r'))
+         {
+            ++m_Position;
+         }
+      }
+
+      bool consume(char a_character)
+      {
+         if(m_Position != m_End && *m_Position == a_character)
+         {
+            ++m_Position;
+            return true;
+         }
+         return false;
+      }
+
+      bool consumeDigits()
+      {
+         const char* start = m_Position;
+         while(m_Position != m_End && *m_Position >= '0' && *m_Position <= '9')
+         {
+            ++m_Position;
+         }
+         return m_Position != start;
+      }
+
+      bool consumeLiteral(std::string_view a_literal)
+      {
+         if(static_cast<std::size_t>(m_End - m_Position) < a_literal.size() ||
+            std::string_view(m_Position, a_literal.size()) != a_literal)
+         {
+            return false;
+         }
+         m_Position += a_literal.size();
+         return true;
+      }
+
+      bool scanString(std::string_view& a_text)
+      {
+         if(!consume('"'))
+         {
+            return false;
+         }
+         const char* start = m_Position;
+         while(m_Position != m_End && *m_Position != '"')
+         {
+            if(*m_Position == '\\' || static_cast<unsigned char>(*m_Position) < 0x20)
+            {
+               return false;
+            }
+            ++m_Position;
+         }
+         if(m_Position == m_End)
+         {
+            return false;
+         }
+         a_text = std::string_view(start, static_cast<std::size_t>(m_Position - start));
+         ++m_Position;
+         return true;
+      }
+
+      bool scanNumber(std::string_view& a_text)
+      {
+         const char* start = m_Position;
+         consume('-');
+         if(!consume('0') && !consumeDigits())
+         {
+            return false;
+         }
+         if(consume('.') && !consumeDigits())
+         {
+            return false;
+         }
+         if(consume('e') || consume('E'))
+         {
+            if(!consume('+'))
+            {
+               consume('-');
+            }
+            if(!consumeDigits())
+            {
+               return false;
+            }
+         }
+         a_text = std::string_view(start, static_cast<std::size_t>(m_Position - start));
+         return true;
+      }
+
+      bool scanValue(Field& a_field)
+      {
+         if(m_Position == m_End)
+         {
+            return false;
+         }
+         switch(*m_Position)
+         {
+         case '"':
+            a_field.type = ValueType::String;
+            return scanString(a_field.value);
+         case 't':
+            a_field.type = ValueType::Bool;
+            a_field.value = "true";
+            return consumeLiteral("true");
+         case 'f':
+            a_field.type = ValueType::Bool;
+            a_field.value = "false";
+            return consumeLiteral("false");
+         case 'n':
+            a_field.type = ValueType::Null;
+            return consumeLiteral("null");
+         default:
+            a_field.type = ValueType::Number;
+            return scanNumber(a_field.value);
+         }
+      }
+
+      const char* m_Position;
+      const char* const m_End;
+   };
+
+   //!
+   //! \brief The MessageFields struct
+   //! The members a message class writes in toJson, with the type of their default value. A payload only takes the
+   //! fast path when it holds every one of them with the same type, which is what fromJson accepts as well
+   //!
+   struct MessageFields
+   {
+      std::vector<std::pair<QByteArray, ValueType>> required;
+      bool hasFastPath = false;
+
+      MessageFields(const QJsonObject& a_defaults, std::initializer_list<const char*> a_decodedFields)
+      {
+         for(auto member = a_defaults.constBegin(); member != a_defaults.constEnd(); ++member)
+         {
+            switch(member.value().type())
+            {
+            case QJsonValue::String:
+               required.emplace_back(member.key().toUtf8(), ValueType::String);
+               break;
+            case QJsonValue::Bool:
+               required.emplace_back(member.key().toUtf8(), ValueType::Bool);
+               break;
+            case QJsonValue::Double:
+               required.emplace_back(member.key().toUtf8(), ValueType::Number);
+               break;
+            default:
+               // The scanner cannot check this member, every payload takes the QJsonDocument path
+               return;
+            }
+         }
+
+         hasFastPath = true;
+         for(const char* decodedField : a_decodedFields)
+         {
+            hasFastPath = hasFastPath && a_defaults.contains(QLatin1String(decodedField));
+         }
+      }
+
+      bool matches(const FlatObject& a_object) const
+      {
+         for(const auto& [key, type] : required)
+         {
+            const Field* field = a_object.find(std::string_view(key.constData(), static_cast<std::size_t>(key.size())));
+            if(field == nullptr || field->type != type)
+            {
+               return false;
+            }
+         }
+         return true;
+      }
+   };
+
+   const MessageFields& edgeFields()
+   {
+      static const MessageFields fields(MsgEdge().toJson(), { "isOnline" });
+      return fields;
+   }
+
+   const MessageFields& deviceFields()
+   {
+      static const MessageFields fields(MsgDevice().toJson(), { "deviceSerial", "lastHeartBeat" });
+      return fields;
+   }
+
+   QString toString(std::string_view a_text)
+   {
+      return QString::fromUtf8(a_text.data(), static_cast<qsizetype>(a_text.size()));
+   }
+
+   //!
+   //! \brief The decodeDocument function
+   //! Decodes a payload through QJsonDocument and the fromJson function of the message class
+   //!
+   template<typename Message>
+   MqttMessageDecoder::Decoding decodeDocument(const QByteArray& a_payload, Message& a_sample, QJsonParseError* a_parseError)
+   {
+      QJsonParseError parseError;
+      const QJsonDocument document = QJsonDocument::fromJson(a_payload, &parseError);
+      if(a_parseError != nullptr)
+      {
+         *a_parseError = parseError;
+      }
+      // An empty payload clears the retained message and is not a parse failure
+      if(!a_payload.isEmpty() && parseError.error != QJsonParseError::NoError)
+      {
+         return MqttMessageDecoder::Decoding::NotJson;
+      }
+      return a_sample.fromJson(document.object()) ? MqttMessageDecoder::Decoding::Decoded : MqttMessageDecoder::Decoding::Rejected;
+   }
+}
+
+//!
+//! \brief The parseTopic static function
+//! Counts the levels of a topic and retrieves the Edge Node and Device levels, the second and third one
+//!
+void MqttMessageDecoder::parseTopic(QStringView a_topic, Topic& a_levels)
+{
+   a_levels = Topic();
+   if(a_topic.isEmpty())
+   {
+      return;
+   }
+
+   qsizetype levelStart = 0;
+   while(true)
+   {
+      const qsizetype levelEnd = a_topic.indexOf(u'/', levelStart);
+      const QStringView level = a_topic.mid(levelStart, levelEnd < 0 ? -1 : levelEnd - levelStart);
+      ++a_levels.levelCount;
+      if(a_levels.levelCount == 2)
+      {
+         a_levels.edgeId = level;
+      }
+      else if(a_levels.levelCount == 3)
+      {
+         a_levels.deviceId = level;
+      }
+
+      if(levelEnd < 0)
+      {
+         return;
+      }
+      levelStart = levelEnd + 1;
+   }
+}
+
+//!
+//! \brief The splitDeviceId static function
+//! Splits a "vendorid:productid" Device id. Fails unless the id has exactly one separator
+//!
+bool MqttMessageDecoder::splitDeviceId(QStringView a_deviceId, QStringView& a_vendorId, QStringView& a_productId)
+{
+   const qsizetype separator = a_deviceId.indexOf(u':');
+   if(separator < 0 || a_deviceId.indexOf(u':', separator + 1) >= 0)
+   {
+      return false;
+   }
+   a_vendorId = a_deviceId.left(separator);
+   a_productId = a_deviceId.mid(separator + 1);
+   return true;
+}
+
+//!
+//! \brief The decodeEdge static function
+//! Decodes an Edge Node message. a_parseError is only set when the payload takes the QJsonDocument path
+//!
+MqttMessageDecoder::Decoding MqttMessageDecoder::decodeEdge(const QByteArray& a_payload, MsgEdge& a_sample, QJsonParseError* a_parseError)
+{
+   const MessageFields& fields = edgeFields();
+   FlatObject object;
+   if(fields.hasFastPath && Scanner(a_payload).scanObject(object) && fields.matches(object))
+   {
+      a_sample.isOnline = object.find("isOnline")->value == "true";
+      return Decoding::Decoded;
+   }
+   return decodeDocument(a_payload, a_sample, a_parseError);
+}
+
+//!
+//! \brief The decodeDevice static function
+//! Decodes a Device message. On the fast path the two decoded strings are the only allocations
+//!
+MqttMessageDecoder::Decoding MqttMessageDecoder::decodeDevice(const QByteArray& a_payload, MsgDevice& a_sample, QJsonParseError* a_parseError)
+{
+   const MessageFields& fields = deviceFields();
+   FlatObject object;
+   if(fields.hasFastPath && Scanner(a_payload).scanObject(object) && fields.matches(object))
+   {
+      a_sample.deviceSerial = toString(object.find("deviceSerial")->value);
+      a_sample.lastHeartBeat = toString(object.find("lastHeartBeat")->value);
+      return Decoding::Decoded;
+   }
+   return decodeDocument(a_payload, a_sample, a_parseError);
+}
+
+//!
+//! \brief The hasFastPath static function
+//! Checks that the message classes write the fields the scanner decodes, otherwise every payload takes the
+//! QJsonDocument path
+//!
+bool MqttMessageDecoder::hasFastPath()
+{
+   return edgeFields().hasFastPath && deviceFields().hasFastPath;
+}
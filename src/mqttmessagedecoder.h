@@ -0,0 +1,40 @@
+#pragma once
+#include <QByteArray>
+#include <QStringView>
+
+class MsgEdge;
+class MsgDevice;
+struct QJsonParseError;
+//!
+//! \brief The MqttMessageDecoder class
+//! Decodes the edges/# messages without building intermediate containers. Topic levels and device ids are
+//! returned as views into the topic, and flat JSON payloads are scanned in place for the MsgEdge and MsgDevice
+//! fields the database uses. Payloads the scanner does not handle, such as nested values or escaped strings,
+//! fall back to QJsonDocument and the fromJson function of the message class
+//!
+class MqttMessageDecoder
+{
+public:
+    // The levels of an "edges/<edgeid>[/<deviceid>]" topic
+    struct Topic
+    {
+        int levelCount = 0;
+        QStringView edgeId;
+        QStringView deviceId;
+    };
+
+    enum class Decoding
+    {
+        Decoded,
+        Rejected,
+        NotJson
+    };
+
+    static void parseTopic(QStringView a_topic, Topic& a_levels);
+    static bool splitDeviceId(QStringView a_deviceId, QStringView& a_vendorId, QStringView& a_productId);
+
+    static Decoding decodeEdge(const QByteArray& a_payload, MsgEdge& a_sample, QJsonParseError* a_parseError = nullptr);
+    static Decoding decodeDevice(const QByteArray& a_payload, MsgDevice& a_sample, QJsonParseError* a_parseError = nullptr);
+
+    static bool hasFastPath();
+};
@@ -0,0 +1,348 @@
+#include "operationmetrics.h"
+
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+
+namespace
+{
+   constexpr int LINEAR_BUCKETS = 16;
+   constexpr int SUB_BUCKET_BITS = 3;
+   constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+   constexpr int MAX_EXPONENT = 47; // About 39 hours in nanoseconds
+   constexpr int BUCKETS = LINEAR_BUCKETS + (MAX_EXPONENT - 3) * SUB_BUCKETS;
+
+   //!
+   //! \brief The bucketIndex function
+   //! Maps a latency to its bucket. Latencies below 16ns get a bucket each, larger ones are split into
+   //! 8 buckets per power of two
+   //!
+   int bucketIndex(quint64 a_nanoseconds)
+   {
+      if(a_nanoseconds < LINEAR_BUCKETS)
+      {
+         return static_cast<int>(a_nanoseconds);
+      }
+      const int exponent = qMin(63 - qCountLeadingZeroBits(a_nanoseconds), MAX_EXPONENT);
+      const int subBucket = static_cast<int>((a_nanoseconds >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+      return qMin(LINEAR_BUCKETS + (exponent - 4) * SUB_BUCKETS + subBucket, BUCKETS - 1);
+   }
+
+   //!
+   //! \brief The bucketMidpoint function
+   //! Retrieves the latency in the middle of a bucket
+   //!
+   double bucketMidpoint(int a_index)
+   {
+      if(a_index < LINEAR_BUCKETS)
+      {
+         return a_index;
+      }
+      const int exponent = (a_index - LINEAR_BUCKETS) / SUB_BUCKETS + 4;
+      const int subBucket = (a_index - LINEAR_BUCKETS) % SUB_BUCKETS;
+      const double width = static_cast<double>(quint64(1) << (exponent - SUB_BUCKET_BITS));
+      return (SUB_BUCKETS + subBucket) * width + width / 2;
+   }
+
+   //!
+   //! \brief The Histogram struct
+   //! The latencies of one operation recorded by one thread. Only the owning thread writes, so plain
+   //! loads and stores are enough, the atomics only keep concurrent readers from seeing torn values
+   //!
+   struct Histogram
+   {
+      std::array<std::atomic<quint64>, BUCKETS> buckets {};
+      std::atomic<quint64> count { 0 };
+      std::atomic<quint64> errors { 0 };
+      std::atomic<quint64> sumNanoseconds { 0 };
+      std::atomic<quint64> maxNanoseconds { 0 };
+
+      static void add(std::atomic<quint64>& a_value, quint64 a_amount)
+      {
+         a_value.store(a_value.load(std::memory_order_relaxed) + a_amount, std::memory_order_relaxed);
+      }
+
+      void record(quint64 a_nanoseconds, bool a_failed)
+      {
+         add(buckets[bucketIndex(a_nanoseconds)], 1);
+         add(count, 1);
+         add(sumNanoseconds, a_nanoseconds);
+         if(a_failed)
+         {
+            add(errors, 1);
+         }
+         if(a_nanoseconds > maxNanoseconds.load(std::memory_order_relaxed))
+         {
+            maxNanoseconds.store(a_nanoseconds, std::memory_order_relaxed);
+         }
+      }
+
+      void mergeInto(Histogram& a_target) const
+      {
+         for(int i = 0; i < BUCKETS; ++i)
+         {
+            add(a_target.buckets[i], buckets[i].load(std::memory_order_relaxed));
+         }
+         add(a_target.count, count.load(std::memory_order_relaxed));
+         add(a_target.errors, errors.load(std::memory_order_relaxed));
+         add(a_target.sumNanoseconds, sumNanoseconds.load(std::memory_order_relaxed));
+         a_target.maxNanoseconds.store(qMax(a_target.maxNanoseconds.load(std::memory_order_relaxed),
+                                            maxNanoseconds.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+      }
+   };
+
+   struct ThreadMetrics;
+
+   //!
+   //! \brief The Registry struct
+   //! The operation names, the metrics of the running threads and the merged metrics of finished threads
+   //!
+   struct Registry
+   {
+      QMutex mutex;
+      std::vector<QString> names;
+      std::vector<ThreadMetrics*> threads;
+      std::array<std::unique_ptr<Histogram>, OperationMetrics::MAX_OPERATIONS> finished;
+   };
+
+   Registry& registry()
+   {
+      static Registry instance;
+      return instance;
+   }
+
+   //!
+   //! \brief The ThreadMetrics struct
+   //! The histograms of one thread, allocated on the first use of each operation.
+   //! When the thread ends its histograms are merged into the registry
+   //!
+   struct ThreadMetrics
+   {
+      std::array<std::atomic<Histogram*>, OperationMetrics::MAX_OPERATIONS> histograms {};
+
+      ThreadMetrics()
+      {
+         QMutexLocker locker(&registry().mutex);
+         registry().threads.push_back(this);
+      }
+
+      ~ThreadMetrics()
+      {
+         Registry& metrics = registry();
+         QMutexLocker locker(&metrics.mutex);
+         metrics.threads.erase(std::find(metrics.threads.begin(), metrics.threads.end(), this));
+         for(int i = 0; i < OperationMetrics::MAX_OPERATIONS; ++i)
+         {
+            std::unique_ptr<Histogram> histogram(histograms[i].load());
+            if(histogram != nullptr)
+            {
+               if(metrics.finished[i] == nullptr)
+               {
+                  metrics.finished[i] = std::make_unique<Histogram>();
+               }
+               histogram->mergeInto(*metrics.finished[i]);
+            }
+         }
+      }
+
+      Histogram& histogram(int a_operation)
+      {
+         Histogram* histogram = histograms[a_operation].load(std::memory_order_acquire);
+         if(histogram == nullptr)
+         {
+            histogram = new Histogram();
+            histograms[a_operation].store(histogram, std::memory_order_release);
+         }
+         return *histogram;
+      }
+   };
+
+   ThreadMetrics& threadMetrics()
+   {
+      thread_local ThreadMetrics metrics;
+      return metrics;
+   }
+
+   //!
+   //! \brief The percentile function
+   //! Retrieves the a_fraction percentile of a histogram in microseconds
+   //!
+   double percentile(const Histogram& a_histogram, double a_fraction)
+   {
+      const quint64 count = a_histogram.count.load(std::memory_order_relaxed);
+      if(count == 0)
+      {
+         return 0.0;
+      }
+      const quint64 rank = qMax<quint64>(static_cast<quint64>(a_fraction * count + 0.5), 1);
+      quint64 seen = 0;
+      for(int i = 0; i < BUCKETS; ++i)
+      {
+         seen += a_histogram.buckets[i].load(std::memory_order_relaxed);
+         if(seen >= rank)
+         {
+            return qMin(bucketMidpoint(i), static_cast<double>(a_histogram.maxNanoseconds.load(std::memory_order_relaxed))) / 1000.0;
+         }
+      }
+      return a_histogram.maxNanoseconds.load(std::memory_order_relaxed) / 1000.0;
+   }
+}
+
+//!
+//! \brief The registerOperation static function
+//! Retrieves the id of the operation named a_name, registering it on first use.
+//! Returns -1 when MAX_OPERATIONS operations are registered already
+//!
+int OperationMetrics::registerOperation(const char* a_name)
+{
+   Registry& metrics = registry();
+   QMutexLocker locker(&metrics.mutex);
+   const QString name = QString::fromLatin1(a_name);
+   for(std::size_t i = 0; i < metrics.names.size(); ++i)
+   {
+      if(metrics.names[i] == name)
+      {
+         return static_cast<int>(i);
+      }
+   }
+
+   if(metrics.names.size() >= MAX_OPERATIONS)
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Not recording operation" << name << ", too many operations";
+      return -1;
+   }
+   metrics.names.push_back(name);
+   return static_cast<int>(metrics.names.size() - 1);
+}
+
+//!
+//! \brief The record static function
+//! Records one execution of an operation in the histogram of the calling thread
+//!
+void OperationMetrics::record(int a_operation, qint64 a_nanoseconds, bool a_failed)
+{
+   if(a_operation < 0 || a_operation >= MAX_OPERATIONS)
+   {
+      return;
+   }
+   threadMetrics().histogram(a_operation).record(static_cast<quint64>(qMax<qint64>(a_nanoseconds, 0)), a_failed);
+}
+
+//!
+//! \brief The getStatistics static function
+//! Merges the histograms of all threads and retrieves the statistics of every operation recorded so far
+//!
+std::vector<OperationMetrics::OperationStatistics> OperationMetrics::getStatistics()
+{
+   std::vector<OperationStatistics> result;
+   Registry& metrics = registry();
+   QMutexLocker locker(&metrics.mutex);
+
+   for(std::size_t operation = 0; operation < metrics.names.size(); ++operation)
+   {
+      Histogram merged;
+      if(metrics.finished[operation] != nullptr)
+      {
+         metrics.finished[operation]->mergeInto(merged);
+      }
+      for(ThreadMetrics* thread : metrics.threads)
+      {
+         const Histogram* histogram = thread->histograms[operation].load(std::memory_order_acquire);
+         if(histogram != nullptr)
+         {
+            histogram->mergeInto(merged);
+         }
+      }
+
+      const quint64 count = merged.count.load();
+      if(count == 0)
+      {
+         continue;
+      }
+
+      OperationStatistics statistics;
+      statistics.name = metrics.names[operation];
+      statistics.count = count;
+      statistics.errors = merged.errors.load();
+      statistics.meanUs = merged.sumNanoseconds.load() / 1000.0 / count;
+      statistics.p50Us = percentile(merged, 0.5);
+      statistics.p90Us = percentile(merged, 0.9);
+      statistics.p99Us = percentile(merged, 0.99);
+      statistics.p999Us = percentile(merged, 0.999);
+      statistics.maxUs = merged.maxNanoseconds.load() / 1000.0;
+      result.push_back(statistics);
+   }
+   return result;
+}
+
+//!
+//! \brief The toJson static function
+//! Retrieves the statistics of every operation as a JSON object keyed by operation name
+//!
+QJsonObject OperationMetrics::toJson()
+{
+   QJsonObject operations;
+   for(const OperationStatistics& statistics : getStatistics())
+   {
+      QJsonObject operation;
+      operation["count"] = static_cast<qint64>(statistics.count);
+      operation["errors"] = static_cast<qint64>(statistics.errors);
+      operation["meanUs"] = statistics.meanUs;
+      operation["p50Us"] = statistics.p50Us;
+      operation["p90Us"] = statistics.p90Us;
+      operation["p99Us"] = statistics.p99Us;
+      operation["p999Us"] = statistics.p999Us;
+      operation["maxUs"] = statistics.maxUs;
+      operations[statistics.name] = operation;
+   }
+
+   QJsonObject snapshot;
+   snapshot["operations"] = operations;
+   return snapshot;
+}
+
+//!
+//! \brief The writeSnapshot static function
+//! Writes the statistics of every operation to a_filePath. The file is replaced atomically,
+//! so readers never see a partial snapshot
+//!
+bool OperationMetrics::writeSnapshot(const QString& a_filePath)
+{
+   QSaveFile file(a_filePath);
+   if(!file.open(QIODevice::WriteOnly))
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Failed to open" << a_filePath << ": " << file.errorString();
+      return false;
+   }
+   file.write(QJsonDocument(toJson()).toJson(QJsonDocument::Indented));
+   if(!file.commit())
+   {
+      qWarning() << __PRETTY_FUNCTION__ << "Failed to write" << a_filePath << ": " << file.errorString();
+      return false;
+   }
+   return true;
+}
+
+//!
+//! \brief The measureOverhead static function
+//! Measures the cost of recording one operation in nanoseconds, using an operation reserved for the measurement
+//!
+double OperationMetrics::measureOverhead(int a_iterations)
+{
+   static const int operation = registerOperation("operationMetricsOverhead");
+   const auto start = std::chrono::steady_clock::now();
+   for(int i = 0; i < a_iterations; ++i)
+   {
+      const Scope scope(operation);
+   }
+   const auto elapsed = std::chrono::steady_clock::now() - start;
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / static_cast<double>(qMax(a_iterations, 1));
+}
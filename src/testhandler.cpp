@@ -1,12 +1,63 @@
 #include "testhandler.h"
 
 #include "databasehandler.h"
+#include "asyncdatabasehandler.h"
+#include "databaseconnectionpool.h"
+#include "virushashindex.h"
+#include "compactids.h"
+#include "timestamp.h"
+#include "operationmetrics.h"
+#include "ingestmetrics.h"
+#include "databasemqttclient.h"
+#include "mqttmessagedecoder.h"
 
+#include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QFile>
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QDateTime>
+#include <QTimeZone>
+#include <QThread>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QCryptographicHash>
 
 #include <stdlib.h>
+#include <algorithm>
+
+namespace
+{
+    constexpr qint64 SCALE_CHUNK_SIZE = 100000;
+    constexpr int SCALE_LOOKUPS = 100000;
+    constexpr qint64 SCALE_KEY_STRIDE = 7919; // Prime, so consecutive lookups hit keys spread over the table
+
+    QString scaleUsbId(qint64 a_value)
+    {
+        return QString("%1").arg(a_value & 0xffff, 4, 16, QChar('0'));
+    }
+
+    QString scaleVirusHash(qint64 a_index)
+    {
+        return QCryptographicHash::hash(QByteArray::number(a_index), QCryptographicHash::Md5).toHex();
+    }
+
+    //!
+    //! \brief The p99Microseconds function
+    //! Retrieves the 99th percentile of the latencies in microseconds
+    //!
+    double p99Microseconds(std::vector<qint64>& a_nanoseconds)
+    {
+        if(a_nanoseconds.empty())
+        {
+            return 0.0;
+        }
+        std::sort(a_nanoseconds.begin(), a_nanoseconds.end());
+        return a_nanoseconds[static_cast<std::size_t>(0.99 * (a_nanoseconds.size() - 1))] / 1000.0;
+    }
+}
 
 //!
 //! \brief The TestHandler constructor
@@ -16,6 +67,7 @@
 //!
 
 TestHandler::TestHandler(const QString &a_databasePath)
+    : m_DatabasePath(a_databasePath)
 {
     QFile file(a_databasePath);
     if(file.exists())
@@ -25,6 +77,24 @@ TestHandler::TestHandler(const QString &a_databasePath)
     m_DBHandler = new DatabaseHandler(a_databasePath);
 }
 
+//!
+//! \brief The TestHandler destructor
+//! Closes the database together with its connections
+//!
+TestHandler::~TestHandler()
+{
+    delete m_DBHandler;
+}
+
+//!
+//! \brief The setAllocationCounter function
+//! Sets the counter testCaseMessageDecoder uses to check the allocations per message. Without one it skips the check
+//!
+void TestHandler::setAllocationCounter(AllocationCounter a_allocationCounter)
+{
+    m_AllocationCounter = std::move(a_allocationCounter);
+}
+
 //!
 //! \brief The testCaseEdgeNode function
 //! Tests the various databasehandler APIs related to the edgenode table
@@ -34,7 +104,7 @@ void TestHandler::testCaseEdgeNode()
     try
     {
         // Clean up existing data
-        QSqlQuery query;
+        QSqlQuery query(m_DBHandler->database());
         query.exec("DELETE FROM edgenode");
 
         // Registration and update
@@ -42,41 +112,66 @@ void TestHandler::testCaseEdgeNode()
         m_DBHandler->registerOrUpdateEdgeNode("ABCD", true, "2021-08-27 09:19:00.000");
         m_DBHandler->registerOrUpdateEdgeNode("EFGH", false, "2011-04-15 17:33:04.372");
         m_DBHandler->registerOrUpdateEdgeNode("IJKL", true, "2016-04-16 07:36:03.987");
-        Q_ASSERT(m_DBHandler->getEdgeNode(node, "IJKL"));
-        Q_ASSERT(node.lastHeartbeat == "2016-04-16 07:36:03.987");
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "IJKL"));
+        TEST_VERIFY(node.lastHeartbeat == "2016-04-16 07:36:03.987");
         m_DBHandler->registerOrUpdateEdgeNode("IJKL", true, "2016-04-16 07:36:03.988");
-        Q_ASSERT(m_DBHandler->getEdgeNode(node, "IJKL"));
-        Q_ASSERT(node.lastHeartbeat == "2016-04-16 07:36:03.988");
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "IJKL"));
+        TEST_VERIFY(node.lastHeartbeat == "2016-04-16 07:36:03.988");
 
         // Retrieval of all keys
         QVector<QString> allKeys;
         m_DBHandler->getAllEdgeNodeKeys(allKeys);
-        Q_ASSERT(allKeys.size() == 3);
-        Q_ASSERT(checkString(allKeys[0], "ABCD", "EFGH", "IJKL"));
+        TEST_VERIFY(allKeys.size() == 3);
+        TEST_VERIFY(checkString(allKeys[0], "ABCD", "EFGH", "IJKL"));
 
         // Retrieval of all Edge Nodes
         std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> edges;
         m_DBHandler->getAllEdgeNodes(edges);
-        Q_ASSERT(edges.size() == 3);
-        Q_ASSERT(checkString((*(edges[2])).macAddress, "ABCD", "EFGH", "IJKL"));
+        TEST_VERIFY(edges.size() == 3);
+        TEST_VERIFY(checkString((*(edges[2])).macAddress, "ABCD", "EFGH", "IJKL"));
 
         // Retrieval of online Edge Nodes
         QVector<QString> allOnlineEdges;
         m_DBHandler->getOnlineEdgeNodes(allOnlineEdges);
-        Q_ASSERT(allOnlineEdges.size() == 2);
+        TEST_VERIFY(allOnlineEdges.size() == 2);
 
         // Updating Edgee Node online status
-        Q_ASSERT(m_DBHandler->getEdgeNode(node, "ABCD"));
-        Q_ASSERT(node.isOnline  == true);
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "ABCD"));
+        TEST_VERIFY(node.isOnline  == true);
         m_DBHandler->setEdgeNodeOnlineStatus("ABCD", false);
-        Q_ASSERT(m_DBHandler->getEdgeNode(node, "ABCD"));
-        Q_ASSERT(node.isOnline == false);
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "ABCD"));
+        TEST_VERIFY(node.isOnline == false);
 
         // Retesting online Edge Nodes based on the above test
         allOnlineEdges.clear();
         m_DBHandler->getOnlineEdgeNodes(allOnlineEdges);
-        Q_ASSERT(allOnlineEdges.size() == 1);
-        Q_ASSERT(allOnlineEdges[0] == "IJKL");
+        TEST_VERIFY(allOnlineEdges.size() == 1);
+        TEST_VERIFY(allOnlineEdges[0] == "IJKL");
+
+        // Batched writes register missing Edge Nodes and update existing ones
+        m_DBHandler->registerOrUpdateEdgeNodes({ { "ABCD", true, "2021-08-27 09:20:00.000" }, { "MNOP", true, "2021-08-27 09:20:00.000" } });
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "ABCD"));
+        TEST_VERIFY(node.isOnline && node.lastHeartbeat == "2021-08-27 09:20:00.000");
+        TEST_VERIFY(m_DBHandler->getEdgeNode(node, "MNOP"));
+        TEST_VERIFY(node.isOnline && node.lastHeartbeat == "2021-08-27 09:20:00.000");
+        query.exec("DELETE FROM edgenode WHERE macaddress = 'MNOP'");
+
+        // Updating an Edge Node during a paged scan must not make it show up again
+        std::vector<DatabaseHandler::EdgeNode> page;
+        qint64 resumeToken = m_DBHandler->getEdgeNodePage(page, DatabaseHandler::FIRST_PAGE, 1);
+        TEST_VERIFY(page.size() == 1);
+        m_DBHandler->registerOrUpdateEdgeNode(page[0].macAddress, page[0].isOnline, page[0].lastHeartbeat);
+        int paged = 1;
+        while(true)
+        {
+            resumeToken = m_DBHandler->getEdgeNodePage(page, resumeToken, 1);
+            if(page.empty())
+            {
+                break;
+            }
+            ++paged;
+        }
+        TEST_VERIFY(paged == 3);
 
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
@@ -95,32 +190,67 @@ void TestHandler::testVirus()
     try
     {
         // Clean up existing data
-        QSqlQuery query;
+        QSqlQuery query(m_DBHandler->database());
         query.exec("DELETE FROM virushash");
+        m_DBHandler->reloadCaches();
 
         // Registration of virus hashes
         DatabaseHandler::VirusHash virusHash;
         m_DBHandler->registerVirusHash("UVUUNNU", "Totally");
         m_DBHandler->registerVirusHash("YUCWZXB", "not a");
         m_DBHandler->registerVirusHash("OPMIMOIBTV", "virus");
-        Q_ASSERT(m_DBHandler->getVirusHash(virusHash, "UVUUNNU"));
-        Q_ASSERT(virusHash.description == "Totally");
+        TEST_VERIFY(m_DBHandler->getVirusHash(virusHash, "UVUUNNU"));
+        TEST_VERIFY(virusHash.description == "Totally");
 
         // Retrieval of all virush hashes
         QVector<QString> allKeys;
         m_DBHandler->getAllVirusHashKeys(allKeys);
-        Q_ASSERT(allKeys.size() == 3);
-        Q_ASSERT(checkString(allKeys[0], "UVUUNNU", "YUCWZXB", "OPMIMOIBTV"));
+        TEST_VERIFY(allKeys.size() == 3);
+        TEST_VERIFY(checkString(allKeys[0], "UVUUNNU", "YUCWZXB", "OPMIMOIBTV"));
 
         // Retrieval of all virus hashes including descriptions
         std::vector<std::unique_ptr<DatabaseHandler::VirusHash>> virusHashes;
         m_DBHandler->getAllVirusHashes(virusHashes);
-        Q_ASSERT(virusHashes.size() == 3);
-        Q_ASSERT(checkString((*(virusHashes[2])).description, "Totally", "not a", "virus"));
+        TEST_VERIFY(virusHashes.size() == 3);
+        TEST_VERIFY(checkString((*(virusHashes[2])).description, "Totally", "not a", "virus"));
 
         // Checking if virus hashes are found in database
-        Q_ASSERT(m_DBHandler->isHashInVirusDatabase("OPMIMOIBTV"));
-        Q_ASSERT(!(m_DBHandler->isHashInVirusDatabase("NO HASH HERE")));
+        TEST_VERIFY(m_DBHandler->isHashInVirusDatabase("OPMIMOIBTV"));
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("NO HASH HERE")));
+
+        // Checking a whole set of hashes at once
+        QVector<QString> scannedHashes{"NO HASH HERE", "YUCWZXB", "ALSO NOT", "OPMIMOIBTV", "YUCWZXB"};
+        QBitArray matches;
+        std::vector<std::unique_ptr<DatabaseHandler::VirusHash>> matchingHashes;
+        TEST_VERIFY(m_DBHandler->checkVirusHashes(scannedHashes, matches, matchingHashes) == 3);
+        TEST_VERIFY(matches.size() == scannedHashes.size());
+        TEST_VERIFY(!matches.testBit(0) && matches.testBit(1) && !matches.testBit(2) && matches.testBit(3) && matches.testBit(4));
+        TEST_VERIFY(matchingHashes.size() == 2);
+        TEST_VERIFY(checkString(matchingHashes[0]->description, "not a", "virus", "virus"));
+
+        // Hex digests are indexed in binary form and must not match other casings
+        m_DBHandler->registerVirusHash("0123456789abcdef0123456789abcdef", "hex");
+        TEST_VERIFY(m_DBHandler->isHashInVirusDatabase("0123456789abcdef0123456789abcdef"));
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("0123456789ABCDEF0123456789ABCDEF")));
+        query.exec("DELETE FROM virushash WHERE hashkey = '0123456789abcdef0123456789abcdef'");
+        m_DBHandler->reloadCaches();
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("0123456789abcdef0123456789abcdef")));
+
+        // The index only takes hashes of committed transactions, also when they were registered in a nested one
+        m_DBHandler->beginTransaction();
+        m_DBHandler->registerVirusHashes({ { "ROLLEDBACK", "virus" } });
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("ROLLEDBACK")));
+        m_DBHandler->beginTransaction();
+        m_DBHandler->registerVirusHash("COMMITTED", "virus");
+        m_DBHandler->commitTransaction();
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("COMMITTED")));
+        m_DBHandler->rollbackTransaction();
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("ROLLEDBACK")));
+        TEST_VERIFY(!(m_DBHandler->isHashInVirusDatabase("COMMITTED")));
+        m_DBHandler->beginTransaction();
+        m_DBHandler->registerVirusHash("COMMITTED", "virus");
+        m_DBHandler->commitTransaction();
+        TEST_VERIFY(m_DBHandler->isHashInVirusDatabase("COMMITTED"));
 
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
@@ -139,7 +269,7 @@ void TestHandler::testCaseProductVendor()
     try
     {
         // Clean up existing data
-        QSqlQuery query;
+        QSqlQuery query(m_DBHandler->database());
         query.exec("DELETE FROM productvendor");
 
         // Registration of productvendors
@@ -147,16 +277,45 @@ void TestHandler::testCaseProductVendor()
         m_DBHandler->registerProductVendor("QWER", "Make", "DCBA", "Sabaton");
         m_DBHandler->registerProductVendor("TYUI", "Pepsi Twist", "HGFE", "Babymetal");
         m_DBHandler->registerProductVendor("ASDF", "Again", "LKJI", "Nightwish");
-        Q_ASSERT(m_DBHandler->getProductVendor(productvendor, "TYUI", "HGFE"));
-        Q_ASSERT(productvendor.productName == "Pepsi Twist");
-        Q_ASSERT(productvendor.vendorName == "Babymetal");
+        TEST_VERIFY(m_DBHandler->getProductVendor(productvendor, "TYUI", "HGFE"));
+        TEST_VERIFY(productvendor.productName == "Pepsi Twist");
+        TEST_VERIFY(productvendor.vendorName == "Babymetal");
 
         // Retrieval of all productvendors
         std::vector<std::unique_ptr<DatabaseHandler::ProductVendor>> productvendors;
         m_DBHandler->getAllProductVendors(productvendors);
-        Q_ASSERT(productvendors.size() == 3);
-        Q_ASSERT(checkString((*(productvendors[2])).productName, "Make", "Pepsi Twist", "Again"));
-        Q_ASSERT(checkString((*(productvendors[2])).vendorName, "Sabaton", "Babymetal", "Nightwish"));
+        TEST_VERIFY(productvendors.size() == 3);
+        TEST_VERIFY(checkString((*(productvendors[2])).productName, "Make", "Pepsi Twist", "Again"));
+        TEST_VERIFY(checkString((*(productvendors[2])).vendorName, "Sabaton", "Babymetal", "Nightwish"));
+
+        // Streaming must stop as soon as the callback returns false
+        int streamed = 0;
+        m_DBHandler->forEachProductVendor([&streamed](const DatabaseHandler::ProductVendor&)
+        {
+            return ++streamed < 2;
+        });
+        TEST_VERIFY(streamed == 2);
+
+        // A callback running the same scan must not cut the outer one short
+        streamed = 0;
+        m_DBHandler->forEachProductVendor([this, &streamed](const DatabaseHandler::ProductVendor&)
+        {
+            std::vector<std::unique_ptr<DatabaseHandler::ProductVendor>> nested;
+            m_DBHandler->getAllProductVendors(nested);
+            ++streamed;
+            return nested.size() == 3;
+        });
+        TEST_VERIFY(streamed == 3);
+
+        // Paging must visit every row exactly once and end with an empty page
+        std::vector<DatabaseHandler::ProductVendor> page;
+        qint64 resumeToken = m_DBHandler->getProductVendorPage(page, DatabaseHandler::FIRST_PAGE, 2);
+        TEST_VERIFY(page.size() == 2);
+        resumeToken = m_DBHandler->getProductVendorPage(page, resumeToken, 2);
+        TEST_VERIFY(page.size() == 1);
+        TEST_VERIFY(checkString(page[0].productName, "Make", "Pepsi Twist", "Again"));
+        m_DBHandler->getProductVendorPage(page, resumeToken, 2);
+        TEST_VERIFY(page.empty());
 
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
@@ -175,8 +334,9 @@ void TestHandler::testCaseDevice(bool a_requiredDataExists)
     try
     {
         // Clean up existing data
-        QSqlQuery query;
+        QSqlQuery query(m_DBHandler->database());
         query.exec("DELETE FROM device");
+        m_DBHandler->reloadCaches();
 
         if(!a_requiredDataExists)
         {
@@ -186,7 +346,7 @@ void TestHandler::testCaseDevice(bool a_requiredDataExists)
         // Registration of Devices using existing productvendors
         std::vector<std::unique_ptr<DatabaseHandler::ProductVendor>> productVendors;
         m_DBHandler->getAllProductVendors(productVendors);
-        Q_ASSERT(productVendors.size() == 3);
+        TEST_VERIFY(productVendors.size() == 3);
         for(uint i = 0; i < productVendors.size(); ++i)
         {
             m_DBHandler->registerDevice(productVendors[i]->productId, productVendors[i]->vendorId, QString::number(i + 1000));
@@ -196,29 +356,45 @@ void TestHandler::testCaseDevice(bool a_requiredDataExists)
 
         // Verify successful registration
         DatabaseHandler::Device device;
-        Q_ASSERT(m_DBHandler->getDevice(device, productVendors[0]->productId, productVendors[0]->vendorId, QString::number(1000)));
-        Q_ASSERT(device.productId == productVendors[0]->productId);
-        Q_ASSERT(device.vendorId == productVendors[0]->vendorId);
-        Q_ASSERT(device.serialNumber == QString::number(1000));
+        TEST_VERIFY(m_DBHandler->getDevice(device, productVendors[0]->productId, productVendors[0]->vendorId, QString::number(1000)));
+        TEST_VERIFY(device.productId == productVendors[0]->productId);
+        TEST_VERIFY(device.vendorId == productVendors[0]->vendorId);
+        TEST_VERIFY(device.serialNumber == QString::number(1000));
 
         // Retrieval of all Devices
         std::vector<std::unique_ptr<DatabaseHandler::Device>> devices;
         m_DBHandler->getAllDevices(devices);
-        Q_ASSERT(devices.size() == 3);
-        Q_ASSERT(checkString((*(devices[0])).productId, productVendors[0]->productId, productVendors[1]->productId, productVendors[2]->productId));
+        TEST_VERIFY(devices.size() == 3);
+        TEST_VERIFY(checkString((*(devices[0])).productId, productVendors[0]->productId, productVendors[1]->productId, productVendors[2]->productId));
 
         // Test and check Device status
-        Q_ASSERT(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId, device.serialNumber));
-        Q_ASSERT(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
+        TEST_VERIFY(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId, device.serialNumber));
+        TEST_VERIFY(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
         m_DBHandler->setDeviceWhitelisted(device.productId, device.vendorId,device.serialNumber);
-        Q_ASSERT(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId,device.serialNumber));
-        Q_ASSERT(m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
+        TEST_VERIFY(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId,device.serialNumber));
+        TEST_VERIFY(m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
         m_DBHandler->setDeviceBlacklisted(device.productId, device.vendorId,device.serialNumber);
-        Q_ASSERT(m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId,device.serialNumber));
-        Q_ASSERT(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
+        TEST_VERIFY(m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId,device.serialNumber));
+        TEST_VERIFY(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId,device.serialNumber));
+
+        TEST_VERIFY(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId, "1234"));
+        TEST_VERIFY(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId, "1234"));
 
-        Q_ASSERT(!m_DBHandler->isDeviceBlackListed(device.productId, device.vendorId, "1234"));
-        Q_ASSERT(!m_DBHandler->isDeviceWhiteListed(device.productId, device.vendorId, "1234"));
+        // A single lookup returns every status, and a status change reaches the cache only when it is committed
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, device.serialNumber) == DatabaseHandler::DeviceStatus::Blacklisted);
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, "1234") == DatabaseHandler::DeviceStatus::NotRegistered);
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(productVendors[1]->productId, productVendors[1]->vendorId, QString::number(1001)) == DatabaseHandler::DeviceStatus::Unknown);
+        m_DBHandler->beginTransaction();
+        m_DBHandler->setDeviceWhitelisted(device.productId, device.vendorId, device.serialNumber);
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, device.serialNumber) == DatabaseHandler::DeviceStatus::Blacklisted);
+        m_DBHandler->rollbackTransaction();
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, device.serialNumber) == DatabaseHandler::DeviceStatus::Blacklisted);
+        m_DBHandler->beginTransaction();
+        m_DBHandler->setDeviceWhitelisted(device.productId, device.vendorId, device.serialNumber);
+        m_DBHandler->commitTransaction();
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, device.serialNumber) == DatabaseHandler::DeviceStatus::Whitelisted);
+        m_DBHandler->setDeviceBlacklisted(device.productId, device.vendorId, device.serialNumber);
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(device.productId, device.vendorId, device.serialNumber) == DatabaseHandler::DeviceStatus::Blacklisted);
 
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
@@ -237,8 +413,9 @@ void TestHandler::testCaseConnectedDevice(bool a_requiredDataExists)
     try
     {
         // Clean up existing data
-        QSqlQuery query;
+        QSqlQuery query(m_DBHandler->database());
         query.exec("DELETE FROM connecteddevice");
+        m_DBHandler->reloadDeviceCaches();
 
         if(!a_requiredDataExists)
         {
@@ -251,32 +428,79 @@ void TestHandler::testCaseConnectedDevice(bool a_requiredDataExists)
         std::vector<std::unique_ptr<DatabaseHandler::Device>> devices;
         m_DBHandler->getAllEdgeNodeKeys(edgeKeys);
         m_DBHandler->getAllDevices(devices);
-        Q_ASSERT(edgeKeys.size() == static_cast< qsizetype >( devices.size() ));
-        Q_ASSERT(edgeKeys.size() == 3);
+        TEST_VERIFY(edgeKeys.size() == static_cast< qsizetype >( devices.size() ));
+        TEST_VERIFY(edgeKeys.size() == 3);
         for(int i = 0; i < edgeKeys.size(); ++i)
         {
-            m_DBHandler->registerConnectedDevice(edgeKeys[i], devices[i]->productId, devices[i]->vendorId, devices[i]->serialNumber, "2021:09:09 22:36:00:00" + QString::number(i));
+            m_DBHandler->registerConnectedDevice(edgeKeys[i], devices[i]->productId, devices[i]->vendorId, devices[i]->serialNumber, "2021-09-09 22:36:00.00" + QString::number(i));
         }
 
         // Verify successfull registration
         std::vector<std::unique_ptr<DatabaseHandler::ConnectedDevice>> connectedDevices;
         m_DBHandler->getAllConnectedDevices(connectedDevices);
-        Q_ASSERT(connectedDevices.size() == 3);
-        Q_ASSERT(checkString((*(connectedDevices[0])).connectedEdgeNodeMacAddress, edgeKeys[0], edgeKeys[1], edgeKeys[2]));
-        Q_ASSERT(checkString((*(connectedDevices[1])).deviceSerialNumber, "1000", "1001", "1002"));
+        TEST_VERIFY(connectedDevices.size() == 3);
+        TEST_VERIFY(checkString((*(connectedDevices[0])).connectedEdgeNodeMacAddress, edgeKeys[0], edgeKeys[1], edgeKeys[2]));
+        TEST_VERIFY(checkString((*(connectedDevices[1])).deviceSerialNumber, "1000", "1001", "1002"));
 
         // Verify the ability to remove an existing connection
         m_DBHandler->unregisterConnectedDevice(edgeKeys[1], devices[1]->productId, devices[1]->vendorId, devices[1]->serialNumber);
         connectedDevices.clear();
         m_DBHandler->getAllConnectedDevices(connectedDevices);
-        Q_ASSERT(connectedDevices.size() == 2);
+        TEST_VERIFY(connectedDevices.size() == 2);
         for(const std::unique_ptr<DatabaseHandler::ConnectedDevice>& cd: connectedDevices)
         {
-            Q_ASSERT(cd->connectedEdgeNodeMacAddress != edgeKeys[1]);
-            Q_ASSERT(cd->deviceProductId != devices[1]->productId);
-            Q_ASSERT(cd->deviceSerialNumber != devices[1]->serialNumber);
+            TEST_VERIFY(cd->connectedEdgeNodeMacAddress != edgeKeys[1]);
+            TEST_VERIFY(cd->deviceProductId != devices[1]->productId);
+            TEST_VERIFY(cd->deviceSerialNumber != devices[1]->serialNumber);
         }
 
+        // Verify the connected device index follows the registrations and matches the table after a reload
+        std::vector<DatabaseHandler::Device> devicesOnEdgeNode;
+        QVector<QString> edgeNodesOfDevice;
+        m_DBHandler->getDevicesConnectedToEdgeNode(devicesOnEdgeNode, edgeKeys[0]);
+        TEST_VERIFY(devicesOnEdgeNode.size() == 1 && devicesOnEdgeNode[0].serialNumber == devices[0]->serialNumber);
+        m_DBHandler->getDevicesConnectedToEdgeNode(devicesOnEdgeNode, edgeKeys[1]);
+        TEST_VERIFY(devicesOnEdgeNode.empty());
+        TEST_VERIFY(!m_DBHandler->isDeviceConnected(devices[1]->productId, devices[1]->vendorId, devices[1]->serialNumber));
+
+        m_DBHandler->registerConnectedDevice(edgeKeys[1], devices[0]->productId, devices[0]->vendorId, devices[0]->serialNumber, "2021-09-09 22:37:00.000");
+        m_DBHandler->reloadDeviceCaches();
+        m_DBHandler->getEdgeNodesOfConnectedDevice(edgeNodesOfDevice, devices[0]->productId, devices[0]->vendorId, devices[0]->serialNumber);
+        TEST_VERIFY(edgeNodesOfDevice.size() == 2 && edgeNodesOfDevice.contains(edgeKeys[0]) && edgeNodesOfDevice.contains(edgeKeys[1]));
+
+        m_DBHandler->unregisterConnectedDevicesOnEdgeNode(edgeKeys[0]);
+        m_DBHandler->getEdgeNodesOfConnectedDevice(edgeNodesOfDevice, devices[0]->productId, devices[0]->vendorId, devices[0]->serialNumber);
+        TEST_VERIFY(edgeNodesOfDevice.size() == 1 && edgeNodesOfDevice[0] == edgeKeys[1]);
+        m_DBHandler->getDevicesConnectedToEdgeNode(devicesOnEdgeNode, edgeKeys[0]);
+        TEST_VERIFY(devicesOnEdgeNode.empty());
+
+        // Verify Edge Nodes going offline together disconnect and log all their Devices in one call
+        const QString offlineTime = "2021-09-09 22:38:00.000";
+        m_DBHandler->registerOrUpdateEdgeNode(edgeKeys[1], true, offlineTime);
+        TEST_VERIFY(m_DBHandler->edgesWentOffline({ qMakePair(edgeKeys[1], offlineTime), qMakePair(edgeKeys[2], offlineTime) }) == 2);
+        connectedDevices.clear();
+        m_DBHandler->getAllConnectedDevices(connectedDevices);
+        TEST_VERIFY(connectedDevices.empty());
+        TEST_VERIFY(!m_DBHandler->isDeviceConnected(devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber));
+        DatabaseHandler::EdgeNode offlineEdgeNode;
+        TEST_VERIFY(m_DBHandler->getEdgeNode(offlineEdgeNode, edgeKeys[1]) && !offlineEdgeNode.isOnline);
+        DatabaseHandler::LogEvent disconnectEvent;
+        TEST_VERIFY(m_DBHandler->getLoggedEvent(disconnectEvent, edgeKeys[1], devices[0]->productId, devices[0]->vendorId, devices[0]->serialNumber, offlineTime));
+        TEST_VERIFY(disconnectEvent.eventDescription == "Device disconnected");
+        TEST_VERIFY(m_DBHandler->edgeWentOffline(edgeKeys[0], offlineTime) == 0);
+
+        // Verify the index only takes connections once their transaction commits
+        m_DBHandler->beginTransaction();
+        m_DBHandler->registerConnectedDevice(edgeKeys[2], devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber, "2021-09-09 22:39:00.000");
+        TEST_VERIFY(!m_DBHandler->isDeviceConnected(devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber));
+        m_DBHandler->rollbackTransaction();
+        TEST_VERIFY(!m_DBHandler->isDeviceConnected(devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber));
+        m_DBHandler->beginTransaction();
+        m_DBHandler->registerConnectedDevice(edgeKeys[2], devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber, "2021-09-09 22:39:00.000");
+        m_DBHandler->commitTransaction();
+        TEST_VERIFY(m_DBHandler->isDeviceConnected(devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber));
+        m_DBHandler->unregisterConnectedDevicesOnEdgeNode(edgeKeys[2]);
+
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
     catch(std::exception& e)
@@ -294,8 +518,8 @@ void TestHandler::testCaseLog(bool a_requiredDataExists)
     try
     {
         // Clean up existing data
-        QSqlQuery query;
-        query.exec("DELETE FROM log");
+        m_DBHandler->dropLogPartitionsBefore(QDateTime::currentDateTimeUtc().addDays(1));
+        TEST_VERIFY(m_DBHandler->getLogPartitions().isEmpty());
 
         if(!a_requiredDataExists)
         {
@@ -308,23 +532,67 @@ void TestHandler::testCaseLog(bool a_requiredDataExists)
         std::vector<std::unique_ptr<DatabaseHandler::Device>> devices;
         m_DBHandler->getAllEdgeNodeKeys(edgeKeys);
         m_DBHandler->getAllDevices(devices);
-        Q_ASSERT(edgeKeys.size() == static_cast< qsizetype >( devices.size() ) );
-        Q_ASSERT(edgeKeys.size() == 3);
+        TEST_VERIFY(edgeKeys.size() == static_cast< qsizetype >( devices.size() ) );
+        TEST_VERIFY(edgeKeys.size() == 3);
         for(int i = 0; i < edgeKeys.size(); ++i)
         {
-            m_DBHandler->logEvent(edgeKeys[i], devices[i]->productId, devices[i]->vendorId, devices[i]->serialNumber, "2021:09:09 22:36:00:00" + QString::number(i), "Number " + QString::number(i));
+            m_DBHandler->logEvent(edgeKeys[i], devices[i]->productId, devices[i]->vendorId, devices[i]->serialNumber, "2021-09-09 22:36:00.00" + QString::number(i), "Number " + QString::number(i));
         }
 
         // Verify successfull loggging
         DatabaseHandler::LogEvent logEvent;
-        Q_ASSERT(m_DBHandler->getLoggedEvent(logEvent, edgeKeys[2], devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber, "2021:09:09 22:36:00:002"));
+        TEST_VERIFY(m_DBHandler->getLoggedEvent(logEvent, edgeKeys[2], devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber, "2021-09-09 22:36:00.002"));
 
         // Retrieval of all logged events
         std::vector<std::unique_ptr<DatabaseHandler::LogEvent>> logEvents;
         m_DBHandler->getAllLoggedEvents(logEvents);
-        Q_ASSERT(logEvents.size() == 3);
-        Q_ASSERT(checkString((*(logEvents[0])).edgeNodeMacAddress, edgeKeys[0], edgeKeys[1], edgeKeys[2]));
-        Q_ASSERT(checkString((*(logEvents[1])).timestamp, "2021:09:09 22:36:00:000", "2021:09:09 22:36:00:001", "2021:09:09 22:36:00:002"));
+        TEST_VERIFY(logEvents.size() == 3);
+        TEST_VERIFY(checkString((*(logEvents[0])).edgeNodeMacAddress, edgeKeys[0], edgeKeys[1], edgeKeys[2]));
+        TEST_VERIFY(checkString((*(logEvents[1])).timestamp, "2021-09-09 22:36:00.000", "2021-09-09 22:36:00.001", "2021-09-09 22:36:00.002"));
+
+        // Time window queries
+        const QDateTime start(QDate(2021, 9, 9), QTime(22, 36, 0, 0), QTimeZone::utc());
+        QVector<QString> timestamps;
+        m_DBHandler->forEachLoggedEventBetween(start, start.addMSecs(2), [&timestamps](const DatabaseHandler::LogEvent& a_event)
+        {
+            timestamps.append(a_event.timestamp);
+            return true;
+        });
+        TEST_VERIFY(timestamps == QVector<QString>({"2021-09-09 22:36:00.000", "2021-09-09 22:36:00.001"}));
+        int edgeNodeEvents = 0;
+        m_DBHandler->forEachLoggedEventOnEdgeNode(edgeKeys[1], start, start.addSecs(3600), [&edgeNodeEvents](const DatabaseHandler::LogEvent&)
+        {
+            return ++edgeNodeEvents > 0;
+        });
+        TEST_VERIFY(edgeNodeEvents == 1);
+        int deviceEvents = 0;
+        m_DBHandler->forEachLoggedEventForDevice(devices[2]->productId, devices[2]->vendorId, devices[2]->serialNumber, start.addMSecs(3), start.addSecs(3600), [&deviceEvents](const DatabaseHandler::LogEvent&)
+        {
+            return ++deviceEvents > 0;
+        });
+        TEST_VERIFY(deviceEvents == 0);
+
+        // Legacy Qt text dates convert to the same instant
+        qint64 legacy = 0;
+        qint64 canonical = 0;
+        TEST_VERIFY(Timestamp::parse(u"Thu Sep 9 22:36:00 2021", legacy));
+        TEST_VERIFY(Timestamp::parse(u"2021-09-09T22:36:00Z", canonical));
+        TEST_VERIFY(legacy == canonical && Timestamp::toText(canonical) == "2021-09-09 22:36:00.000");
+
+        // Paging and retention across partitions
+        m_DBHandler->logEvent(edgeKeys[0], devices[0]->productId, devices[0]->vendorId, devices[0]->serialNumber, "2021-09-10 08:00:00.000", "Next day");
+        TEST_VERIFY(m_DBHandler->getLogPartitions() == QVector<QString>({"log_20210909", "log_20210910"}));
+        std::vector<DatabaseHandler::LogEvent> page;
+        qint64 resumeToken = m_DBHandler->getLoggedEventPage(page, DatabaseHandler::FIRST_PAGE, 3);
+        TEST_VERIFY(page.size() == 3);
+        resumeToken = m_DBHandler->getLoggedEventPage(page, resumeToken, 3);
+        TEST_VERIFY(page.size() == 1 && page[0].eventDescription == "Next day");
+        m_DBHandler->getLoggedEventPage(page, resumeToken, 3);
+        TEST_VERIFY(page.empty());
+        TEST_VERIFY(m_DBHandler->dropLogPartitionsBefore(start.addDays(1)) == 1);
+        logEvents.clear();
+        m_DBHandler->getAllLoggedEvents(logEvents);
+        TEST_VERIFY(logEvents.size() == 1);
 
         qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
     }
@@ -334,18 +602,755 @@ void TestHandler::testCaseLog(bool a_requiredDataExists)
     }
 }
 
+//!
+//! \brief The testCasePreparedQueryCache function
+//! Tests that prepared statements are reused and dropped again on invalidation
+//!
+void TestHandler::testCasePreparedQueryCache()
+{
+    try
+    {
+        DatabaseHandler::EdgeNode node;
+        m_DBHandler->getEdgeNode(node, "ABCD");
+        const DatabaseHandler::PreparedQueryStatistics before = m_DBHandler->getPreparedQueryStatistics();
+
+        // A repeated operation must be served from the cache
+        m_DBHandler->getEdgeNode(node, "EFGH");
+        DatabaseHandler::PreparedQueryStatistics after = m_DBHandler->getPreparedQueryStatistics();
+        TEST_VERIFY(after.hits == before.hits + 1);
+        TEST_VERIFY(after.misses == before.misses);
+
+        // After an invalidation the statement must be prepared again
+        m_DBHandler->invalidatePreparedQueries();
+        m_DBHandler->getEdgeNode(node, "EFGH");
+        after = m_DBHandler->getPreparedQueryStatistics();
+        TEST_VERIFY(after.misses == before.misses + 1);
+        TEST_VERIFY(after.invalidations == before.invalidations + 1);
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCasePreparedQueryCache failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseConnectionPool function
+//! Tests that other threads read through their own query only connection while the database runs in WAL mode
+//!
+void TestHandler::testCaseConnectionPool()
+{
+    try
+    {
+        QSqlQuery query(m_DBHandler->database());
+        TEST_VERIFY(query.exec("PRAGMA journal_mode"));
+        TEST_VERIFY(query.next() && query.value(0).toString().compare("wal", Qt::CaseInsensitive) == 0);
+        query.finish();
+
+        std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> ownerNodes;
+        m_DBHandler->getAllEdgeNodes(ownerNodes);
+
+        std::size_t readerNodes = 0;
+        bool writeRejected = false;
+        QThread* reader = QThread::create([this, &readerNodes, &writeRejected]()
+        {
+            std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> nodes;
+            m_DBHandler->getAllEdgeNodes(nodes);
+            readerNodes = nodes.size();
+            try
+            {
+                m_DBHandler->registerOrUpdateEdgeNode("READER", true, "2021-09-09 22:36:00.000");
+            }
+            catch(std::exception& e)
+            {
+                writeRejected = true;
+            }
+            m_DBHandler->releaseThreadConnection();
+        });
+        reader->start();
+        reader->wait();
+        delete reader;
+
+        TEST_VERIFY(readerNodes == ownerNodes.size());
+        TEST_VERIFY(writeRejected);
+
+        // Threads exiting without releasing their connection still give back their reader slot
+        bool readFailed = false;
+        for(int i = 0; i <= DatabaseConnectionPool::maxReadersFromEnvironment(); ++i)
+        {
+            QThread* exitingReader = QThread::create([this, &readFailed]()
+            {
+                try
+                {
+                    DatabaseHandler::EdgeNode node;
+                    m_DBHandler->getEdgeNode(node, "ABCD");
+                }
+                catch(std::exception& e)
+                {
+                    readFailed = true;
+                }
+            });
+            exitingReader->start();
+            exitingReader->wait();
+            delete exitingReader;
+        }
+        TEST_VERIFY(!readFailed);
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseConnectionPool failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseOperationMetrics function
+//! Tests that operations record their latencies and errors on every thread
+//!
+void TestHandler::testCaseOperationMetrics()
+{
+#ifndef HOSTSECURE_NO_OPERATION_METRICS
+    try
+    {
+        const auto statistics = [](const QString& a_name)
+        {
+            for(const OperationMetrics::OperationStatistics& operation : OperationMetrics::getStatistics())
+            {
+                if(operation.name == a_name)
+                {
+                    return operation;
+                }
+            }
+            return OperationMetrics::OperationStatistics();
+        };
+
+        const OperationMetrics::OperationStatistics before = statistics("getEdgeNode");
+        DatabaseHandler::EdgeNode node;
+        for(int i = 0; i < 100; ++i)
+        {
+            m_DBHandler->getEdgeNode(node, "ABCD");
+        }
+        QThread* reader = QThread::create([this]()
+        {
+            DatabaseHandler::EdgeNode readerNode;
+            m_DBHandler->getEdgeNode(readerNode, "ABCD");
+            m_DBHandler->releaseThreadConnection();
+        });
+        reader->start();
+        reader->wait();
+        delete reader;
+
+        const OperationMetrics::OperationStatistics after = statistics("getEdgeNode");
+        TEST_VERIFY(after.count == before.count + 101);
+        TEST_VERIFY(after.p50Us > 0 && after.p50Us <= after.p99Us && after.p99Us <= after.maxUs);
+
+        const int failingOperation = OperationMetrics::registerOperation("testFailingOperation");
+        try
+        {
+            const OperationMetrics::Scope scope(failingOperation);
+            throw std::runtime_error("Expected failure");
+        }
+        catch(std::runtime_error& e)
+        {
+            // Expected
+        }
+        TEST_VERIFY(statistics("testFailingOperation").errors == 1);
+        TEST_VERIFY(OperationMetrics::toJson()["operations"].toObject().contains("getEdgeNode"));
+
+        qCritical() << __PRETTY_FUNCTION__ << "Recording overhead" << OperationMetrics::measureOverhead() << "ns per operation";
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseOperationMetrics failed with exception = %s", e.what());
+    }
+#endif
+}
+
+//!
+//! \brief The testCaseIngestMetrics function
+//! Tests that the Mqtt client counts messages, malformed payloads and rejected samples
+//!
+void TestHandler::testCaseIngestMetrics()
+{
+    try
+    {
+        auto metrics = std::make_shared<IngestMetrics>();
+        DatabaseMqttClient client(nullptr, false);
+        client.setIngestMetrics(metrics);
+
+        int removedEdges = 0;
+        QObject::connect(&client, &DatabaseMqttClient::edgeRemoved, [&removedEdges]() { ++removedEdges; });
+
+        client.processMessage(QMqttTopicName("edges/ABCD"), QByteArray("{not json"));
+        client.processMessage(QMqttTopicName("edges/ABCD"), QByteArray("[]"));
+        client.processMessage(QMqttTopicName("edges/ABCD"), QByteArray());
+        client.processMessage(QMqttTopicName("edges/ABCD/1234:5678/extra"), QByteArray());
+        metrics->countInvalidId();
+        metrics->countWriteFailure(IngestMetrics::WriteOperation::ConnectDevice);
+        metrics->recordLag(2000000);
+
+        // A payload that is not JSON is dropped, an empty or rejected payload still removes the Edge Node
+        TEST_VERIFY(removedEdges == 2);
+
+        const QJsonObject snapshot = metrics->takeSnapshot();
+        TEST_VERIFY(snapshot["messages"].toObject()["edge"].toInteger() == 3);
+        TEST_VERIFY(snapshot["messages"].toObject()["unexpected"].toInteger() == 1);
+        TEST_VERIFY(snapshot["jsonParseFailures"].toInteger() == 1);
+        TEST_VERIFY(snapshot["rejected"].toObject()["edge"].toInteger() == 1);
+        TEST_VERIFY(snapshot["invalidIds"].toInteger() == 1);
+        TEST_VERIFY(snapshot["writeFailures"].toObject()["connectDevice"].toInteger() == 1);
+        TEST_VERIFY(snapshot["lag"].toObject()["writes"].toInteger() == 1);
+        TEST_VERIFY(snapshot["lag"].toObject()["maxMs"].toDouble() == 2.0);
+
+        // The lag covers one snapshot interval, the counters are totals
+        const QJsonObject next = metrics->takeSnapshot();
+        TEST_VERIFY(next["lag"].toObject()["writes"].toInteger() == 0);
+        TEST_VERIFY(next["jsonParseFailures"].toInteger() == 1);
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseIngestMetrics failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseMessageDecoder function
+//! Tests that the fast path decodes topics and payloads like QJsonDocument does, and that it allocates only
+//! the strings it hands out
+//!
+void TestHandler::testCaseMessageDecoder()
+{
+    try
+    {
+        TEST_VERIFY(MqttMessageDecoder::hasFastPath());
+
+        const QString topicName = "edges/ABCD/1234:5678";
+        MqttMessageDecoder::Topic topic;
+        MqttMessageDecoder::parseTopic(topicName, topic);
+        TEST_VERIFY(topic.levelCount == 3 && topic.edgeId == u"ABCD" && topic.deviceId == u"1234:5678");
+        MqttMessageDecoder::parseTopic(u"edges/ABCD/", topic);
+        TEST_VERIFY(topic.levelCount == 3 && topic.deviceId.isEmpty());
+
+        QStringView vendorId;
+        QStringView productId;
+        TEST_VERIFY(MqttMessageDecoder::splitDeviceId(u"1234:5678", vendorId, productId));
+        TEST_VERIFY(vendorId == u"1234" && productId == u"5678");
+        TEST_VERIFY(!MqttMessageDecoder::splitDeviceId(u"1234", vendorId, productId));
+        TEST_VERIFY(!MqttMessageDecoder::splitDeviceId(u"1234:5678:9", vendorId, productId));
+
+        MsgDevice device;
+        device.deviceSerial = "1000";
+        device.lastHeartBeat = "2021-08-27 09:19:00.000";
+        const QByteArray devicePayload = QJsonDocument(device.toJson()).toJson(QJsonDocument::Compact);
+
+        MsgDevice decoded;
+        TEST_VERIFY(MqttMessageDecoder::decodeDevice(devicePayload, decoded) == MqttMessageDecoder::Decoding::Decoded);
+        TEST_VERIFY(decoded.deviceSerial == device.deviceSerial && decoded.lastHeartBeat == device.lastHeartBeat);
+
+        // Indented and nested payloads take the QJsonDocument path and decode the same
+        QJsonObject nested = device.toJson();
+        nested["extra"] = QJsonObject({ { "key", 1 } });
+        MsgDevice fallback;
+        TEST_VERIFY(MqttMessageDecoder::decodeDevice(QJsonDocument(nested).toJson(QJsonDocument::Indented), fallback) == MqttMessageDecoder::Decoding::Decoded);
+        TEST_VERIFY(fallback.deviceSerial == device.deviceSerial);
+
+        MsgEdge edge;
+        edge.isOnline = true;
+        MsgEdge decodedEdge;
+        TEST_VERIFY(MqttMessageDecoder::decodeEdge(QJsonDocument(edge.toJson()).toJson(QJsonDocument::Compact), decodedEdge) == MqttMessageDecoder::Decoding::Decoded);
+        TEST_VERIFY(decodedEdge.isOnline);
+
+        // Duplicate keys decode like QJsonDocument, which keeps the last value
+        TEST_VERIFY(MqttMessageDecoder::decodeEdge("{\"isOnline\":true,\"isOnline\":false}", decodedEdge) == MqttMessageDecoder::Decoding::Decoded);
+        TEST_VERIFY(!decodedEdge.isOnline);
+
+        TEST_VERIFY(MqttMessageDecoder::decodeEdge("{\"isOnline\":tru}", decodedEdge) == MqttMessageDecoder::Decoding::NotJson);
+        TEST_VERIFY(MqttMessageDecoder::decodeEdge("{}", decodedEdge) == MqttMessageDecoder::Decoding::Rejected);
+        TEST_VERIFY(MqttMessageDecoder::decodeEdge("", decodedEdge) == MqttMessageDecoder::Decoding::Rejected);
+
+        if(m_AllocationCounter)
+        {
+            // The device serial and heartbeat are the only allocations of a Device message
+            constexpr int MESSAGES = 1000;
+            constexpr quint64 MAX_ALLOCATIONS_PER_MESSAGE = 2;
+            const quint64 before = m_AllocationCounter();
+            for(int i = 0; i < MESSAGES; ++i)
+            {
+                MqttMessageDecoder::parseTopic(topicName, topic);
+                MqttMessageDecoder::splitDeviceId(topic.deviceId, vendorId, productId);
+                MqttMessageDecoder::decodeDevice(devicePayload, decoded);
+            }
+            const quint64 fastPathAllocations = m_AllocationCounter() - before;
+
+            const quint64 documentBefore = m_AllocationCounter();
+            for(int i = 0; i < MESSAGES; ++i)
+            {
+                const QStringList levels = topicName.split('/');
+                const QStringList ids = levels[2].split(':');
+                decoded.fromJson(QJsonDocument::fromJson(devicePayload).object());
+            }
+            const quint64 documentAllocations = m_AllocationCounter() - documentBefore;
+
+            qCritical() << __PRETTY_FUNCTION__ << "Allocations per message:" << fastPathAllocations / double(MESSAGES)
+                        << "decoder," << documentAllocations / double(MESSAGES) << "QJsonDocument";
+            TEST_VERIFY(fastPathAllocations <= MAX_ALLOCATIONS_PER_MESSAGE * MESSAGES);
+        }
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseMessageDecoder failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseAsync function
+//! Tests that queries run on the async handler deliver their results and exceptions through futures
+//!
+void TestHandler::testCaseAsync()
+{
+    try
+    {
+        m_DBHandler->registerOrUpdateEdgeNode("ABCD", true, "2021-08-27 09:19:00.000");
+        std::vector<std::unique_ptr<DatabaseHandler::EdgeNode>> edges;
+        m_DBHandler->getAllEdgeNodes(edges);
+
+        AsyncDatabaseHandler asyncHandler(*m_DBHandler);
+
+        QFuture<std::optional<DatabaseHandler::EdgeNode>> existing = asyncHandler.getEdgeNode("ABCD");
+        QFuture<std::optional<DatabaseHandler::EdgeNode>> missing = asyncHandler.getEdgeNode("NONE");
+        QFuture<std::vector<DatabaseHandler::EdgeNode>> all = asyncHandler.getAllEdgeNodes();
+        TEST_VERIFY(existing.result().has_value() && existing.result()->macAddress == "ABCD");
+        TEST_VERIFY(!missing.result().has_value());
+        TEST_VERIFY(all.result().size() == edges.size());
+
+        QFuture<int> failing = asyncHandler.run([](DatabaseHandler&) -> int
+        {
+            throw std::runtime_error("Expected failure");
+        });
+        bool rethrown = false;
+        try
+        {
+            failing.result();
+        }
+        catch(std::runtime_error& e)
+        {
+            rethrown = QString(e.what()) == "Expected failure";
+        }
+        TEST_VERIFY(rethrown);
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseAsync failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testVirusHashIndexPerformance function
+//! Helper function measuring the memory per signature and the miss lookup time of the in-memory virus hash index
+//! against their budgets. Returns false when a budget is exceeded by more than the tolerance
+//!
+bool TestHandler::testVirusHashIndexPerformance(qint64 a_signatureCount, const QJsonObject& a_baseline, double a_tolerance, QJsonObject& a_results)
+{
+    if(a_signatureCount <= 0)
+    {
+        return true;
+    }
+
+    QRandomGenerator random(42);
+    VirusHashIndex index;
+    index.reserve(a_signatureCount);
+
+    QElapsedTimer timer;
+    timer.start();
+    for(qint64 i = 0; i < a_signatureCount; ++i)
+    {
+        VirusHashIndex::Digest digest;
+        digest.high = random.generate64();
+        digest.low = random.generate64();
+        index.insert(digest);
+    }
+    const qint64 buildMs = timer.elapsed();
+
+    constexpr int lookupCount = 10000000;
+    int found = 0;
+    timer.restart();
+    for(int i = 0; i < lookupCount; ++i)
+    {
+        VirusHashIndex::Digest digest;
+        digest.high = random.generate64();
+        digest.low = random.generate64();
+        found += index.contains(digest) ? 1 : 0;
+    }
+    const qint64 lookupNs = qMax<qint64>(timer.nsecsElapsed(), 1);
+    TEST_VERIFY(found == 0);
+    TEST_VERIFY(index.size() == a_signatureCount);
+
+    qCritical() << __PRETTY_FUNCTION__ << a_signatureCount << "signatures built in" << buildMs << "ms,"
+                << static_cast<qint64>(lookupCount * 1000000000.0 / lookupNs) << "miss lookups/sec";
+    bool withinBudget = checkBudget(a_baseline, "virusHashIndexBytesPerSignature", static_cast<double>(index.memoryUsage()) / a_signatureCount, a_tolerance, a_results);
+    withinBudget &= checkBudget(a_baseline, "virusHashIndexMissLookupNs", static_cast<double>(lookupNs) / lookupCount, a_tolerance, a_results);
+    return withinBudget;
+}
+
+//!
+//! \brief The testCaseSchema function
+//! Tests that the database has been migrated to the latest schema version
+//!
+void TestHandler::testCaseSchema()
+{
+    try
+    {
+        TEST_VERIFY(m_DBHandler->getSchemaVersion() == DatabaseHandler::getLatestSchemaVersion());
+
+        // The single log table has been replaced by daily partitions
+        QSqlQuery query(m_DBHandler->database());
+        TEST_VERIFY(query.exec("SELECT name FROM sqlite_master WHERE type = 'table' AND name = 'log'"));
+        TEST_VERIFY(!query.next());
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseSchema failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseCompactIds function
+//! Tests the conversions between text ids and the integers stored by the compact layout
+//!
+void TestHandler::testCaseCompactIds()
+{
+    try
+    {
+        CompactIds::UsbId usbId = 0;
+        TEST_VERIFY(CompactIds::parseUsbId(u"1D6b", usbId));
+        TEST_VERIFY(usbId == 0x1d6b);
+        TEST_VERIFY(CompactIds::formatUsbId(0x0a5c) == "0a5c");
+        TEST_VERIFY(!CompactIds::parseUsbId(u"QWER", usbId));
+        TEST_VERIFY(!CompactIds::parseUsbId(u"12345", usbId));
+
+        CompactIds::MacAddress macAddress = 0;
+        TEST_VERIFY(CompactIds::parseMacAddress(u"00:1A:2b:3c:4D:5e", macAddress));
+        TEST_VERIFY(macAddress == 0x001a2b3c4d5eULL);
+        TEST_VERIFY(CompactIds::formatMacAddress(macAddress) == "00:1a:2b:3c:4d:5e");
+        TEST_VERIFY(CompactIds::parseMacAddress(u"001a2b3c4d5e", macAddress));
+        TEST_VERIFY(!CompactIds::parseMacAddress(u"ABCD", macAddress));
+        TEST_VERIFY(!CompactIds::parseMacAddress(u"00:1a:2b:3c:4d:5e:6f", macAddress));
+
+        CompactIds::DeviceType deviceType;
+        TEST_VERIFY(CompactIds::parseDeviceType(u"046d:c52b", deviceType));
+        TEST_VERIFY(deviceType.vendorId == 0x046d && deviceType.productId == 0xc52b);
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseCompactIds failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The testCaseCompactLayout function
+//! Tests a database created with HOSTSECURE_DB_COMPACT_IDS set, whose ids are stored as integers
+//!
+void TestHandler::testCaseCompactLayout()
+{
+    const QString path = m_DatabasePath + ".compact";
+    try
+    {
+        for(const char* suffix : { "", "-wal", "-shm" })
+        {
+            QFile::remove(path + suffix);
+        }
+        qputenv("HOSTSECURE_DB_COMPACT_IDS", "1");
+        std::unique_ptr<DatabaseHandler> db = std::make_unique<DatabaseHandler>(path);
+        qunsetenv("HOSTSECURE_DB_COMPACT_IDS");
+        TEST_VERIFY(db->usesCompactIds());
+        {
+            QSqlQuery query(db->database());
+            query.exec("DELETE FROM productvendor");
+        }
+
+        // Ids are accepted in any case and returned in their canonical form
+        const QString macAddress = "00:1a:2b:3c:4d:5e";
+        db->registerOrUpdateEdgeNode("00:1A:2B:3C:4D:5E", true, "2021-09-09 22:36:00.000");
+        DatabaseHandler::EdgeNode edgeNode;
+        TEST_VERIFY(db->getEdgeNode(edgeNode, macAddress));
+        TEST_VERIFY(edgeNode.macAddress == macAddress && edgeNode.isOnline && edgeNode.lastHeartbeat == "2021-09-09 22:36:00.000");
+
+        // The batch import skips rows with invalid ids, single writes throw
+        int invalidRows = 0;
+        TEST_VERIFY(db->registerProductVendors({ { "FFF1", "Product", "FFF0", "Vendor" }, { "QWER", "Invalid", "fff0", "Vendor" } }, &invalidRows) == 1);
+        TEST_VERIFY(invalidRows == 1);
+        DatabaseHandler::ProductVendor productVendor;
+        TEST_VERIFY(db->getProductVendor(productVendor, "fff1", "fff0"));
+        TEST_VERIFY(productVendor.productId == "fff1" && productVendor.vendorId == "fff0" && productVendor.productName == "Product");
+        bool rejected = false;
+        try
+        {
+            db->registerOrUpdateEdgeNode("ABCD", true, "2021-09-09 22:36:00.000");
+        }
+        catch(std::exception&)
+        {
+            rejected = true;
+        }
+        TEST_VERIFY(rejected);
+
+        // Devices and their status
+        db->registerDevice("FFF1", "FFF0", "SN1");
+        DatabaseHandler::Device device;
+        TEST_VERIFY(db->getDevice(device, "fff1", "fff0", "SN1"));
+        TEST_VERIFY(device.productId == "fff1" && device.vendorId == "fff0" && device.serialNumber == "SN1");
+        db->setDeviceBlacklisted("fff1", "fff0", "SN1");
+        TEST_VERIFY(db->isDeviceBlackListed("FFF1", "FFF0", "SN1"));
+
+        // Connections and log events
+        db->registerConnectedDevice(macAddress, "fff1", "fff0", "SN1", "2021-09-09 22:36:00.000");
+        TEST_VERIFY(db->isDeviceConnected("fff1", "fff0", "SN1"));
+        std::vector<std::unique_ptr<DatabaseHandler::ConnectedDevice>> connectedDevices;
+        db->getAllConnectedDevices(connectedDevices);
+        TEST_VERIFY(connectedDevices.size() == 1);
+        TEST_VERIFY(connectedDevices[0]->connectedEdgeNodeMacAddress == macAddress && connectedDevices[0]->deviceProductId == "fff1" && connectedDevices[0]->deviceVendorId == "fff0");
+
+        db->logEvent(macAddress, "fff1", "fff0", "SN1", "2021-09-09 22:36:00.001", "Device connected");
+        DatabaseHandler::LogEvent logEvent;
+        TEST_VERIFY(db->getLoggedEvent(logEvent, "00:1A:2B:3C:4D:5E", "FFF1", "FFF0", "SN1", "2021-09-09 22:36:00.001"));
+        TEST_VERIFY(logEvent.edgeNodeMacAddress == macAddress && logEvent.deviceProductId == "fff1" && logEvent.deviceVendorId == "fff0");
+        TEST_VERIFY(logEvent.eventDescription == "Device connected");
+
+        // Going offline logs the disconnect of the connected Device
+        TEST_VERIFY(db->edgeWentOffline(macAddress, "2021-09-09 22:37:00.000") == 1);
+        TEST_VERIFY(!db->isDeviceConnected("fff1", "fff0", "SN1"));
+        TEST_VERIFY(db->getLoggedEvent(logEvent, macAddress, "fff1", "fff0", "SN1", "2021-09-09 22:37:00.000"));
+
+        db.reset();
+        for(const char* suffix : { "", "-wal", "-shm" })
+        {
+            QFile::remove(path + suffix);
+        }
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseCompactLayout failed with exception = %s", e.what());
+    }
+}
+
 //!
 //! \brief The testCaseAll function
 //! Tests every table
 //!
 void TestHandler::testCaseAll()
 {
+    testCaseSchema();
+    testCaseCompactIds();
+    testCaseCompactLayout();
     testCaseEdgeNode();
     testVirus();
     testCaseProductVendor();
     testCaseDevice(true);
     testCaseConnectedDevice(true);
     testCaseLog(true);
+    testCasePreparedQueryCache();
+    testCaseConnectionPool();
+    testCaseAsync();
+    testCaseOperationMetrics();
+    testCaseIngestMetrics();
+    testCaseMessageDecoder();
+}
+
+//!
+//! \brief The testCaseScale function
+//! Loads large synthetic datasets, checks the results of the queries on them and compares the measured
+//! timings with the budgets of the baseline file. Fails when a timing exceeds its budget by more than the tolerance.
+//! The tolerance of the baseline can be overridden with HOSTSECURE_TEST_TOLERANCE
+//!
+void TestHandler::testCaseScale(const QString &a_baselinePath, const QString &a_resultsPath)
+{
+    try
+    {
+        QFile baselineFile(a_baselinePath);
+        if(!baselineFile.open(QIODevice::ReadOnly))
+        {
+            throw std::runtime_error("Failed to open the performance baseline " + a_baselinePath.toStdString());
+        }
+        const QJsonObject baseline = QJsonDocument::fromJson(baselineFile.readAll()).object();
+        const QJsonObject rows = baseline["rows"].toObject();
+        const QJsonObject budgets = baseline["budgets"].toObject();
+        double tolerance = baseline["tolerance"].toDouble();
+        const char* toleranceSetting = getenv("HOSTSECURE_TEST_TOLERANCE");
+        if(toleranceSetting != nullptr)
+        {
+            tolerance = QString(toleranceSetting).toDouble();
+        }
+
+        QJsonObject measurements;
+        bool withinBudget = true;
+        QElapsedTimer timer;
+
+        // Import of product vendors in one batch
+        const qint64 productVendorRows = rows["productVendors"].toInteger();
+        std::vector<DatabaseHandler::ProductVendor> productVendors;
+        productVendors.reserve(productVendorRows);
+        for(qint64 i = 0; i < productVendorRows; ++i)
+        {
+            productVendors.push_back({ scaleUsbId(i), QString("Product %1").arg(i), scaleUsbId(i >> 16), QString("Vendor %1").arg(i) });
+        }
+        timer.start();
+        const int importedProductVendors = m_DBHandler->registerProductVendors(productVendors);
+        const double importSeconds = timer.nsecsElapsed() / 1e9;
+        productVendors.clear();
+        TEST_VERIFY(importedProductVendors == productVendorRows);
+        DatabaseHandler::ProductVendor productVendor;
+        TEST_VERIFY(m_DBHandler->getProductVendor(productVendor, scaleUsbId(productVendorRows - 1), scaleUsbId((productVendorRows - 1) >> 16)));
+        withinBudget &= checkBudget(budgets, "importProductVendorsSeconds", importSeconds, tolerance, measurements);
+
+        // Virus hash lookups, every other one misses
+        const qint64 virusHashRows = rows["virusHashes"].toInteger();
+        for(qint64 chunk = 0; chunk < virusHashRows; chunk += SCALE_CHUNK_SIZE)
+        {
+            std::vector<DatabaseHandler::VirusHash> virusHashes;
+            for(qint64 i = chunk; i < qMin(chunk + SCALE_CHUNK_SIZE, virusHashRows); ++i)
+            {
+                virusHashes.push_back({ scaleVirusHash(i), QString("Virus %1").arg(i) });
+            }
+            m_DBHandler->registerVirusHashes(virusHashes);
+        }
+        std::vector<qint64> latencies;
+        latencies.reserve(SCALE_LOOKUPS);
+        int wrongVirusHashResults = 0;
+        for(int i = 0; i < SCALE_LOOKUPS; ++i)
+        {
+            const bool expected = i % 2 == 0;
+            const QString hash = scaleVirusHash(expected ? (i * SCALE_KEY_STRIDE) % virusHashRows : -i - 1);
+            timer.restart();
+            const bool found = m_DBHandler->isHashInVirusDatabase(hash);
+            latencies.push_back(timer.nsecsElapsed());
+            wrongVirusHashResults += found != expected ? 1 : 0;
+        }
+        TEST_VERIFY(wrongVirusHashResults == 0);
+        withinBudget &= checkBudget(budgets, "isHashInVirusDatabaseP99Us", p99Microseconds(latencies), tolerance, measurements);
+
+        // Memory and lookup speed of the virus hash index on its own, with random digests
+        withinBudget &= testVirusHashIndexPerformance(rows["virusHashIndexSignatures"].toInteger(), budgets, tolerance, measurements);
+
+        // Device lookups and status checks, every tenth Device is blacklisted
+        const qint64 deviceRows = rows["devices"].toInteger();
+        for(qint64 chunk = 0; chunk < deviceRows; chunk += SCALE_CHUNK_SIZE)
+        {
+            m_DBHandler->beginTransaction();
+            for(qint64 i = chunk; i < qMin(chunk + SCALE_CHUNK_SIZE, deviceRows); ++i)
+            {
+                m_DBHandler->registerDevice(scaleUsbId(i), scaleUsbId(i >> 16), QString("SN%1").arg(i));
+                if(i % 10 == 0)
+                {
+                    m_DBHandler->setDeviceBlacklisted(scaleUsbId(i), scaleUsbId(i >> 16), QString("SN%1").arg(i));
+                }
+            }
+            m_DBHandler->commitTransaction();
+        }
+        latencies.clear();
+        std::vector<qint64> statusLatencies;
+        statusLatencies.reserve(SCALE_LOOKUPS);
+        int wrongDeviceResults = 0;
+        DatabaseHandler::Device device;
+        for(int i = 0; i < SCALE_LOOKUPS; ++i)
+        {
+            const qint64 key = (i * SCALE_KEY_STRIDE) % deviceRows;
+            const QString productId = scaleUsbId(key);
+            const QString vendorId = scaleUsbId(key >> 16);
+            const QString serialNumber = QString("SN%1").arg(key);
+
+            timer.restart();
+            const bool found = m_DBHandler->getDevice(device, productId, vendorId, serialNumber);
+            latencies.push_back(timer.nsecsElapsed());
+
+            timer.restart();
+            const bool blacklisted = m_DBHandler->isDeviceBlackListed(productId, vendorId, serialNumber);
+            statusLatencies.push_back(timer.nsecsElapsed());
+
+            wrongDeviceResults += (!found || blacklisted != (key % 10 == 0)) ? 1 : 0;
+        }
+        TEST_VERIFY(wrongDeviceResults == 0);
+        withinBudget &= checkBudget(budgets, "getDeviceP99Us", p99Microseconds(latencies), tolerance, measurements);
+        withinBudget &= checkBudget(budgets, "isDeviceBlackListedP99Us", p99Microseconds(statusLatencies), tolerance, measurements);
+
+        // Status checks of a Device in the device cache, timed together as a single one is below the timer resolution
+        const QString cachedProductId = scaleUsbId(deviceRows - 1);
+        const QString cachedVendorId = scaleUsbId((deviceRows - 1) >> 16);
+        const QString cachedSerialNumber = QString("SN%1").arg(deviceRows - 1);
+        TEST_VERIFY(m_DBHandler->getDeviceStatus(cachedProductId, cachedVendorId, cachedSerialNumber) != DatabaseHandler::DeviceStatus::NotRegistered);
+        timer.restart();
+        for(int i = 0; i < SCALE_LOOKUPS; ++i)
+        {
+            m_DBHandler->getDeviceStatus(cachedProductId, cachedVendorId, cachedSerialNumber);
+        }
+        withinBudget &= checkBudget(budgets, "cachedDeviceStatusNs", static_cast<double>(timer.nsecsElapsed()) / SCALE_LOOKUPS, tolerance, measurements);
+
+        // The results use the layout of the baseline, so they can be checked in as the new baseline
+        QJsonObject results;
+        results["tolerance"] = baseline["tolerance"];
+        results["rows"] = rows;
+        results["budgets"] = measurements;
+        const QByteArray resultsJson = QJsonDocument(results).toJson(QJsonDocument::Indented);
+        qCritical().noquote() << resultsJson;
+        if(!a_resultsPath.isEmpty())
+        {
+            QFile resultsFile(a_resultsPath);
+            if(!resultsFile.open(QIODevice::WriteOnly | QIODevice::Truncate) || resultsFile.write(resultsJson) != resultsJson.size())
+            {
+                qWarning() << __PRETTY_FUNCTION__ << "Failed to write the results to" << a_resultsPath;
+            }
+        }
+
+        if(!withinBudget)
+        {
+            throw std::runtime_error("Performance regressed beyond the tolerance of the baseline");
+        }
+
+        qCritical() << __PRETTY_FUNCTION__ << "Completed successfully";
+    }
+    catch(std::exception& e)
+    {
+        qFatal("testCaseScale failed with exception = %s", e.what());
+    }
+}
+
+//!
+//! \brief The checkBudget function
+//! Helper function comparing a measurement with its budget. Returns false when the budget is exceeded by more than the tolerance
+//!
+bool TestHandler::checkBudget(const QJsonObject &a_baseline, const QString &a_metric, double a_measured, double a_tolerance, QJsonObject &a_results)
+{
+    a_results[a_metric] = a_measured;
+
+    const double budget = a_baseline[a_metric].toDouble();
+    if(budget <= 0)
+    {
+        qWarning() << __PRETTY_FUNCTION__ << "No budget for" << a_metric << ", measured" << a_measured;
+        return true;
+    }
+
+    if(a_measured > budget * (1.0 + a_tolerance))
+    {
+        qCritical() << __PRETTY_FUNCTION__ << a_metric << "measured" << a_measured << "exceeds the budget of" << budget
+                    << "by more than" << a_tolerance * 100 << "%";
+        return false;
+    }
+
+    qCritical() << __PRETTY_FUNCTION__ << a_metric << "measured" << a_measured << "within the budget of" << budget;
+    return true;
 }
 
 //!
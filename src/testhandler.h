@@ -1,7 +1,26 @@
 #pragma once
 #include <QString>
 
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+//!
+//! \brief The TEST_VERIFY macro
+//! Checks a test condition in every build type, unlike Q_ASSERT which is compiled out of release builds.
+//! A failing check throws, so the test case reports it through its exception handler
+//!
+#define TEST_VERIFY(a_condition) \
+    do \
+    { \
+        if(!(a_condition)) \
+        { \
+            throw std::runtime_error(std::string("Check failed: " #a_condition " at " __FILE__ ":") + std::to_string(__LINE__)); \
+        } \
+    } while(false)
+
 class DatabaseHandler;
+class QJsonObject;
 //!
 //! \brief The TestHandler class
 //! A class used to test and verify the databasehandler API and its queries.
@@ -9,7 +28,13 @@ class DatabaseHandler;
 class TestHandler
 {
 public:
+    // Retrieves the number of heap allocations made by the calling thread so far
+    using AllocationCounter = std::function<quint64()>;
+
     TestHandler(const QString& a_databasePath);
+    ~TestHandler();
+
+    void setAllocationCounter(AllocationCounter a_allocationCounter);
 
     void testCaseEdgeNode();
     void testVirus();
@@ -17,9 +42,23 @@ public:
     void testCaseDevice(bool a_requiredDataExists = false);
     void testCaseConnectedDevice(bool a_requiredDataExists = false);
     void testCaseLog(bool a_requiredDataExists = false);
+    void testCasePreparedQueryCache();
+    void testCaseConnectionPool();
+    void testCaseAsync();
+    void testCaseOperationMetrics();
+    void testCaseIngestMetrics();
+    void testCaseMessageDecoder();
+    void testCaseSchema();
+    void testCaseCompactIds();
+    void testCaseCompactLayout();
     void testCaseAll();
+    void testCaseScale(const QString& a_baselinePath, const QString& a_resultsPath = "");
 
 private:
     bool checkString(const QString& a_query, const QString& a_target1, const QString& a_target2, const QString& a_target3);
+    bool checkBudget(const QJsonObject& a_baseline, const QString& a_metric, double a_measured, double a_tolerance, QJsonObject& a_results);
+    bool testVirusHashIndexPerformance(qint64 a_signatureCount, const QJsonObject& a_baseline, double a_tolerance, QJsonObject& a_results);
     DatabaseHandler* m_DBHandler;
+    QString m_DatabasePath;
+    AllocationCounter m_AllocationCounter;
 };
@@ -0,0 +1,215 @@
+#include "timestamp.h"
+
+#include <QDate>
+#include <QDateTime>
+#include <QTimeZone>
+
+#include <chrono>
+
+namespace
+{
+   constexpr qint64 MICROSECONDS_PER_SECOND = 1000000;
+   constexpr qint64 SECONDS_PER_DAY = 86400;
+
+   bool readNumber(QStringView a_text, qsizetype a_position, int a_digits, int& a_value)
+   {
+      if(a_position + a_digits > a_text.size())
+      {
+         return false;
+      }
+
+      int value = 0;
+      for(int i = 0; i < a_digits; ++i)
+      {
+         const char16_t character = a_text[a_position + i].unicode();
+         if(character < u'0' || character > u'9')
+         {
+            return false;
+         }
+         value = value * 10 + (character - u'0');
+      }
+      a_value = value;
+      return true;
+   }
+
+   //!
+   //! \brief The daysFromCivil and civilFromDays functions
+   //! Convert between proleptic Gregorian dates and days since 1970-01-01 without going through QDateTime
+   //!
+   qint64 daysFromCivil(int a_year, int a_month, int a_day)
+   {
+      const qint64 year = a_year - (a_month <= 2 ? 1 : 0);
+      const qint64 era = (year >= 0 ? year : year - 399) / 400;
+      const qint64 yearOfEra = year - era * 400;
+      const qint64 dayOfYear = (153 * (a_month + (a_month > 2 ? -3 : 9)) + 2) / 5 + a_day - 1;
+      const qint64 dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+      return era * 146097 + dayOfEra - 719468;
+   }
+
+   void civilFromDays(qint64 a_days, int& a_year, int& a_month, int& a_day)
+   {
+      a_days += 719468;
+      const qint64 era = (a_days >= 0 ? a_days : a_days - 146096) / 146097;
+      const qint64 dayOfEra = a_days - era * 146097;
+      const qint64 yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+      const qint64 dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+      const qint64 monthIndex = (5 * dayOfYear + 2) / 153;
+      a_day = static_cast<int>(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+      a_month = static_cast<int>(monthIndex < 10 ? monthIndex + 3 : monthIndex - 9);
+      a_year = static_cast<int>(yearOfEra + era * 400 + (a_month <= 2 ? 1 : 0));
+   }
+
+   //!
+   //! \brief The parseCanonical function
+   //! Parses "yyyy-MM-dd HH:mm:ss" with an optional fraction of up to six digits and an optional 'Z'.
+   //! A 'T' is accepted in place of the space
+   //!
+   bool parseCanonical(QStringView a_text, qint64& a_microseconds)
+   {
+      int year, month, day, hour, minute, second;
+      if(a_text.size() < 19 ||
+         !readNumber(a_text, 0, 4, year) || a_text[4] != u'-' ||
+         !readNumber(a_text, 5, 2, month) || a_text[7] != u'-' ||
+         !readNumber(a_text, 8, 2, day) || (a_text[10] != u' ' && a_text[10] != u'T') ||
+         !readNumber(a_text, 11, 2, hour) || a_text[13] != u':' ||
+         !readNumber(a_text, 14, 2, minute) || a_text[16] != u':' ||
+         !readNumber(a_text, 17, 2, second))
+      {
+         return false;
+      }
+      if(!QDate::isValid(year, month, day) || hour > 23 || minute > 59 || second > 59)
+      {
+         return false;
+      }
+
+      qsizetype position = 19;
+      qint64 fraction = 0;
+      if(position < a_text.size() && a_text[position] == u'.')
+      {
+         ++position;
+         int digits = 0;
+         while(position < a_text.size() && a_text[position].isDigit())
+         {
+            if(digits == 6)
+            {
+               return false;
+            }
+            fraction = fraction * 10 + a_text[position].digitValue();
+            ++digits;
+            ++position;
+         }
+         if(digits == 0)
+         {
+            return false;
+         }
+         for(; digits < 6; ++digits)
+         {
+            fraction *= 10;
+         }
+      }
+      if(position < a_text.size() && a_text[position] == u'Z')
+      {
+         ++position;
+      }
+      if(position != a_text.size())
+      {
+         return false;
+      }
+
+      const qint64 seconds = daysFromCivil(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+      a_microseconds = seconds * MICROSECONDS_PER_SECOND + fraction;
+      return true;
+   }
+}
+
+//!
+//! \brief The parse static function
+//! Parses a timestamp in the canonical form, any ISO 8601 form Qt understands, or the legacy Qt text date form.
+//! Timestamps without a time zone are taken as UTC
+//!
+bool Timestamp::parse(QStringView a_text, qint64& a_microseconds)
+{
+   if(parseCanonical(a_text, a_microseconds))
+   {
+      return true;
+   }
+
+   const QString text = a_text.toString();
+   QDateTime dateTime = QDateTime::fromString(text, Qt::ISODateWithMs);
+   if(!dateTime.isValid())
+   {
+      dateTime = QDateTime::fromString(text, Qt::TextDate);
+   }
+   if(!dateTime.isValid())
+   {
+      return false;
+   }
+
+   if(dateTime.timeSpec() == Qt::LocalTime)
+   {
+      dateTime = QDateTime(dateTime.date(), dateTime.time(), QTimeZone::utc());
+   }
+   a_microseconds = fromDateTime(dateTime);
+   return true;
+}
+
+//!
+//! \brief The toText static function
+//! Formats epoch microseconds in the canonical form. Microseconds are only written when they are not zero
+//!
+QString Timestamp::toText(qint64 a_microseconds)
+{
+   qint64 seconds = a_microseconds / MICROSECONDS_PER_SECOND;
+   qint64 fraction = a_microseconds % MICROSECONDS_PER_SECOND;
+   if(fraction < 0)
+   {
+      --seconds;
+      fraction += MICROSECONDS_PER_SECOND;
+   }
+   qint64 days = seconds / SECONDS_PER_DAY;
+   qint64 secondOfDay = seconds % SECONDS_PER_DAY;
+   if(secondOfDay < 0)
+   {
+      --days;
+      secondOfDay += SECONDS_PER_DAY;
+   }
+
+   int year, month, day;
+   civilFromDays(days, year, month, day);
+
+   QString text = QString::asprintf("%04d-%02d-%02d %02d:%02d:%02d.%03d", year, month, day,
+                                    static_cast<int>(secondOfDay / 3600), static_cast<int>(secondOfDay / 60 % 60),
+                                    static_cast<int>(secondOfDay % 60), static_cast<int>(fraction / 1000));
+   if(fraction % 1000 != 0)
+   {
+      text.append(QString::asprintf("%03d", static_cast<int>(fraction % 1000)));
+   }
+   return text;
+}
+
+//!
+//! \brief The fromDateTime static function
+//! Converts a QDateTime to epoch microseconds
+//!
+qint64 Timestamp::fromDateTime(const QDateTime& a_dateTime)
+{
+   return a_dateTime.toMSecsSinceEpoch() * 1000;
+}
+
+//!
+//! \brief The now static function
+//! Returns the current time in epoch microseconds
+//!
+qint64 Timestamp::now()
+{
+   return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//!
+//! \brief The nowText static function
+//! Returns the current time in the canonical text form
+//!
+QString Timestamp::nowText()
+{
+   return toText(now());
+}
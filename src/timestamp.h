@@ -0,0 +1,19 @@
+#pragma once
+#include <QString>
+#include <QStringView>
+
+class QDateTime;
+//!
+//! \brief The Timestamp class
+//! Converts between the text timestamps of the API and the UTC epoch microseconds stored in the database.
+//! The canonical text form is "yyyy-MM-dd HH:mm:ss.zzz" in UTC, which sorts chronologically
+//!
+class Timestamp
+{
+public:
+    static bool parse(QStringView a_text, qint64& a_microseconds);
+    static QString toText(qint64 a_microseconds);
+    static qint64 fromDateTime(const QDateTime& a_dateTime);
+    static qint64 now();
+    static QString nowText();
+};
@@ -0,0 +1,286 @@
+#include "virushashindex.h"
+
+#include <QCryptographicHash>
+
+namespace
+{
+   constexpr qsizetype MINIMUM_CAPACITY = 1024;
+   constexpr int BLOOM_BITS_PER_SLOT = 5; // Slots are at most half used, so this gives at least 10 bits per hash
+   constexpr int BLOOM_PROBES = 7;
+
+   //!
+   //! \brief The hexValue function
+   //! Converts a lowercase hex character, returns -1 for anything else
+   //!
+   int hexValue(char16_t a_character)
+   {
+      if(a_character >= u'0' && a_character <= u'9')
+      {
+         return a_character - u'0';
+      }
+      if(a_character >= u'a' && a_character <= u'f')
+      {
+         return a_character - u'a' + 10;
+      }
+      return -1;
+   }
+
+   quint64 readBigEndian(const char* a_bytes)
+   {
+      quint64 value = 0;
+      for(int i = 0; i < 8; ++i)
+      {
+         value = (value << 8) | static_cast<quint8>(a_bytes[i]);
+      }
+      return value;
+   }
+
+   //!
+   //! \brief The mix function
+   //! Finalizer of SplitMix64, spreads the digest bits before they are used as table and Bloom filter positions
+   //!
+   quint64 mix(quint64 a_value)
+   {
+      a_value ^= a_value >> 30;
+      a_value *= 0xbf58476d1ce4e5b9ULL;
+      a_value ^= a_value >> 27;
+      a_value *= 0x94d049bb133111ebULL;
+      a_value ^= a_value >> 31;
+      return a_value;
+   }
+}
+
+//!
+//! \brief The digest static function
+//! Reduces a virus hash to its fixed-width binary form
+//!
+VirusHashIndex::Digest VirusHashIndex::digest(const QString& a_hash)
+{
+   Digest result;
+
+   if(a_hash.size() == 32)
+   {
+      bool isHex = true;
+      for(int i = 0; i < 32 && isHex; ++i)
+      {
+         const int value = hexValue(a_hash[i].unicode());
+         if(value < 0)
+         {
+            isHex = false;
+         }
+         else if(i < 16)
+         {
+            result.high = (result.high << 4) | static_cast<quint64>(value);
+         }
+         else
+         {
+            result.low = (result.low << 4) | static_cast<quint64>(value);
+         }
+      }
+
+      if(isHex)
+      {
+         return result;
+      }
+   }
+
+   const QByteArray md5 = QCryptographicHash::hash(a_hash.toUtf8(), QCryptographicHash::Md5);
+   result.high = readBigEndian(md5.constData());
+   result.low = readBigEndian(md5.constData() + 8);
+   return result;
+}
+
+//!
+//! \brief The reserve function
+//! Makes room for a_count hashes without further rehashing
+//!
+void VirusHashIndex::reserve(qsizetype a_count)
+{
+   QWriteLocker locker(&m_Lock);
+   qsizetype capacity = MINIMUM_CAPACITY;
+   while(capacity < a_count * 2)
+   {
+      capacity *= 2;
+   }
+
+   if(capacity > static_cast<qsizetype>(m_Slots.size()))
+   {
+      rehash(capacity);
+   }
+}
+
+//!
+//! \brief The insert function
+//! Adds a hash to the index. Inserting an existing hash is a no-op
+//!
+void VirusHashIndex::insert(const QString& a_hash)
+{
+   insert(digest(a_hash));
+}
+
+void VirusHashIndex::insert(const Digest& a_digest)
+{
+   QWriteLocker locker(&m_Lock);
+   insertDigest(a_digest);
+}
+
+//!
+//! \brief The insertDigest function
+//! Helper function to add a digest while the write lock is held
+//!
+void VirusHashIndex::insertDigest(const Digest& a_digest)
+{
+   if(a_digest.isEmpty())
+   {
+      m_ContainsEmptyDigest = true;
+      return;
+   }
+
+   if((m_Size + 1) * 2 > static_cast<qsizetype>(m_Slots.size()))
+   {
+      rehash(qMax(MINIMUM_CAPACITY, static_cast<qsizetype>(m_Slots.size()) * 2));
+   }
+
+   quint64 slot = mix(a_digest.low) & m_SlotMask;
+   while(!m_Slots[slot].isEmpty())
+   {
+      if(m_Slots[slot] == a_digest)
+      {
+         return;
+      }
+      slot = (slot + 1) & m_SlotMask;
+   }
+
+   m_Slots[slot] = a_digest;
+   addToBloomFilter(a_digest);
+   ++m_Size;
+}
+
+//!
+//! \brief The contains function
+//! Checks if a hash is in the index
+//!
+bool VirusHashIndex::contains(const QString& a_hash) const
+{
+   return contains(digest(a_hash));
+}
+
+bool VirusHashIndex::contains(const Digest& a_digest) const
+{
+   QReadLocker locker(&m_Lock);
+   if(a_digest.isEmpty())
+   {
+      return m_ContainsEmptyDigest;
+   }
+
+   if(m_Size == 0 || !mightContain(a_digest))
+   {
+      return false;
+   }
+
+   quint64 slot = mix(a_digest.low) & m_SlotMask;
+   while(!m_Slots[slot].isEmpty())
+   {
+      if(m_Slots[slot] == a_digest)
+      {
+         return true;
+      }
+      slot = (slot + 1) & m_SlotMask;
+   }
+
+   return false;
+}
+
+//!
+//! \brief The clear function
+//! Removes every hash and releases the memory of the index
+//!
+void VirusHashIndex::clear()
+{
+   QWriteLocker locker(&m_Lock);
+   std::vector<Digest>().swap(m_Slots);
+   std::vector<quint64>().swap(m_BloomFilter);
+   m_SlotMask = 0;
+   m_BloomBitMask = 0;
+   m_Size = 0;
+   m_ContainsEmptyDigest = false;
+}
+
+qsizetype VirusHashIndex::size() const
+{
+   QReadLocker locker(&m_Lock);
+   return m_Size + (m_ContainsEmptyDigest ? 1 : 0);
+}
+
+//!
+//! \brief The memoryUsage function
+//! Retrieves the number of bytes allocated by the table and the Bloom filter
+//!
+qsizetype VirusHashIndex::memoryUsage() const
+{
+   QReadLocker locker(&m_Lock);
+   return static_cast<qsizetype>(m_Slots.capacity() * sizeof(Digest) + m_BloomFilter.capacity() * sizeof(quint64));
+}
+
+//!
+//! \brief The rehash function
+//! Helper function to grow the table and rebuild the Bloom filter to match
+//!
+void VirusHashIndex::rehash(qsizetype a_capacity)
+{
+   std::vector<Digest> oldSlots(static_cast<std::size_t>(a_capacity));
+   oldSlots.swap(m_Slots);
+   m_SlotMask = static_cast<quint64>(a_capacity - 1);
+
+   const qsizetype bloomBits = a_capacity * BLOOM_BITS_PER_SLOT;
+   qsizetype bloomWords = 1;
+   while(bloomWords * 64 < bloomBits)
+   {
+      bloomWords *= 2;
+   }
+   m_BloomFilter.assign(static_cast<std::size_t>(bloomWords), 0);
+   m_BloomBitMask = static_cast<quint64>(bloomWords * 64 - 1);
+
+   m_Size = 0;
+   for(const Digest& digest : oldSlots)
+   {
+      if(!digest.isEmpty())
+      {
+         insertDigest(digest);
+      }
+   }
+}
+
+//!
+//! \brief The addToBloomFilter function
+//! Helper function setting the Bloom filter bits of a digest using double hashing
+//!
+void VirusHashIndex::addToBloomFilter(const Digest& a_digest)
+{
+   const quint64 first = mix(a_digest.high);
+   const quint64 second = mix(a_digest.low ^ a_digest.high) | 1;
+   for(int i = 0; i < BLOOM_PROBES; ++i)
+   {
+      const quint64 bit = (first + i * second) & m_BloomBitMask;
+      m_BloomFilter[bit >> 6] |= (1ULL << (bit & 63));
+   }
+}
+
+//!
+//! \brief The mightContain function
+//! Helper function checking the Bloom filter. A false result means the digest is definitely not indexed
+//!
+bool VirusHashIndex::mightContain(const Digest& a_digest) const
+{
+   const quint64 first = mix(a_digest.high);
+   const quint64 second = mix(a_digest.low ^ a_digest.high) | 1;
+   for(int i = 0; i < BLOOM_PROBES; ++i)
+   {
+      const quint64 bit = (first + i * second) & m_BloomBitMask;
+      if((m_BloomFilter[bit >> 6] & (1ULL << (bit & 63))) == 0)
+      {
+         return false;
+      }
+   }
+   return true;
+}
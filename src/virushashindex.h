@@ -0,0 +1,57 @@
+#pragma once
+#include <QReadWriteLock>
+#include <QString>
+#include <QtGlobal>
+
+#include <vector>
+
+//!
+//! \brief The VirusHashIndex class
+//! An in-memory set of virus hashes used to answer isHashInVirusDatabase without querying SQLite.
+//! Every hash is reduced to a fixed-width 128 bit digest: hashes written as 32 lowercase hex characters (MD5)
+//! are decoded directly, anything else is digested with MD5 first.
+//! Digests are stored in a linear probing open-addressing table kept at most half full,
+//! fronted by a Bloom filter with ~10 bits and 7 probes per hash (~1% false positives), so most misses
+//! are answered without touching the table at all.
+//! Memory per signature is 16 byte slots / load factor (32-64 bytes) plus ~1.25 bytes of Bloom filter.
+//! The scale tests check the measured numbers against the performance baseline.
+//! Lookups may run on any thread. They share a read lock, while inserting takes the write lock
+//!
+class VirusHashIndex
+{
+public:
+    struct Digest
+    {
+        quint64 high = 0;
+        quint64 low = 0;
+
+        bool operator==(const Digest& a_other) const { return high == a_other.high && low == a_other.low; }
+        bool isEmpty() const { return high == 0 && low == 0; }
+    };
+
+    static Digest digest(const QString& a_hash);
+
+    void reserve(qsizetype a_count);
+    void insert(const QString& a_hash);
+    void insert(const Digest& a_digest);
+    bool contains(const QString& a_hash) const;
+    bool contains(const Digest& a_digest) const;
+    void clear();
+
+    qsizetype size() const;
+    qsizetype memoryUsage() const;
+
+private:
+    void insertDigest(const Digest& a_digest);
+    void rehash(qsizetype a_capacity);
+    void addToBloomFilter(const Digest& a_digest);
+    bool mightContain(const Digest& a_digest) const;
+
+    std::vector<Digest> m_Slots;
+    std::vector<quint64> m_BloomFilter;
+    quint64 m_SlotMask = 0;
+    quint64 m_BloomBitMask = 0;
+    qsizetype m_Size = 0;
+    bool m_ContainsEmptyDigest = false; // The all-zero digest marks empty slots, so it is tracked separately
+    mutable QReadWriteLock m_Lock;
+};
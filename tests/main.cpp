@@ -0,0 +1,88 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QTemporaryDir>
+
+#include <testhandler.h>
+
+#if defined(__GLIBC__)
+#include <cstddef>
+
+//
+// Counts the heap allocations of every thread. Qt allocates its containers with malloc and operator new ends
+// in malloc too, so replacing the glibc allocation functions sees both. They match the noexcept declarations of <cstdlib>
+//
+extern "C"
+{
+    void* __libc_malloc(size_t a_size);
+    void* __libc_calloc(size_t a_count, size_t a_size);
+    void* __libc_realloc(void* a_pointer, size_t a_size);
+}
+
+namespace
+{
+    thread_local quint64 allocations = 0;
+}
+
+extern "C"
+{
+    void* malloc(size_t a_size) noexcept
+    {
+        ++allocations;
+        return __libc_malloc(a_size);
+    }
+
+    void* calloc(size_t a_count, size_t a_size) noexcept
+    {
+        ++allocations;
+        return __libc_calloc(a_count, a_size);
+    }
+
+    void* realloc(void* a_pointer, size_t a_size) noexcept
+    {
+        ++allocations;
+        return __libc_realloc(a_pointer, a_size);
+    }
+}
+#endif
+
+//
+// Test executable of the databasehandler
+// Runs every test case against a fresh database. With --scale it also loads large synthetic datasets and fails
+// when a measured timing exceeds the budget of the baseline file by more than its tolerance.
+// On glibc the heap allocations are counted, so the message decoder test can check its allocation bound.
+// A failing test case aborts the process, so the exit code reports the result
+//
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Tests the databasehandler");
+    parser.addHelpOption();
+    parser.addOption({ "scale", "Also run the scale tests and compare their timings with the baseline." });
+    parser.addOption({ "baseline", "Performance baseline to compare with.", "path", PERFORMANCE_BASELINE });
+    parser.addOption({ "results", "File to write the measured timings to, in the layout of the baseline.", "path" });
+    parser.addOption({ "directory", "Directory for the test databases. Defaults to a temporary directory.", "path" });
+    parser.process(app);
+
+    QTemporaryDir temporaryDir;
+    const QString directory = parser.isSet("directory") ? parser.value("directory") : temporaryDir.path();
+    QDir().mkpath(directory);
+
+    {
+        TestHandler testHandler(QDir(directory).filePath("testcases.db"));
+#if defined(__GLIBC__)
+        testHandler.setAllocationCounter([]() { return allocations; });
+#endif
+        testHandler.testCaseAll();
+    }
+
+    if(parser.isSet("scale"))
+    {
+        TestHandler scaleHandler(QDir(directory).filePath("scale.db"));
+        scaleHandler.testCaseScale(parser.value("baseline"), parser.value("results"));
+    }
+
+    return 0;
+}
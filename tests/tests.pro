@@ -0,0 +1,24 @@
+QT -= gui
+QT += sql mqtt
+
+CONFIG += c++2a console
+CONFIG -= app_bundle
+
+TARGET = databasehandlertests
+
+DEFINES += PERFORMANCE_BASELINE=\\\"$$PWD/performance_baseline.json\\\"
+
+INCLUDEPATH += $$PWD/../src
+
+DEPENDPATH += $$PWD/../../messagehandler/lib/include
+INCLUDEPATH += $$PWD/../../messagehandler/lib/include
+LIBS += -L$$PWD/../../messagehandler/lib -lmessagehandler
+
+include($$PWD/../src/databasehandler.pri)
+
+SOURCES += \
+    main.cpp \
+    $$PWD/../src/testhandler.cpp
+
+HEADERS += \
+    $$PWD/../src/testhandler.h